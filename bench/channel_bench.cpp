@@ -0,0 +1,523 @@
+// Serial framing benchmark and fuzz harness, runs on Linux only
+// For every error model(see serial_channel.h) and framing, a stream of DATA frames goes through a SerialChannel
+// into the parser and it reports:
+//   recovered - frames that came out intact, of those sent
+//   bad       - frames with a matching CRC but the wrong contents
+//   goodput   - payload bytes recovered per byte on the line, and what that is at 1152000 baud
+//   resync    - line time from the start of a lost frame to the start of the next recovered one,
+//               averaged over every run of lost frames
+//   decode    - parser time per frame byte
+// and for dumb_serial and FEC the chunks or codewords they repaired
+// Times are in TSC cycles on x86, which tick at the nominal clock rather than the core's, elsewhere in ns
+// CHANNEL_BENCH_MODEL=spec runs just that model, CHANNEL_BENCH_FUZZ=N checks N random inputs instead(see fuzz_one)
+// pio run -e channel_bench && .pio/build/channel_bench/program
+// The same checks as a libFuzzer target, without the native HAL:
+// clang -c -fsanitize=fuzzer,address src/dumb_serial.c && clang++ -fsanitize=fuzzer,address -DCHANNEL_BENCH_LIBFUZZER
+//   -Isrc -Ilib/native_hal bench/channel_bench.cpp src/packet_framing.cpp src/fec.cpp src/retransmit.cpp src/crc16.cpp src/log.cpp
+//   src/latency.cpp src/histogram.cpp lib/native_hal/serial_channel.cpp dumb_serial.o -o channel_fuzz
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#include <Arduino.h>
+#include <serial_channel.h>
+
+#include "dumb_serial.h"
+#include "fec.h"
+#include "packet_framing.h"
+#include "uart.h"
+
+#define FRAMES_PER_RUN 20000
+// Bytes handed to the parser at a time, a few RX FIFO interrupts worth
+#define PARSE_CHUNK 64
+#define LINE_BAUD 1152000
+#define LOCAL_PORT 6969
+// dumb_serial turns every 7 bytes into 9, and each of those can be escaped into 2
+#define CODEC_MAX_ENCODED(n) (2 + (((n) + 6) / 7) * 18)
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+// Frame type, length, sequence number, DATA header and CRC around every payload
+#define DATA_FRAME_OVERHEAD 12
+
+struct Framing {
+    const char* name;
+    uint8_t mode;
+    // FRAMING_FEC only
+    uint8_t parity, length;
+};
+
+static const Framing FRAMINGS[] = {
+    {"preamble", FRAMING_PREAMBLE, 0, 0},
+    {"dumb_serial", FRAMING_DUMB_SERIAL, 0, 0},
+#if FRAME_FEC
+    {"fec 2/16", FRAMING_FEC, 2, 16},
+    {"fec 4/32", FRAMING_FEC, 4, 32},
+    {"fec 4/16", FRAMING_FEC, 4, 16},
+    {"fec 8/32", FRAMING_FEC, 8, 32},
+#endif
+};
+
+// Line order, each model on its own seed
+static const char* const MODELS[] = {
+    "",
+    "drop=0.0001",
+    "drop=0.001",
+    "flip=0.0001",
+    "flip=0.001",
+    "garbage=0.0001",
+    "burst=0.00001:32",
+    "text=0.0001",
+    "drop=0.0002,flip=0.0002,garbage=0.0001,burst=0.000005:16,text=0.00005",
+};
+
+// Everything the framing code sends, it has no other way out
+static std::vector<uint8_t> txCapture;
+
+void uart_tx_write(const uint8_t* data, size_t len) {
+    txCapture.insert(txCapture.end(), data, data + len);
+}
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Payload of frame seq: seq(4), then bytes that only depend on seq, so every frame can be checked on its own
+static uint16_t make_payload(uint32_t seq, uint8_t* out) {
+    uint32_t state = seq * 2654435761u + 1;
+    uint16_t len = 20 + xorshift(&state) % 100;
+    // Now and then a full size one
+    if ((seq % 16) == 15)
+        len = FRAGMENT_SIZE;
+    memcpy(out, &seq, 4);
+    for (uint16_t i = 4; i < len; i++)
+        out[i] = xorshift(&state);
+    return len;
+}
+
+static bool payload_matches(const uint8_t* data, uint16_t len, const FrameInfo& info, uint32_t frameCount, uint32_t* seq) {
+    if (len < 4)
+        return false;
+    memcpy(seq, data, 4);
+    if (*seq >= frameCount)
+        return false;
+    uint8_t expected[FRAGMENT_SIZE];
+    uint16_t expectedLen = make_payload(*seq, expected);
+    return (info.type == FRAME_TYPE_DATA) && (info.address == (*seq % 10)) && (info.localPort == LOCAL_PORT) &&
+           (len == expectedLen) && (memcmp(data, expected, len) == 0);
+}
+
+
+// Parity 1-8 and a codeword length that goes with it, both from one byte
+static void fuzz_profile(uint8_t param, uint8_t* parity, uint8_t* length) {
+    *parity = 1 + param % FEC_MAX_PARITY;
+    *length = 2 * *parity + (param / FEC_MAX_PARITY) % (FEC_MAX_CODEWORD - 2 * *parity + 1);
+}
+
+static std::vector<uint8_t> fecCapture;
+
+static void fec_capture_write(const uint8_t* data, size_t len) {
+    fecCapture.insert(fecCapture.end(), data, data + len);
+}
+
+// Fuzz targets, the first byte picks one
+// 0: read_process_byte with random input never writes past its buffer and only returns lengths that fit
+// 1: write_process_bytes/write_end_frame output fits the bound, only has frame markers at its ends
+//    and read_process_byte turns it back into the input, however the input is split up
+// 2: parse_frame with random input always makes progress, never hands back more than it could have and
+//    never overruns anything
+// 3: fec_decode repairs any mix of e wrong and f lost bytes with 2e + f <= parity, and never changes more than
+//    parity bytes of a codeword with more
+// 4: FecEncoder output fits max_encoded_size, only has frame markers at its ends and FecDecoder turns it back
+//    into the input, also with one symbol left out as long as there are 2 parity bytes
+static void fuzz_one(const uint8_t* data, size_t size) {
+    if (size < 2)
+        return;
+    uint8_t target = data[0] % 5;
+    uint8_t param = data[1];
+    data += 2;
+    size -= 2;
+
+    if (target == 0) {
+        size_t bufferSize = 1 + param % 64;
+        // Guard bytes after the buffer for builds without ASan
+        std::vector<uint8_t> buffer(bufferSize + 16, 0xA5);
+        read_state_t reader;
+        init_read_state(&reader, buffer.data(), bufferSize);
+        for (size_t i = 0; i < size; i++) {
+            size_t ret = read_process_byte(&reader, data[i]);
+            CHECK((ret == NOT_COMPLETE) || (ret == NOT_COMPLETE_FRAME_START) || (ret == NOT_DATA) ||
+                  (ret == IGNORED_FRAME_END) || (ret <= bufferSize));
+            if ((i % 97) == 96)
+                read_reset_buffer(&reader);
+        }
+        for (size_t i = bufferSize; i < buffer.size(); i++)
+            CHECK(buffer[i] == 0xA5);
+        return;
+    }
+
+    if (target == 1) {
+        size_t bound = CODEC_MAX_ENCODED(size);
+        std::vector<uint8_t> encoded(bound);
+        write_state_t writer;
+        init_write_state(&writer, encoded.data(), bound);
+        size_t piece = 1 + param % 16;
+        for (size_t pos = 0; pos < size; pos += piece)
+            write_process_bytes(&writer, &data[pos], std::min(piece, size - pos));
+        // Nothing is sent for an empty frame
+        size_t encodedLen = write_end_frame(&writer);
+        if (size == 0)
+            return;
+
+        CHECK(encodedLen >= 2);
+        CHECK(encodedLen <= bound);
+        CHECK(encoded[0] == 0xE6);
+        CHECK(encoded[encodedLen - 1] == 0xE9);
+        for (size_t i = 1; i < (encodedLen - 1); i++)
+            CHECK((encoded[i] != 0xE6) && (encoded[i] != 0xE9));
+
+        std::vector<uint8_t> decoded(size + 16);
+        read_state_t reader;
+        init_read_state(&reader, decoded.data(), decoded.size());
+        size_t ret = NOT_COMPLETE;
+        for (size_t i = 0; i < encodedLen; i++)
+            ret = read_process_byte(&reader, encoded[i]);
+        CHECK(read_take_corrected(&reader) == 0);
+        CHECK(ret == size);
+        CHECK(memcmp(decoded.data(), data, size) == 0);
+        return;
+    }
+
+    if (target == 3) {
+        uint8_t parity, length;
+        fuzz_profile(param, &parity, &length);
+        if (size < length)
+            return;
+        uint8_t codeword[FEC_MAX_CODEWORD];
+        memcpy(codeword, data, length - parity);
+        fec_encode(codeword, length - parity, parity, &codeword[length - parity]);
+        uint8_t original[FEC_MAX_CODEWORD];
+        memcpy(original, codeword, length);
+
+        // The rest of the input says what to break: position, and a value for a wrong byte or 0 to lose it
+        uint8_t erasures[FEC_MAX_PARITY];
+        size_t erasureCount = 0;
+        size_t wrong = 0;
+        bool broken[FEC_MAX_CODEWORD] = {};
+        for (size_t i = length; (i + 1) < size; i += 2) {
+            uint8_t pos = data[i] % length;
+            if (broken[pos])
+                continue;
+            broken[pos] = true;
+            if (data[i + 1] == 0) {
+                if (erasureCount < FEC_MAX_PARITY)
+                    erasures[erasureCount++] = pos;
+                codeword[pos] = 0;
+            } else {
+                wrong++;
+                codeword[pos] ^= data[i + 1];
+            }
+        }
+
+        int ret = fec_decode(codeword, length, parity, erasures, erasureCount);
+        if ((2 * wrong + erasureCount) <= parity) {
+            CHECK(ret >= 0);
+            CHECK(memcmp(codeword, original, length) == 0);
+        } else {
+            CHECK(ret <= parity);
+        }
+        return;
+    }
+
+    if (target == 4) {
+        uint8_t parity, length;
+        fuzz_profile(param, &parity, &length);
+        size_t frameLen = std::min(size, (size_t)FEC_MAX_RX_FRAME);
+        if (frameLen == 0)
+            return;
+        FecEncoder encoder;
+        CHECK(encoder.set_profile(parity, length));
+        encoder.begin();
+        encoder.add(data, frameLen);
+        fecCapture.clear();
+        encoder.end(fec_capture_write);
+
+        CHECK(fecCapture.size() <= encoder.max_encoded_size(frameLen));
+        CHECK(fecCapture.front() == FEC_FRAME_START);
+        CHECK(fecCapture.back() == FEC_FRAME_END);
+        for (size_t i = 1; i < (fecCapture.size() - 1); i++)
+            CHECK((fecCapture[i] != FEC_FRAME_START) && (fecCapture[i] != FEC_FRAME_END));
+
+        FecDecoder decoder;
+        std::vector<uint8_t> decoded(FEC_MAX_RX_FRAME);
+        decoder.begin();
+        for (size_t i = 1; i < (fecCapture.size() - 1); i++)
+            decoder.add(fecCapture[i]);
+        CHECK(decoder.finish(decoded.data(), decoded.size()) == (int)frameLen);
+        CHECK(memcmp(decoded.data(), data, frameLen) == 0);
+
+        // A skipped symbol, not one that is escaped or escapes the next one and not the last one, which nothing comes after
+        size_t skip = 1 + data[frameLen - 1] * (fecCapture.size() - 3) / 256;
+        if ((parity < 2) || (fecCapture[skip] == FEC_ESC) || (fecCapture[skip - 1] == FEC_ESC))
+            return;
+        decoder.begin();
+        for (size_t i = 1; i < (fecCapture.size() - 1); i++)
+            if (i != skip)
+                decoder.add(fecCapture[i]);
+        memset(decoded.data(), 0, decoded.size());
+        CHECK(decoder.finish(decoded.data(), decoded.size()) == (int)frameLen);
+        CHECK(memcmp(decoded.data(), data, frameLen) == 0);
+        return;
+    }
+
+    PacketFraming parser;
+    size_t chunk = 1 + param % 32;
+    // parse_frame may leave one byte for the next call after handing back text
+    int idleCalls = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t len = std::min(chunk, size - pos);
+        size_t consumed = 0;
+        int8_t status = 0;
+        FrameInfo info;
+        uint16_t outputLength = 0;
+        const uint8_t* out = parser.parse_frame(&data[pos], len, &consumed, &status, &info, &outputLength);
+
+        CHECK(consumed <= len);
+        CHECK((status >= -2) && (status <= 1));
+        if (status == 1) {
+            CHECK(out != NULL);
+            CHECK(outputLength <= FRAGMENT_SIZE);
+        } else if (status == 0) {
+            CHECK(out != NULL);
+            CHECK((outputLength > 0) && (outputLength <= (consumed + 3)));
+        } else if (status == -1) {
+            CHECK(consumed == len);
+        }
+
+        idleCalls = (consumed == 0) ? (idleCalls + 1) : 0;
+        CHECK(idleCalls < 2);
+        pos += consumed;
+    }
+}
+
+
+#ifdef CHANNEL_BENCH_LIBFUZZER
+
+// No HAL in fuzzer builds, the framing code only needs a clock
+unsigned long millis() {
+    return 0;
+}
+
+unsigned long micros() {
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    fuzz_one(data, size);
+    return 0;
+}
+
+#else
+
+struct RunResult {
+    uint32_t recovered, bad, corrected;
+    uint64_t frameBytes, payloadBytes, lineBytes;
+    uint32_t lostRuns;
+    uint64_t lostRunBytes;
+    uint64_t parseCycles;
+};
+
+static void set_framing(PacketFraming& framing, const Framing& f) {
+    framing.set_tx_mode(f.mode);
+    if (f.mode == FRAMING_FEC)
+        CHECK(framing.set_fec_profile(f.parity, f.length));
+}
+
+static void run(const char* model, const Framing& framing, RunResult* r) {
+    memset(r, 0, sizeof(*r));
+
+    // Sender
+    PacketFraming sender;
+    set_framing(sender, framing);
+    txCapture.clear();
+    std::vector<size_t> frameStart(FRAMES_PER_RUN + 1);
+    uint8_t payload[FRAGMENT_SIZE];
+    for (uint32_t seq = 0; seq < FRAMES_PER_RUN; seq++) {
+        frameStart[seq] = txCapture.size();
+        uint16_t len = make_payload(seq, payload);
+        size_t unused;
+        sender.make_frame(payload, len, seq % 10, LOCAL_PORT, seq >> 8, 0, &unused);
+        r->frameBytes += len + DATA_FRAME_OVERHEAD;
+    }
+    frameStart[FRAMES_PER_RUN] = txCapture.size();
+
+    SerialChannel channel;
+    CHECK(channel.configure(model));
+    std::vector<uint8_t> line;
+    channel.apply(txCapture.data(), txCapture.size(), line);
+    r->lineBytes = line.size();
+
+    // Receiver, both repair counters start from 0
+    PacketFraming receiver;
+    receiver.take_corrected_chunks();
+    std::vector<bool> delivered(FRAMES_PER_RUN, false);
+    uint64_t start = cycles();
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t len = std::min((size_t)PARSE_CHUNK, line.size() - pos);
+        size_t consumed = 0;
+        int8_t status;
+        FrameInfo info;
+        uint16_t outputLength;
+        const uint8_t* data = receiver.parse_frame(&line[pos], len, &consumed, &status, &info, &outputLength);
+        pos += consumed;
+        if (status != 1)
+            continue;
+
+        uint32_t seq;
+        if (payload_matches(data, outputLength, info, FRAMES_PER_RUN, &seq) && !delivered[seq]) {
+            delivered[seq] = true;
+            r->recovered++;
+            r->payloadBytes += outputLength;
+        } else {
+            r->bad++;
+        }
+    }
+    r->parseCycles = cycles() - start;
+    // The parser takes every framing, noise that looks like the start of another one gets "repaired" too
+    r->corrected = receiver.take_corrected_chunks(framing.mode);
+
+    // Runs of lost frames, measured on the sender's side of the line
+    uint32_t seq = 0;
+    while (seq < FRAMES_PER_RUN) {
+        if (delivered[seq]) {
+            seq++;
+            continue;
+        }
+        uint32_t first = seq;
+        while ((seq < FRAMES_PER_RUN) && !delivered[seq])
+            seq++;
+        r->lostRuns++;
+        r->lostRunBytes += frameStart[seq] - frameStart[first];
+    }
+}
+
+// Encoding time on its own, it doesn't depend on the channel
+static void encode_speed(const Framing& framing) {
+    PacketFraming sender;
+    set_framing(sender, framing);
+    uint8_t payload[FRAGMENT_SIZE];
+    uint16_t lengths[64];
+    for (uint32_t i = 0; i < 64; i++)
+        lengths[i] = make_payload(i, payload);
+
+    txCapture.reserve(1 << 20);
+    uint64_t frameBytes = 0, lineBytes = 0;
+    uint64_t start = cycles();
+    for (uint32_t i = 0; i < FRAMES_PER_RUN * 5; i++) {
+        txCapture.clear();
+        size_t unused;
+        sender.make_frame(payload, lengths[i % 64], i % 10, LOCAL_PORT, 0, 0, &unused);
+        frameBytes += lengths[i % 64] + DATA_FRAME_OVERHEAD;
+        lineBytes += txCapture.size();
+    }
+    uint64_t spent = cycles() - start;
+    printf("encode %-11s %6.1f cycles per frame byte, %5.1f%% overhead\n", framing.name, (double)spent / frameBytes,
+           100.0 * lineBytes / frameBytes - 100);
+}
+
+static void fuzz(uint32_t iterations) {
+    // Bytes the codec and the parser treat specially, so random input hits them often
+    static const uint8_t SPECIAL[] = {0xE6, 0xE9, 0xDB, 0xDC, 0xDD, 0xDE, 0xCF, 0xEB, 0x01, 0x81, 0x84, 0x85, 0x00};
+    uint32_t state = 12345;
+    std::vector<uint8_t> input;
+    for (uint32_t i = 0; i < iterations; i++) {
+        input.resize(xorshift(&state) % 600);
+        for (size_t k = 0; k < input.size(); k++) {
+            uint32_t r = xorshift(&state);
+            input[k] = ((r & 3) == 0) ? SPECIAL[(r >> 8) % sizeof(SPECIAL)] : (r >> 16);
+        }
+        fuzz_one(input.data(), input.size());
+    }
+    printf("fuzz: %u inputs, all checks passed\n", iterations);
+}
+
+void setup() {
+    const char* fuzzEnv = getenv("CHANNEL_BENCH_FUZZ");
+    if (fuzzEnv != NULL) {
+        fuzz(strtoul(fuzzEnv, NULL, 10));
+        exit(0);
+    }
+
+    const char* models[sizeof(MODELS) / sizeof(MODELS[0])];
+    size_t modelCount = sizeof(MODELS) / sizeof(MODELS[0]);
+    memcpy(models, MODELS, sizeof(MODELS));
+    const char* modelEnv = getenv("CHANNEL_BENCH_MODEL");
+    if (modelEnv != NULL) {
+        SerialChannel check;
+        if (!check.configure(modelEnv)) {
+            fprintf(stderr, "Bad CHANNEL_BENCH_MODEL: %s\n", modelEnv);
+            exit(1);
+        }
+        models[0] = modelEnv;
+        modelCount = 1;
+    }
+
+    for (const Framing& f : FRAMINGS)
+        encode_speed(f);
+    printf("%u frames per run\n", FRAMES_PER_RUN);
+    printf("%-11s %9s %6s %9s %8s %9s %9s %8s %s\n", "framing", "recovered", "bad", "goodput", "kB/s", "resync B", "resync us",
+           "decode/B", "model");
+    for (size_t m = 0; m < modelCount; m++) {
+        for (const Framing& f : FRAMINGS) {
+            RunResult r;
+            run(models[m], f, &r);
+
+            double goodput = (double)r.payloadBytes / r.lineBytes;
+            double resyncBytes = r.lostRuns ? (double)r.lostRunBytes / r.lostRuns : 0;
+            char corrected[32] = "";
+            if (f.mode != FRAMING_PREAMBLE)
+                snprintf(corrected, sizeof(corrected), " (%u chunks repaired)", r.corrected);
+            printf("%-11s %8.3f%% %6u %8.2f%% %8.1f %9.0f %9.0f %8.1f %s%s\n", f.name, 100.0 * r.recovered / FRAMES_PER_RUN,
+                   r.bad, 100 * goodput, goodput * LINE_BAUD / 10 / 1000, resyncBytes, resyncBytes * 10 * 1000000 / LINE_BAUD,
+                   (double)r.parseCycles / r.frameBytes, (models[m][0] != '\0') ? models[m] : "lossless", corrected);
+        }
+    }
+    exit(0);
+}
+
+void loop() {
+}
+
+#endif
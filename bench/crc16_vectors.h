@@ -0,0 +1,277 @@
+// Generated by bench/crc16_vectors.py --profile default from crc16() in host/crc16.py, don't edit
+#ifndef CRC16_VECTORS_H
+#define CRC16_VECTORS_H
+
+#include <stdint.h>
+
+#define CRC16_VECTORS_POLY 0x5935
+#define CRC16_VECTORS_SEED 0x5EEDu
+#define CRC16_VECTORS_MAX_LENGTH 512
+
+// Buffer length, CRC it starts from, CRC after it
+struct crc16_vector_t {
+    uint16_t length;
+    uint16_t init;
+    uint16_t crc;
+};
+
+static const crc16_vector_t CRC16_VECTORS[] = {
+    {32, 0x0000, 0x613D},
+    {504, 0xD302, 0xBFBD},
+    {407, 0x0000, 0xCD4D},
+    {259, 0x5E90, 0x59A6},
+    {192, 0x0000, 0x2971},
+    {355, 0x1199, 0x451D},
+    {465, 0x0000, 0x7515},
+    {477, 0x937A, 0xC276},
+    {493, 0x0000, 0x126E},
+    {101, 0xB9CF, 0xF867},
+    {61, 0x0000, 0xCAEE},
+    {14, 0x82F9, 0x1745},
+    {269, 0x0000, 0x96F3},
+    {321, 0x832F, 0x07C9},
+    {246, 0x0000, 0x8E55},
+    {359, 0xDC50, 0xB6E4},
+    {262, 0x0000, 0x94B2},
+    {54, 0xED51, 0x9458},
+    {226, 0x0000, 0xA179},
+    {54, 0x0278, 0x8D39},
+    {22, 0x0000, 0x643F},
+    {388, 0x74E9, 0xD7B5},
+    {367, 0x0000, 0x51CE},
+    {261, 0xC202, 0x2499},
+    {374, 0x0000, 0x6A44},
+    {504, 0xEBEF, 0x627F},
+    {507, 0x0000, 0x7046},
+    {47, 0x251D, 0x0D62},
+    {284, 0x0000, 0x997C},
+    {295, 0x8E5B, 0x8A0D},
+    {161, 0x0000, 0xD9A7},
+    {283, 0x7D01, 0x2846},
+    {387, 0x0000, 0x4F93},
+    {311, 0x59F0, 0xD983},
+    {2, 0x0000, 0xBBA1},
+    {67, 0x64FA, 0xBFFB},
+    {317, 0x0000, 0x8065},
+    {433, 0x81D2, 0x7469},
+    {44, 0x0000, 0x3748},
+    {442, 0xEEE5, 0xAA93},
+    {192, 0x0000, 0xAC51},
+    {8, 0x47F8, 0x884D},
+    {27, 0x0000, 0xC33C},
+    {218, 0x8B5D, 0x9C55},
+    {214, 0x0000, 0xE2F3},
+    {4, 0x8AB7, 0x7C3B},
+    {365, 0x0000, 0xB007},
+    {279, 0xB77F, 0x05E6},
+    {17, 0x0000, 0x96CC},
+    {55, 0x9142, 0xF349},
+    {377, 0x0000, 0x312E},
+    {11, 0x8C05, 0xDCCF},
+    {107, 0x0000, 0x0D0C},
+    {462, 0x1AC3, 0x418A},
+    {219, 0x0000, 0x0509},
+    {171, 0x8CC5, 0x2C1C},
+    {368, 0x0000, 0x20C4},
+    {302, 0x2E15, 0x2FE4},
+    {435, 0x0000, 0x1BA0},
+    {102, 0x58CB, 0x055B},
+    {459, 0x0000, 0xC189},
+    {80, 0x3119, 0x85C5},
+    {239, 0x0000, 0x08F1},
+    {29, 0x94C8, 0x8FF0},
+    {82, 0x0000, 0x875A},
+    {257, 0xD3B3, 0x102E},
+    {262, 0x0000, 0x8F45},
+    {67, 0x6CEA, 0x99FC},
+    {399, 0x0000, 0x8074},
+    {407, 0xB428, 0x0D6F},
+    {193, 0x0000, 0xFE3B},
+    {251, 0x0203, 0x4FC2},
+    {30, 0x0000, 0x2252},
+    {444, 0xF862, 0x0869},
+    {102, 0x0000, 0xBD60},
+    {259, 0xCE42, 0x80B1},
+    {219, 0x0000, 0xB589},
+    {135, 0x410B, 0x8BA5},
+    {325, 0x0000, 0x9655},
+    {339, 0xB99A, 0xDDD8},
+    {144, 0x0000, 0x2EEE},
+    {282, 0xE22D, 0x3866},
+    {232, 0x0000, 0x4453},
+    {6, 0x8D01, 0x0009},
+    {416, 0x0000, 0xEE86},
+    {482, 0x8B92, 0xD069},
+    {325, 0x0000, 0x825D},
+    {99, 0x2EAF, 0xAEF8},
+    {341, 0x0000, 0x85B4},
+    {249, 0xD0BF, 0xF8DA},
+    {224, 0x0000, 0x4681},
+    {218, 0xA5E0, 0x2028},
+    {89, 0x0000, 0xF20A},
+    {95, 0xB7E9, 0x4F0B},
+    {390, 0x0000, 0xECA5},
+    {74, 0x76CD, 0x7BB8},
+    {159, 0x0000, 0xE5CF},
+    {234, 0x770C, 0x871C},
+    {10, 0x0000, 0x500B},
+    {379, 0xF0F0, 0xC1F1},
+    {129, 0x0000, 0x5F98},
+    {467, 0x6C5C, 0x9018},
+    {261, 0x0000, 0x076A},
+    {442, 0xA7F6, 0x9C14},
+    {459, 0x0000, 0xC35D},
+    {175, 0x7D19, 0x0DA2},
+    {323, 0x0000, 0xEF78},
+    {385, 0x1D4F, 0x86A8},
+    {258, 0x0000, 0xB3E5},
+    {365, 0x1A53, 0xB514},
+    {464, 0x0000, 0xDE27},
+    {94, 0x7F0A, 0x4E7E},
+    {404, 0x0000, 0x01E8},
+    {323, 0x9537, 0x5985},
+    {412, 0x0000, 0x7B2B},
+    {372, 0xD63B, 0x419A},
+    {430, 0x0000, 0xA007},
+    {357, 0x7030, 0x5210},
+    {157, 0x0000, 0xED3F},
+    {179, 0xC915, 0x4287},
+    {305, 0x0000, 0xCEFA},
+    {375, 0x4518, 0xEE9A},
+    {12, 0x0000, 0xB852},
+    {409, 0xD0E8, 0xA2CF},
+    {504, 0x0000, 0xDE1D},
+    {171, 0xB47A, 0xD09C},
+    {230, 0x0000, 0x19E3},
+    {456, 0x261F, 0x8614},
+    {264, 0x0000, 0x3D56},
+    {221, 0x9061, 0x5EBF},
+    {160, 0x0000, 0x46B2},
+    {437, 0xA273, 0xF53A},
+    {68, 0x0000, 0x6422},
+    {437, 0x6F26, 0x35E7},
+    {76, 0x0000, 0x1029},
+    {451, 0x4770, 0xFB31},
+    {155, 0x0000, 0x692E},
+    {452, 0xF4E9, 0xD73E},
+    {207, 0x0000, 0x3503},
+    {135, 0xCA48, 0xA615},
+    {251, 0x0000, 0xFC01},
+    {442, 0x301C, 0xC427},
+    {85, 0x0000, 0xB28D},
+    {195, 0x3B69, 0xF44D},
+    {295, 0x0000, 0x161E},
+    {6, 0xD9D7, 0x94B5},
+    {101, 0x0000, 0xDEE1},
+    {401, 0xD7EB, 0x512C},
+    {375, 0x0000, 0x85B6},
+    {55, 0xB774, 0x7155},
+    {214, 0x0000, 0x36AB},
+    {26, 0x6AE8, 0xE07F},
+    {271, 0x0000, 0x8E2F},
+    {427, 0x9C0D, 0xBA33},
+    {315, 0x0000, 0xCBE3},
+    {512, 0x09DE, 0xFB46},
+    {124, 0x0000, 0xA284},
+    {443, 0xFDA4, 0x073F},
+    {199, 0x0000, 0x9F14},
+    {290, 0xC125, 0x93ED},
+    {319, 0x0000, 0xFC0C},
+    {249, 0xDFFE, 0x0023},
+    {470, 0x0000, 0x4E46},
+    {330, 0xFAAA, 0xE4CE},
+    {403, 0x0000, 0xFE08},
+    {266, 0x6510, 0xCD8E},
+    {430, 0x0000, 0xBA6C},
+    {41, 0xFC98, 0x0B87},
+    {451, 0x0000, 0x4F9D},
+    {61, 0xF1C2, 0xD394},
+    {203, 0x0000, 0xC082},
+    {428, 0xAB25, 0x010B},
+    {123, 0x0000, 0xBDF7},
+    {153, 0x88B6, 0xCDB7},
+    {161, 0x0000, 0xB447},
+    {159, 0xB961, 0x2D56},
+    {127, 0x0000, 0x7174},
+    {28, 0x1A89, 0x86C4},
+    {454, 0x0000, 0xAE18},
+    {12, 0x3A58, 0x6D33},
+    {474, 0x0000, 0x7CF7},
+    {240, 0x0638, 0x2F00},
+    {27, 0x0000, 0xE009},
+    {99, 0x82BC, 0xB23A},
+    {242, 0x0000, 0x9A6A},
+    {198, 0x3225, 0x0C11},
+    {226, 0x0000, 0xF7B2},
+    {449, 0xD54D, 0xB008},
+    {400, 0x0000, 0x1594},
+    {243, 0x7426, 0xB538},
+    {51, 0x0000, 0x8D38},
+    {507, 0xEAB7, 0xCAC7},
+    {185, 0x0000, 0xB9C6},
+    {33, 0x295D, 0x1689},
+    {134, 0x0000, 0x1BE5},
+    {54, 0x19A6, 0x940D},
+    {362, 0x0000, 0x2E8C},
+    {253, 0xE84A, 0xE232},
+    {320, 0x0000, 0x812E},
+    {6, 0xAF83, 0x822C},
+    {51, 0x0000, 0x4FA5},
+    {497, 0xB166, 0xA633},
+    {429, 0x0000, 0x463D},
+    {467, 0xFF8D, 0xD73F},
+    {99, 0x0000, 0xB77A},
+    {74, 0x8B7A, 0xD43E},
+    {322, 0x0000, 0x961F},
+    {421, 0xE5E1, 0x2E3F},
+    {411, 0x0000, 0xBED6},
+    {426, 0x9EFA, 0xCF29},
+    {218, 0x0000, 0x734F},
+    {377, 0x279B, 0xB61E},
+    {351, 0x0000, 0x4266},
+    {151, 0xF1EE, 0x6FED},
+    {459, 0x0000, 0xFC8D},
+    {451, 0x0DA0, 0x3922},
+    {314, 0x0000, 0x9D39},
+    {423, 0x4A3D, 0xA958},
+    {36, 0x0000, 0x939E},
+    {447, 0x3858, 0x4A03},
+    {73, 0x0000, 0x422D},
+    {476, 0x37D7, 0x0061},
+    {296, 0x0000, 0x8525},
+    {400, 0x2641, 0x3B0A},
+    {98, 0x0000, 0x6847},
+    {318, 0x12D4, 0xA0CC},
+    {251, 0x0000, 0x02CB},
+    {363, 0x0177, 0xF770},
+    {333, 0x0000, 0xC875},
+    {76, 0xE423, 0x8888},
+    {91, 0x0000, 0xAB38},
+    {13, 0xB3B2, 0xDB19},
+    {311, 0x0000, 0x9382},
+    {161, 0x30FB, 0x29FC},
+    {91, 0x0000, 0x190F},
+    {202, 0x5804, 0x5BCE},
+    {155, 0x0000, 0xC98A},
+    {70, 0xA966, 0x6031},
+    {431, 0x0000, 0x0307},
+    {228, 0x1DDC, 0xD7A6},
+    {273, 0x0000, 0x4A57},
+    {305, 0x0E5F, 0xC976},
+    {111, 0x0000, 0xF27E},
+    {356, 0xCEBC, 0x8F28},
+    {105, 0x0000, 0x54E7},
+    {412, 0x6444, 0x251E},
+    {17, 0x0000, 0xAE3D},
+    {208, 0x4206, 0xCF11},
+    {164, 0x0000, 0x1781},
+    {432, 0xB14B, 0x66CE},
+    {295, 0x0000, 0xECD1},
+    {162, 0xE2F8, 0x315A},
+    {468, 0x0000, 0xBB09},
+    {159, 0x46EC, 0x5092},
+    {299, 0x0000, 0x5136},
+    {286, 0x6F71, 0x31CE},
+};
+
+#endif
@@ -0,0 +1,74 @@
+# Writes bench/crc16_vectors.h: CRCs of random buffers from crc16() in host/crc16.py, for bench/crc_bench.cpp
+# The buffers aren't stored, both sides draw them from the same xorshift32 stream, see crc_bench.cpp
+# python bench/crc16_vectors.py [--profile NAME], again whenever the polynomial of that profile changes
+import argparse
+import os
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(BENCH_DIR, '..', 'host'))
+
+from crc16 import crc16, set_crc16_poly
+from framing_profile import load_profile
+
+VECTOR_COUNT = 256
+MAX_LENGTH = 512
+SEED = 0x5EED
+
+
+def xorshift32(state):
+    state ^= (state << 13) & 0xFFFFFFFF
+    state ^= state >> 17
+    state ^= (state << 5) & 0xFFFFFFFF
+    return state
+
+
+# Yields (length, init, crc), odd vectors start from a nonzero CRC the way a frame checked in parts would
+def make_vectors(count, seed):
+    state = seed
+    for i in range(count):
+        state = xorshift32(state)
+        length = state % (MAX_LENGTH + 1)
+        state = xorshift32(state)
+        init = state & 0xFFFF if i & 1 else 0
+        data = bytearray()
+        for _ in range(length):
+            state = xorshift32(state)
+            data.append(state & 0xFF)
+        yield length, init, crc16(data, init)
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--profile', default='default', metavar='NAME', help='Framing profile the polynomial comes from')
+parser.add_argument('--output', default=os.path.join(BENCH_DIR, 'crc16_vectors.h'))
+args = parser.parse_args()
+
+profile = load_profile(args.profile)
+set_crc16_poly(profile.crc16_poly)
+
+lines = [
+    f'// Generated by bench/crc16_vectors.py --profile {profile.name} from crc16() in host/crc16.py, don\'t edit',
+    '#ifndef CRC16_VECTORS_H',
+    '#define CRC16_VECTORS_H',
+    '',
+    '#include <stdint.h>',
+    '',
+    f'#define CRC16_VECTORS_POLY 0x{profile.crc16_poly:04X}',
+    f'#define CRC16_VECTORS_SEED 0x{SEED:X}u',
+    f'#define CRC16_VECTORS_MAX_LENGTH {MAX_LENGTH}',
+    '',
+    '// Buffer length, CRC it starts from, CRC after it',
+    'struct crc16_vector_t {',
+    '    uint16_t length;',
+    '    uint16_t init;',
+    '    uint16_t crc;',
+    '};',
+    '',
+    'static const crc16_vector_t CRC16_VECTORS[] = {',
+]
+lines += [f'    {{{length}, 0x{init:04X}, 0x{crc:04X}}},' for length, init, crc in make_vectors(VECTOR_COUNT, SEED)]
+lines += ['};', '', '#endif', '']
+
+with open(args.output, 'w') as f:
+    f.write('\n'.join(lines))
+print(f'{VECTOR_COUNT} vectors for polynomial 0x{profile.crc16_poly:04X} written to {args.output}')
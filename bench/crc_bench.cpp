@@ -0,0 +1,172 @@
+// Check and throughput of the three CRC16_IMPL variants of src/crc16.cpp, runs on Linux only
+// crc16.cpp is built once per variant, each in a namespace of its own
+// Every variant has to give the CRCs in crc16_vectors.h, which crc16() in host/crc16.py computed for the same buffers.
+// They're also fed each buffer in two parts and a byte at a time, a mismatch aborts
+// Throughput is over random buffers of 0..512 bytes, the sizes frames have
+// CRC_BENCH_SCALE=N runs N times as much(default 1)
+// pio run -e crc_bench && .pio/build/crc_bench/program
+// Without PlatformIO: g++ -O2 -Isrc bench/crc_bench.cpp -o crc_bench
+// After changing the polynomial of the framing profile: python bench/crc16_vectors.py --profile NAME
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <time.h>
+
+// First at global scope, so the includes of crc16.cpp below only add the definitions
+#include "crc16.h"
+#include "crc16_vectors.h"
+
+#if CRC16_POLY != CRC16_VECTORS_POLY
+#error crc16_vectors.h is for another polynomial, run bench/crc16_vectors.py --profile with this framing profile
+#endif
+
+#undef CRC16_IMPL
+
+namespace bitwise {
+#define CRC16_IMPL CRC16_BITWISE
+#include "../src/crc16.cpp"
+#undef CRC16_IMPL
+}
+
+namespace table {
+#define CRC16_IMPL CRC16_TABLE
+#include "../src/crc16.cpp"
+#undef CRC16_IMPL
+#undef CRC16_TABLE_COUNT
+}
+
+namespace slice4 {
+#define CRC16_IMPL CRC16_SLICE4
+#include "../src/crc16.cpp"
+#undef CRC16_IMPL
+#undef CRC16_TABLE_COUNT
+}
+
+#define BYTES_PER_RUN (256u << 20)
+// Random buffers the runs go over, more than fits in L1 but not in L2
+#define BENCH_BUFFERS 1024
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+typedef void (*update_crc16_t)(const uint8_t* data, size_t length, uint16_t* crc);
+
+struct variant_t {
+    const char* name;
+    update_crc16_t update;
+};
+
+static const variant_t VARIANTS[] = {
+    {"CRC16_BITWISE", bitwise::update_crc16},
+    {"CRC16_TABLE", table::update_crc16},
+    {"CRC16_SLICE4", slice4::update_crc16},
+};
+
+static uint32_t scale = 1;
+
+
+static uint64_t now_ns() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Same as xorshift32() in crc16_vectors.py
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint16_t crc_of(const variant_t& variant, const uint8_t* data, size_t length, uint16_t init) {
+    uint16_t crc = init;
+    variant.update(data, length, &crc);
+    return crc;
+}
+
+// Draws the buffers the way make_vectors() in crc16_vectors.py does
+static void check_vectors(const variant_t& variant) {
+    uint32_t state = CRC16_VECTORS_SEED;
+    uint8_t data[CRC16_VECTORS_MAX_LENGTH];
+    size_t count = sizeof(CRC16_VECTORS) / sizeof(CRC16_VECTORS[0]);
+    for (size_t i = 0; i < count; i++) {
+        const crc16_vector_t& vector = CRC16_VECTORS[i];
+        uint16_t length = xorshift(&state) % (CRC16_VECTORS_MAX_LENGTH + 1);
+        uint16_t init = xorshift(&state) & 0xFFFF;
+        if (!(i & 1))
+            init = 0;
+        CHECK(length == vector.length && init == vector.init);
+        for (uint16_t j = 0; j < length; j++)
+            data[j] = xorshift(&state) & 0xFF;
+
+        CHECK(crc_of(variant, data, length, init) == vector.crc);
+
+        // Split at another point for each vector, so the second part starts off a 4 byte step too
+        size_t split = length ? i % length : 0;
+        uint16_t crc = crc_of(variant, data, split, init);
+        CHECK(crc_of(variant, data + split, length - split, crc) == vector.crc);
+
+        crc = init;
+        for (uint16_t j = 0; j < length; j++)
+            variant.update(data + j, 1, &crc);
+        CHECK(crc == vector.crc);
+    }
+    printf("%-14s %zu vectors match host/crc16.py\n", variant.name, count);
+}
+
+static void bench(const variant_t& variant, const std::vector<uint8_t>& data, const std::vector<uint16_t>& lengths) {
+    uint64_t target = (uint64_t)BYTES_PER_RUN * scale;
+    uint64_t bytes = 0;
+    uint16_t crc = 0;
+    uint64_t start = now_ns();
+    while (bytes < target) {
+        const uint8_t* buffer = data.data();
+        for (uint16_t length : lengths) {
+            variant.update(buffer, length, &crc);
+            buffer += length;
+            bytes += length;
+        }
+    }
+    uint64_t spent = now_ns() - start;
+
+    // The CRC is printed so the loop can't be optimized out
+    printf("%-14s %8.1f MB/s %6.2f ns/byte (crc %04X)\n", variant.name, bytes * 1e3 / spent, (double)spent / bytes, crc);
+}
+
+
+int main() {
+    const char* scaleEnv = getenv("CRC_BENCH_SCALE");
+    if (scaleEnv != NULL)
+        scale = std::max(1ul, strtoul(scaleEnv, NULL, 10));
+
+    for (const variant_t& variant : VARIANTS)
+        check_vectors(variant);
+
+    uint32_t state = 1;
+    std::vector<uint16_t> lengths(BENCH_BUFFERS);
+    size_t total = 0;
+    for (uint16_t& length : lengths) {
+        length = xorshift(&state) % (CRC16_VECTORS_MAX_LENGTH + 1);
+        total += length;
+    }
+    std::vector<uint8_t> data(total);
+    for (uint8_t& c : data)
+        c = xorshift(&state) & 0xFF;
+
+    printf("random buffers of 0..%u bytes, polynomial 0x%04X\n", CRC16_VECTORS_MAX_LENGTH, CRC16_POLY);
+    for (const variant_t& variant : VARIANTS)
+        bench(variant, data, lengths);
+    printf("all checks passed\n");
+    return 0;
+}
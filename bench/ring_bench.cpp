@@ -0,0 +1,145 @@
+// Stress test and throughput benchmark for RingBuffer in ring_buffer.h, runs on Linux only
+// Every run has a producer and a consumer thread, pinned to different CPUs when there are two, so the ring is used
+// across cores the way it would be between two tasks, harder than between the UART interrupt and the loop.
+// Waiting sides yield, so with one CPU it still runs, just slower. The consumer checks every byte, a mismatch aborts
+// The runs write and read a stream that only depends on the position, in random sized spans
+// RING_BENCH_SCALE=N runs N times as much(default 1)
+// pio run -e ring_bench && .pio/build/ring_bench/program
+// To look for data races as well:
+// g++ -O1 -g -fsanitize=thread -pthread -DNATIVE_BUILD -Isrc -Ilib/native_hal bench/ring_bench.cpp lib/native_hal/*.cpp
+//   -o ring_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <Arduino.h>
+
+#include "ring_buffer.h"
+#include "uart.h"
+
+#define BYTES_PER_RUN (256u << 20)
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+static uint32_t scale = 1;
+
+
+static uint64_t now_ns() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Byte pos of the stream in the bytes run
+static uint8_t stream_byte(uint64_t pos) {
+    return (uint8_t)(pos ^ (pos >> 8) ^ (pos >> 16));
+}
+
+// Threads of one run on different CPUs, if there are enough
+static void pin(std::thread& t, int cpu) {
+    if ((int)std::thread::hardware_concurrency() <= cpu)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+}
+
+static void report(const char* name, uint64_t ns, uint64_t bytes, uint64_t items, const char* itemName) {
+    double s = ns / 1e9;
+    printf("%-24s %8.1f MB/s %10.0f %s/s %8.1f ns per %s\n", name, bytes / s / 1e6, items / s, itemName, (double)ns / items,
+           itemName);
+}
+
+
+static void bytes_run(const char* name, size_t maxChunk) {
+    static RingBuffer<UART_TX_RING_SIZE> ring;
+    ring.clear();
+    uint64_t total = (uint64_t)BYTES_PER_RUN * scale;
+    std::atomic<uint64_t> spans(0);
+
+    uint64_t start = now_ns();
+    std::thread producer([&]() {
+        uint32_t state = 1;
+        uint64_t pos = 0;
+        while (pos < total) {
+            size_t len = 0;
+            uint8_t* ptr = ring.write_span(&len);
+            if (len == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            len = std::min(std::min(len, (size_t)(1 + xorshift(&state) % maxChunk)), (size_t)(total - pos));
+            for (size_t i = 0; i < len; i++)
+                ptr[i] = stream_byte(pos + i);
+            ring.commit_write(len);
+            pos += len;
+        }
+    });
+    std::thread consumer([&]() {
+        uint32_t state = 2;
+        uint64_t pos = 0, count = 0;
+        while (pos < total) {
+            size_t len = 0;
+            const uint8_t* ptr = ring.read_span(&len);
+            if (len == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            len = std::min(len, (size_t)(1 + xorshift(&state) % maxChunk));
+            for (size_t i = 0; i < len; i++)
+                CHECK(ptr[i] == stream_byte(pos + i));
+            ring.commit_read(len);
+            pos += len;
+            count++;
+        }
+        spans = count;
+    });
+    pin(producer, 0);
+    pin(consumer, 1);
+    producer.join();
+    consumer.join();
+    uint64_t spent = now_ns() - start;
+
+    CHECK(ring.available() == 0);
+    report(name, spent, total, spans, "read");
+}
+
+
+void setup() {
+    const char* scaleEnv = getenv("RING_BENCH_SCALE");
+    if (scaleEnv != NULL)
+        scale = std::max(1ul, strtoul(scaleEnv, NULL, 10));
+
+    printf("%u CPUs\n", std::thread::hardware_concurrency());
+    bytes_run("bytes, spans up to 16", 16);
+    bytes_run("bytes, spans up to 256", 256);
+    bytes_run("bytes, whole spans", UART_TX_RING_SIZE);
+    printf("all checks passed\n");
+    exit(0);
+}
+
+void loop() {
+}
@@ -0,0 +1,28 @@
+# Frame CRC, same as src/crc16.cpp: MSB-first CRC16, init 0, no final xor
+# bench/crc16_vectors.py checks the firmware against this one
+from framing_profile import DEFAULT_PROFILE
+
+
+def crc16_table(poly):
+    ret = []
+    for i in range(256):
+        cur = i << 8
+        for _ in range(8):
+            cur = ((cur << 1) ^ poly) if cur & 0x8000 else (cur << 1)
+        ret.append(cur & 0xFFFF)
+    return ret
+
+# Byte at a time, same as CRC16_TABLES.t[0] in src/crc16.cpp. The polynomial comes from the framing profile
+CRC16_TABLE = crc16_table(DEFAULT_PROFILE.crc16_poly)
+
+# Has to be the polynomial of the dongle's framing profile
+def set_crc16_poly(poly):
+    global CRC16_TABLE
+    CRC16_TABLE = crc16_table(poly)
+
+def crc16(data, crc):
+    cur = crc & 0xFFFF
+    table = CRC16_TABLE
+    for c in data:
+        cur = ((cur << 8) & 0xFFFF) ^ table[(cur >> 8) ^ c]
+    return cur
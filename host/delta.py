@@ -0,0 +1,124 @@
+# FRAME_TYPE_DELTA payloads, same as src/delta.h
+# The decoder is used by slime_ap.py, the encoder mirrors the dongle's for delta_bench.py
+from framing_profile import DEFAULT_PROFILE
+
+DELTA_KEYFRAME = 0x80
+DELTA_SEQUENCE_MASK = 0x7F
+# A keyframe has the address, local port and remote port in front of the datagram, laid out by the framing profile
+
+# Defaults of DELTA_STREAMS/DELTA_MAX_LEN/DELTA_KEYFRAME_INTERVAL
+DELTA_STREAMS = 16
+DELTA_MAX_LEN = 128
+DELTA_KEYFRAME_INTERVAL = 64
+
+
+# Returns the encoded payload, None if it is no smaller than the datagram
+def delta_encode(previous, data):
+    out = bytearray()
+    for group in range(0, len(data), 8):
+        mask = 0
+        changed = bytearray()
+        for i in range(group, min(group + 8, len(data))):
+            if data[i] != previous[i]:
+                mask |= 1 << (i - group)
+                changed.append(data[i])
+        out.append(mask)
+        out += changed
+        if len(out) >= len(data):
+            return None
+    return bytes(out)
+
+
+# Returns the datagram, None if the payload doesn't fit previous
+def delta_decode(previous, payload):
+    out = bytearray(previous)
+    pos = 0
+    for group in range(0, len(out), 8):
+        if pos >= len(payload):
+            return None
+        mask = payload[pos]
+        pos += 1
+        for i in range(8):
+            if mask & (1 << i):
+                if group + i >= len(out) or pos >= len(payload):
+                    return None
+                out[group + i] = payload[pos]
+                pos += 1
+    if pos != len(payload):
+        return None
+    return bytes(out)
+
+
+# Same as the dongle's DeltaEncoder, for measuring
+class DeltaEncoder:
+    def __init__(self, streams=DELTA_STREAMS, max_len=DELTA_MAX_LEN, keyframe_interval=DELTA_KEYFRAME_INTERVAL, profile=DEFAULT_PROFILE):
+        self.profile = profile
+        self.max_len = max_len
+        self.keyframe_interval = keyframe_interval
+        # [key, previous datagram, sequence, since keyframe, last used], previous datagram is None until a keyframe
+        self._streams = [[None, None, 0, 0, 0] for _ in range(streams)]
+        self._use_counter = 0
+
+    def accepts(self, data):
+        return 0 < len(data) <= self.max_len
+
+    def resync(self):
+        for s in self._streams:
+            s[1] = None
+
+    # Returns (stream, sequence, payload)
+    def encode(self, addr, local_port, remote_port, data):
+        key = (addr, local_port, remote_port, len(data))
+        index = next((i for i, s in enumerate(self._streams) if s[0] == key), None)
+        if index is None:
+            index = min(range(len(self._streams)), key=lambda i: self._streams[i][4])
+            self._streams[index][0:2] = [key, None]
+        s = self._streams[index]
+        self._use_counter += 1
+        s[4] = self._use_counter
+        s[2] = (s[2] + 1) & DELTA_SEQUENCE_MASK
+
+        payload = None
+        if s[1] is not None and s[3] < self.keyframe_interval:
+            payload = delta_encode(s[1], data)
+        s[1] = bytes(data)
+
+        if payload is None:
+            s[3] = 0
+            return index, s[2] | DELTA_KEYFRAME, self.profile.pack_addressing(addr, local_port, remote_port) + bytes(data)
+        s[3] += 1
+        return index, s[2], payload
+
+
+# Host side, keeps the addressing and previous datagram of every stream
+class DeltaDecoder:
+    def __init__(self, profile=DEFAULT_PROFILE):
+        self.profile = profile
+        # stream -> (address, local port, remote port, sequence, previous datagram)
+        self._streams = {}
+
+    def reset(self):
+        self._streams.clear()
+
+    def active(self):
+        return len(self._streams) > 0
+
+    # Returns (address, local port, remote port, datagram)
+    # None if the frame doesn't follow the previous one of its stream, which then needs a keyframe
+    def decode(self, stream, sequence, payload):
+        if sequence & DELTA_KEYFRAME:
+            if len(payload) <= self.profile.addressing_size:
+                return None
+            addr, local_port, remote_port = self.profile.unpack_addressing(payload)
+            data = bytes(payload[self.profile.addressing_size:])
+            self._streams[stream] = (addr, local_port, remote_port, sequence & DELTA_SEQUENCE_MASK, data)
+            return addr, local_port, remote_port, data
+
+        s = self._streams.pop(stream, None)
+        if s is None or ((s[3] + 1) & DELTA_SEQUENCE_MASK) != sequence:
+            return None
+        data = delta_decode(s[4], payload)
+        if data is None:
+            return None
+        self._streams[stream] = s[:3] + (sequence, data)
+        return s[:3] + (data,)
@@ -0,0 +1,158 @@
+# Bytes per datagram with and without DELTA frames(see delta.py) on recorded tracker traffic
+# Takes pcap or pcapng captures, e.g. tcpdump -i wlan0 -w trackers.pcap udp port 6969
+# Only tracker->server datagrams are counted, those are the ones the dongle compresses
+import struct
+import argparse
+from collections import defaultdict
+
+from delta import DeltaEncoder, DeltaDecoder, DELTA_STREAMS, DELTA_MAX_LEN, DELTA_KEYFRAME_INTERVAL, DELTA_KEYFRAME
+
+# Preamble framing: sync(3), type(1), length(2), header, payload, CRC(2), newline(1)
+FRAME_OVERHEAD = 9
+DATA_HEADER_SIZE = 5
+DELTA_HEADER_SIZE = 2
+
+LINKTYPE_NULL = 0
+LINKTYPE_ETHERNET = 1
+LINKTYPE_RAW = 101
+LINKTYPE_LINUX_SLL = 113
+LINKTYPE_LINUX_SLL2 = 276
+
+
+# Yields (link type, packet) for every packet in a pcap or pcapng file
+def read_capture(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    magic = data[:4]
+    if magic == b'\x0a\x0d\x0d\x0a':
+        pos = 0
+        endian = '<'
+        link_types = []
+        while pos + 12 <= len(data):
+            if data[pos:pos+4] == b'\x0a\x0d\x0d\x0a':
+                endian = '<' if data[pos+8:pos+12] == b'\x4d\x3c\x2b\x1a' else '>'
+                link_types = []
+            block_type, block_len = struct.unpack_from(endian + 'II', data, pos)
+            if block_len < 12:
+                break
+            if block_type == 1:
+                link_types.append(struct.unpack_from(endian + 'H', data, pos + 8)[0])
+            elif block_type == 6:
+                iface, _, _, cap_len = struct.unpack_from(endian + 'IIII', data, pos + 8)
+                yield link_types[iface], data[pos+28:pos+28+cap_len]
+            pos += block_len
+        return
+
+    if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1'):
+        endian = '<'
+    elif magic in (b'\xa1\xb2\xc3\xd4', b'\xa1\xb2\x3c\x4d'):
+        endian = '>'
+    else:
+        raise ValueError(f'{path}: not a pcap or pcapng file')
+    link_type, = struct.unpack_from(endian + 'I', data, 20)
+    pos = 24
+    while pos + 16 <= len(data):
+        cap_len, = struct.unpack_from(endian + 'I', data, pos + 8)
+        yield link_type, data[pos+16:pos+16+cap_len]
+        pos += 16 + cap_len
+
+
+# Returns (source address, source port, destination port, payload), None if it isn't an unfragmented IPv4 UDP datagram
+def parse_udp(link_type, packet):
+    if link_type == LINKTYPE_ETHERNET:
+        pos = 12
+        ether_type, = struct.unpack_from('>H', packet, pos)
+        while ether_type in (0x8100, 0x88A8):
+            pos += 4
+            ether_type, = struct.unpack_from('>H', packet, pos)
+        pos += 2
+    elif link_type == LINKTYPE_LINUX_SLL:
+        ether_type, = struct.unpack_from('>H', packet, 14)
+        pos = 16
+    elif link_type == LINKTYPE_LINUX_SLL2:
+        ether_type, = struct.unpack_from('>H', packet, 0)
+        pos = 20
+    elif link_type == LINKTYPE_NULL:
+        ether_type = 0x0800 if packet[0] == 2 or packet[3] == 2 else 0
+        pos = 4
+    elif link_type == LINKTYPE_RAW:
+        ether_type = 0x0800
+        pos = 0
+    else:
+        return None
+
+    if ether_type != 0x0800 or len(packet) < pos + 20 or (packet[pos] >> 4) != 4:
+        return None
+    ihl = (packet[pos] & 0x0F) * 4
+    total_len, = struct.unpack_from('>H', packet, pos + 2)
+    flags_offset, = struct.unpack_from('>H', packet, pos + 6)
+    if packet[pos+9] != 17 or (flags_offset & 0x3FFF) != 0:
+        return None
+    src = packet[pos+12:pos+16]
+    udp = pos + ihl
+    src_port, dst_port, udp_len = struct.unpack_from('>HHH', packet, udp)
+    payload = packet[udp+8:pos+total_len]
+    if len(payload) != udp_len - 8:
+        return None
+    return src, src_port, dst_port, payload
+
+
+parser = argparse.ArgumentParser(description='Bytes per tracker datagram over serial, with and without delta compression')
+parser.add_argument('captures', nargs='+', help='pcap or pcapng files')
+parser.add_argument('--port', type=int, action='append', metavar='PORT',
+                    help='Server port the trackers send to, can be given more than once(default 6969)')
+parser.add_argument('--streams', type=int, default=DELTA_STREAMS, help='Same as DELTA_STREAMS in src/delta.h')
+parser.add_argument('--max-len', type=int, default=DELTA_MAX_LEN, help='Same as DELTA_MAX_LEN')
+parser.add_argument('--keyframe-interval', type=int, default=DELTA_KEYFRAME_INTERVAL, help='Same as DELTA_KEYFRAME_INTERVAL')
+parser.add_argument('--per-stream', action='store_true', help='Also print the numbers for every tracker and port')
+args = parser.parse_args()
+ports = args.port or [6969]
+
+encoder = DeltaEncoder(args.streams, args.max_len, args.keyframe_interval)
+decoder = DeltaDecoder()
+
+# key -> [datagrams, keyframes, deltas, payload bytes, encoded payload bytes, DATA frame bytes, DELTA frame bytes]
+totals = defaultdict(lambda: [0] * 7)
+for path in args.captures:
+    for link_type, packet in read_capture(path):
+        try:
+            udp = parse_udp(link_type, packet)
+        except struct.error:
+            continue
+        if udp is None or udp[2] not in ports:
+            continue
+        src, src_port, dst_port, payload = udp
+        # The dongle's addressing: last address byte, its local port, the tracker's port
+        key = (src[3], dst_port, src_port)
+
+        data_frame = FRAME_OVERHEAD + DATA_HEADER_SIZE + len(payload)
+        if encoder.accepts(payload):
+            stream, sequence, encoded = encoder.encode(*key, payload)
+            assert decoder.decode(stream, sequence, encoded) == key + (payload,), 'decoder disagrees with the encoder'
+            keyframe = (sequence & DELTA_KEYFRAME) != 0
+            frame = FRAME_OVERHEAD + DELTA_HEADER_SIZE + len(encoded)
+        else:
+            keyframe = False
+            encoded = payload
+            frame = data_frame
+
+        t = totals[key]
+        t[0] += 1
+        t[1] += keyframe
+        t[2] += encoder.accepts(payload) and not keyframe
+        t[3] += len(payload)
+        t[4] += len(encoded)
+        t[5] += data_frame
+        t[6] += frame
+
+def summary(name, t):
+    n = max(t[0], 1)
+    return (f'{name}: {t[0]} datagrams ({t[1]} keyframes, {t[2]} deltas, {t[0] - t[1] - t[2]} too long) ; '
+            f'payload bytes/datagram: {t[3] / n:.1f} -> {t[4] / n:.1f} ; '
+            f'frame bytes/datagram: {t[5] / n:.1f} -> {t[6] / n:.1f} ({100 * (t[6] / max(t[5], 1) - 1):+.1f}%)')
+
+if args.per_stream:
+    for key in sorted(totals):
+        print(summary(f'{key[0]} {key[1]}<-{key[2]}', totals[key]))
+print(summary('All', [sum(t[i] for t in totals.values()) for i in range(7)]))
@@ -0,0 +1,285 @@
+# FRAMING_FEC, same as src/fec.h
+# Frames are split into interleaved Reed-Solomon codewords over GF(256) and sent as 7 bit symbols with an alternating top bit
+FEC_FRAME_START = 0xE7
+FEC_FRAME_END = 0xE8
+FEC_ESC = 0xDB
+FEC_ESC_XOR = 0x20
+
+FEC_HEADER_SIZE = 3
+FEC_HEADER_PARITY = 4
+FEC_HEADER_SYMBOLS = 8
+
+FEC_MAX_PARITY = 8
+FEC_MAX_CODEWORD = 64
+# Defaults of FEC_PARITY/FEC_CODEWORD
+FEC_PARITY = 2
+FEC_CODEWORD = 16
+# Longest frame this side takes, the dongle sends up to FEC_MAX_TX_FRAME
+FEC_MAX_FRAME = 1024
+FEC_MAX_SKIPS = 16
+
+GF_POLY = 0x11D
+
+
+def _gf_tables():
+    exp = [0] * 512
+    log = [0] * 256
+    x = 1
+    for i in range(255):
+        exp[i] = exp[i + 255] = x
+        log[x] = i
+        x <<= 1
+        if x & 0x100:
+            x ^= GF_POLY
+    return exp, log
+
+GF_EXP, GF_LOG = _gf_tables()
+
+
+def gf_mul(a, b):
+    return 0 if a == 0 or b == 0 else GF_EXP[GF_LOG[a] + GF_LOG[b]]
+
+
+def gf_mul_exp(a, power):
+    return 0 if a == 0 else GF_EXP[GF_LOG[a] + power]
+
+
+def gf_inv(a):
+    return GF_EXP[255 - GF_LOG[a]]
+
+
+def _generator(parity):
+    # (x + 2^0)(x + 2^1)..., highest power first
+    g = [1]
+    for i in range(parity):
+        g = [c ^ gf_mul_exp(n, i) for c, n in zip(g + [0], [0] + g)]
+    return g[1:]
+
+GENERATORS = [None] + [_generator(p) for p in range(1, FEC_MAX_PARITY + 1)]
+
+
+def fec_profile_valid(parity, length):
+    return 1 <= parity <= FEC_MAX_PARITY and 2 * parity <= length <= FEC_MAX_CODEWORD
+
+
+# Parity bytes of one codeword
+def fec_encode(data, parity):
+    gen = GENERATORS[parity]
+    out = [0] * parity
+    for b in data:
+        feedback = b ^ out[0]
+        out = out[1:] + [0]
+        if feedback != 0:
+            out = [o ^ gf_mul(feedback, g) for o, g in zip(out, gen)]
+    return bytes(out)
+
+
+# Corrects codeword(a bytearray) in place, erasures - positions of bytes known to be lost
+# Returns the number of bytes it changed, -1 if there were too many errors
+def fec_decode(codeword, parity, erasures):
+    length = len(codeword)
+    if len(erasures) > parity:
+        return -1
+
+    syndromes = []
+    for i in range(parity):
+        s = 0
+        for b in codeword:
+            s = gf_mul_exp(s, i) ^ b
+        syndromes.append(s)
+    if not any(syndromes):
+        return 0
+
+    # Berlekamp-Massey, starting from the locator of the lost bytes
+    lam = [1] + [0] * parity
+    for k, pos in enumerate(erasures):
+        power = length - 1 - pos
+        for j in range(k + 1, 0, -1):
+            lam[j] ^= gf_mul_exp(lam[j - 1], power)
+    prev = list(lam)
+    erased = len(erasures)
+    degree = erased
+    for r in range(erased, parity):
+        delta = 0
+        for i in range(min(degree, r) + 1):
+            delta ^= gf_mul(lam[i], syndromes[r - i])
+        prev = [0] + prev[:-1]
+        if delta == 0:
+            continue
+        nxt = [l ^ gf_mul(delta, p) for l, p in zip(lam, prev)]
+        if 2 * degree <= r + erased:
+            inv = gf_inv(delta)
+            prev = [gf_mul(l, inv) for l in lam]
+            degree = r + 1 + erased - degree
+        lam = nxt
+    if 2 * degree - erased > parity:
+        return -1
+
+    omega = [0] * parity
+    for i in range(parity):
+        for j in range(min(i, degree) + 1):
+            omega[i] ^= gf_mul(lam[j], syndromes[i - j])
+
+    fixes = []
+    for j in range(length):
+        power = length - 1 - j
+        inv_power = (255 - power) % 255
+        v = 0
+        for i in range(degree, -1, -1):
+            v = gf_mul_exp(v, inv_power) ^ lam[i]
+        if v != 0:
+            continue
+        if len(fixes) == degree:
+            return -1
+        num = 0
+        for i in range(parity - 1, -1, -1):
+            num = gf_mul_exp(num, inv_power) ^ omega[i]
+        den = 0
+        for i in range(1, degree + 1, 2):
+            den ^= gf_mul_exp(lam[i], (inv_power * (i - 1)) % 255)
+        if den == 0:
+            return -1
+        fixes.append((j, gf_mul_exp(gf_mul(num, gf_inv(den)), power)))
+    if len(fixes) != degree:
+        return -1
+
+    for pos, value in fixes:
+        codeword[pos] ^= value
+    return sum(1 for _, value in fixes if value != 0)
+
+
+# Codeword count and how the frame is spread over them, the first long_count codewords get one more byte
+def _layout(frame_len, parity, length):
+    count = -(-frame_len // (length - parity))
+    return count, frame_len // count, frame_len % count
+
+
+def fec_encode_frame(frame, parity=FEC_PARITY, length=FEC_CODEWORD):
+    count, short_data, long_count = _layout(len(frame), parity, length)
+    codewords = []
+    pos = 0
+    for i in range(count):
+        data = frame[pos:pos + short_data + (i < long_count)]
+        pos += len(data)
+        codewords.append(bytes(data) + fec_encode(data, parity))
+
+    header = bytes([length, parity | (len(frame) >> 8) << 4, len(frame) & 0xFF])
+    body = bytearray(header + fec_encode(header, FEC_HEADER_PARITY))
+    for row in range(max(len(c) for c in codewords)):
+        for c in codewords:
+            if row < len(c):
+                body.append(c[row])
+
+    out = bytearray([FEC_FRAME_START])
+    bits = int.from_bytes(body, 'big')
+    bit_count = len(body) * 8
+    pad = -bit_count % 7
+    bits <<= pad
+    bit_count += pad
+    phase = 0
+    for shift in range(bit_count - 7, -1, -7):
+        b = ((bits >> shift) & 0x7F) | phase
+        phase ^= 0x80
+        if b in (FEC_FRAME_START, FEC_FRAME_END, FEC_ESC):
+            out.append(FEC_ESC)
+            b ^= FEC_ESC_XOR
+        out.append(b)
+    out.append(FEC_FRAME_END)
+    return out
+
+
+# First count bytes of 7 bit symbols and the indices of those with bits from a lost symbol
+def _unpack(values, lost, count):
+    bits = 0
+    lost_bits = 0
+    for v, l in zip(values, lost):
+        bits = bits << 7 | v
+        lost_bits = lost_bits << 7 | (0x7F if l else 0)
+    extra = len(values) * 7 - count * 8
+    bits >>= extra
+    lost_bits >>= extra
+    out = bytearray(bits.to_bytes(count, 'big'))
+    return out, [i for i in range(count) if (lost_bits >> ((count - 1 - i) * 8)) & 0xFF]
+
+
+class FecDecoder:
+    def __init__(self):
+        # Codewords that needed repairs, reset by the caller
+        self.corrected = 0
+
+    # Bytes between FEC_FRAME_START and FEC_FRAME_END, returns the frame or None if it was broken beyond repair
+    def decode(self, data):
+        symbols = bytearray()
+        escaping = False
+        for b in data:
+            if b == FEC_ESC:
+                escaping = True
+                continue
+            if escaping:
+                escaping = False
+                b ^= FEC_ESC_XOR
+            symbols.append(b)
+
+        # A lone top bit repeat comes right after a skipped symbol, a pair of them is a flipped top bit
+        skips = []
+        s = 0
+        while s < len(symbols):
+            prev_phase = symbols[s - 1] & 0x80 if s > 0 else 0x80
+            if symbols[s] & 0x80 == prev_phase:
+                if s + 1 < len(symbols) and symbols[s + 1] & 0x80 == symbols[s] & 0x80:
+                    s += 1
+                else:
+                    skips.append(s)
+            s += 1
+
+        ret = None
+        if 0 < len(skips) <= FEC_MAX_SKIPS:
+            ret = self._decode(symbols, skips)
+        if ret is None:
+            ret = self._decode(symbols, [])
+        return ret
+
+    def _decode(self, symbols, skips):
+        # Symbols with a lost one put back in front of every index in skips, True marks the lost ones
+        values = []
+        lost = []
+        skip_set = set(skips)
+        for i, sym in enumerate(symbols):
+            if i in skip_set:
+                values.append(0)
+                lost.append(True)
+            values.append(sym & 0x7F)
+            lost.append(False)
+
+        if len(values) < FEC_HEADER_SYMBOLS:
+            return None
+        header, erased = _unpack(values[:FEC_HEADER_SYMBOLS], lost[:FEC_HEADER_SYMBOLS], FEC_HEADER_SIZE + FEC_HEADER_PARITY)
+        if fec_decode(header, FEC_HEADER_PARITY, erased) < 0:
+            return None
+        length, parity = header[0], header[1] & 0x0F
+        frame_len = (header[1] >> 4) << 8 | header[2]
+        if not fec_profile_valid(parity, length) or frame_len == 0 or frame_len > FEC_MAX_FRAME:
+            return None
+
+        # Anything else means bytes were inserted, or the skips were guessed wrong
+        count, short_data, long_count = _layout(frame_len, parity, length)
+        body_len = frame_len + count * parity
+        if len(values) - FEC_HEADER_SYMBOLS != (body_len * 8 + 6) // 7:
+            return None
+        body, erased = _unpack(values[FEC_HEADER_SYMBOLS:], lost[FEC_HEADER_SYMBOLS:], body_len)
+        erased = set(erased)
+
+        frame = bytearray()
+        repaired = 0
+        short_len = short_data + parity
+        for i in range(count):
+            data_len = short_data + (i < long_count)
+            positions = [j * count + i if j < short_len else short_len * count + i for j in range(data_len + parity)]
+            codeword = bytearray(body[t] for t in positions)
+            ret = fec_decode(codeword, parity, [j for j, t in enumerate(positions) if t in erased])
+            if ret < 0:
+                return None
+            repaired += ret > 0
+            frame += codeword[:data_len]
+        self.corrected += repaired
+        return bytes(frame)
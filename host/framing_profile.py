@@ -0,0 +1,72 @@
+# Framing profiles from framing_profiles.json, the same file the firmware build takes its profile from
+# See src/framing_profile.h for what each field means, both sides have to use the same profile
+import json
+import os
+import struct
+
+PROFILES_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'framing_profiles.json')
+ADDRESS_FORMATS = {1: 'B', 4: 'I'}
+PORT_FORMATS = {1: 'B', 2: 'H'}
+
+
+def load_profiles(path=PROFILES_PATH):
+    with open(path) as f:
+        return json.load(f)
+
+
+class FramingProfile:
+    def __init__(self, name, spec):
+        self.name = name
+        self.description = spec.get('description', '')
+        self.fragment_size = spec['fragment_size']
+        # Longest datagram the dongle takes from the host, it has buffers for that many fragments
+        self.max_datagram_size = spec['max_datagram_size']
+        self.address_size = spec['address_size']
+        self.port_size = spec['port_size']
+        self.port_base = spec.get('port_base', 0)
+        # Whether the dongle was built with FRAMING_FEC
+        self.fec = spec.get('fec', True)
+        self.crc16_poly = int(spec['crc16_poly'], 0)
+        if self.address_size not in ADDRESS_FORMATS or self.port_size not in PORT_FORMATS:
+            raise ValueError(f'framing profile {name}: unsupported address_size or port_size')
+
+        self.address_format = '<' + ADDRESS_FORMATS[self.address_size]
+        self.ports_format = '<' + PORT_FORMATS[self.port_size] * 2
+        # Address, local port, remote port, as in DATA/FRAGMENT headers, batch records and delta keyframes
+        self.addressing_format = self.address_format + self.ports_format[1:]
+        self.addressing_size = struct.calcsize(self.addressing_format)
+        self._port_offset = self.port_base if self.port_size == 1 else 0
+
+    def port_fits(self, port):
+        return self.port_size == 2 or self.port_base <= port <= self.port_base + 0xFF
+
+    def pack_ports(self, local_port, remote_port):
+        return struct.pack(self.ports_format, local_port - self._port_offset, remote_port - self._port_offset)
+
+    def unpack_ports(self, data, pos=0):
+        local_port, remote_port = struct.unpack_from(self.ports_format, data, pos)
+        return local_port + self._port_offset, remote_port + self._port_offset
+
+    def pack_addressing(self, addr, local_port, remote_port):
+        return struct.pack(self.address_format, addr) + self.pack_ports(local_port, remote_port)
+
+    # Returns (address, local port, remote port)
+    def unpack_addressing(self, data, pos=0):
+        addr, = struct.unpack_from(self.address_format, data, pos)
+        return (addr,) + self.unpack_ports(data, pos + self.address_size)
+
+    def address_str(self, addr):
+        if self.address_size == 4:
+            return '.'.join(str(b) for b in struct.pack('<I', addr))
+        return f'192.168.4.{addr}'
+
+
+def load_profile(name, path=PROFILES_PATH):
+    profiles = load_profiles(path)
+    if name not in profiles:
+        raise ValueError(f'unknown framing profile {name}, {path} has: {", ".join(profiles)}')
+    return FramingProfile(name, profiles[name])
+
+
+# Used when nothing else is picked, also what the firmware defaults to without the build script
+DEFAULT_PROFILE = FramingProfile('default', {'fragment_size': 256, 'max_datagram_size': 2048, 'address_size': 1, 'port_size': 2, 'crc16_poly': '0x5935'})
@@ -0,0 +1,94 @@
+# Serial link loss accounting and retransmission, same as src/retransmit.h
+# Every frame carries a sequence number, 0 only when the sender just started. DATA frames of reliable ports are kept
+# and numbered in a sequence of their own(FRAME_FLAG_RELIABLE), the receiver NACKs gaps in that one and the sender
+# sends the frames again. Gaps in the other frames are only counted
+from collections import OrderedDict
+
+# Most sequence numbers in one NACK frame, same as on the dongle
+NACK_MAX_MISSING = 16
+NACK_RETRY_S = 0.03
+NACK_TRIES = 3
+# Frames kept for NACKs from the dongle, the dongle keeps fewer
+RETRANSMIT_SLOTS = 64
+
+
+def next_sequence(sequence):
+    sequence = (sequence + 1) & 0xFFFF
+    return sequence if sequence != 0 else 1
+
+
+class SequenceTracker:
+    # nack - ask for missing frames, otherwise only count them
+    def __init__(self, nack):
+        self.nack = nack
+        self._expected = None
+        # sequence -> [tries, next time]
+        self._missing = OrderedDict()
+        # Counters, reset by the caller
+        self.lost = 0
+        self.recovered = 0
+
+    # Returns False for a retransmitted frame that isn't missing(anymore), it was delivered already
+    def received(self, sequence, retransmitted, now):
+        if retransmitted:
+            if self._missing.pop(sequence, None) is None:
+                return False
+            self.recovered += 1
+            return True
+
+        # More than half the sequence space behind means the other side started over without its first frame coming through
+        gap = 0 if self._expected is None else (sequence - self._expected) & 0xFFFF
+        if self._expected is None or sequence == 0 or gap >= 0x8000:
+            self._missing.clear()
+            self._expected = sequence
+            gap = 0
+        elif gap > 0 and sequence < self._expected:
+            # 0 is skipped when wrapping
+            gap -= 1
+
+        self.lost += gap
+        if self.nack:
+            # Only the newest ones of a long run, the rest would be given up anyway
+            s = self._expected if gap <= NACK_MAX_MISSING else (sequence - NACK_MAX_MISSING) & 0xFFFF
+            while s != sequence:
+                if s != 0:
+                    self._missing[s] = [0, now]
+                s = (s + 1) & 0xFFFF
+            while len(self._missing) > NACK_MAX_MISSING:
+                self._missing.popitem(last=False)
+
+        self._expected = next_sequence(sequence)
+        return True
+
+    # Sequence numbers to ask for now
+    def take_nacks(self, now):
+        ret = []
+        for sequence in list(self._missing):
+            tries, next_time = self._missing[sequence]
+            if now < next_time:
+                continue
+            if tries == NACK_TRIES:
+                # Given up once the last try had its time
+                del self._missing[sequence]
+                continue
+            ret.append(sequence)
+            self._missing[sequence] = [tries + 1, now + NACK_RETRY_S]
+        return ret
+
+    def nacks_pending(self):
+        return len(self._missing) > 0
+
+
+# The last RETRANSMIT_SLOTS kept frames, type..payload
+class RetransmitRing:
+    def __init__(self):
+        self._frames = OrderedDict()
+
+    def keep(self, sequence, frame):
+        self._frames.pop(sequence, None)
+        self._frames[sequence] = frame
+        if len(self._frames) > RETRANSMIT_SLOTS:
+            self._frames.popitem(last=False)
+
+    def find(self, sequence):
+        return self._frames.get(sequence)
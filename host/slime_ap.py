@@ -1,27 +1,180 @@
-import socket, struct, time, sys
+import socket, struct, time, sys, re
+import argparse
 import threading
 import selectors
 from collections import deque
 
 import serial
 
+from crc16 import crc16, set_crc16_poly
+from delta import DeltaDecoder
+from framing_profile import DEFAULT_PROFILE, load_profile, load_profiles
+from retransmit import SequenceTracker, RetransmitRing, NACK_RETRY_S, next_sequence
+from fec import FEC_FRAME_START, FEC_FRAME_END, FEC_PARITY, FEC_CODEWORD, FecDecoder, fec_encode_frame, fec_profile_valid
 
-def crc16(data, crc, poly=0x5935):
-    cur = crc & 0xFFFF
+
+# Port of src/dumb_serial.c
+DUMB_FRAME_START = 0xE6
+DUMB_FRAME_END = 0xE9
+DUMB_ESC = 0xDB
+DUMB_ESC_END = 0xDC
+DUMB_ESC_ESC = 0xDD
+DUMB_ESC_START = 0xDE
+
+DUMB_ESCAPES = {DUMB_FRAME_START: DUMB_ESC_START, DUMB_FRAME_END: DUMB_ESC_END, DUMB_ESC: DUMB_ESC_ESC}
+DUMB_UNESCAPES = {v: k for k, v in DUMB_ESCAPES.items()}
+
+
+def dumb_serial_encode(data):
+    out = bytearray([DUMB_FRAME_START])
+    flip_bit = 0
+    for start in range(0, len(data), 7):
+        part = data[start:start+7]
+        
+        chunk = bytearray()
+        upper_bits = 0
+        for i, b in enumerate(part):
+            upper_bits |= (b & 0x80) >> (i + 1)
+            chunk.append((b & 0x7F) | flip_bit)
+            flip_bit ^= 0x80
+        chunk.append(upper_bits | flip_bit)
+        flip_bit ^= 0x80
+        
+        parity = 0
+        for b in chunk:
+            parity ^= b
+        chunk.append((parity & 0x7F) | flip_bit)
+        flip_bit ^= 0x80
+        
+        for b in chunk:
+            if b in DUMB_ESCAPES:
+                out.append(DUMB_ESC)
+                b = DUMB_ESCAPES[b]
+            out.append(b)
+    out.append(DUMB_FRAME_END)
+    return out
+
+
+class DumbSerialDecoder:
+    def __init__(self):
+        self.corrected = 0
+        self.reset()
+    
+    def reset(self):
+        self.out = bytearray()
+        self._chunk = bytearray()
+        self._skip_bit = 0
+        self._skip_cnt = 0
+        self._skip_idx = 0
+        self._escaping = False
+    
+    def _end_chunk(self):
+        chunk = self._chunk
+        skip_cnt = self._skip_cnt
+        self._chunk = bytearray()
+        self._skip_cnt = 0
+        
+        if len(chunk) < 3:
+            return
+        
+        # Exactly one skipped byte can be restored from parity
+        if skip_cnt == 1:
+            parity = 0
+            for b in chunk:
+                parity ^= b
+            chunk[self._skip_idx] = parity
+            self.corrected += 1
+        
+        upper_bits = chunk[-2]
+        for b in chunk[:-2]:
+            upper_bits = (upper_bits << 1) & 0xFF
+            self.out.append(b | (upper_bits & 0x80))
+    
+    # Feed bytes between FRAME_START and FRAME_END(exclusive)
+    def feed(self, data):
+        for b in data:
+            if b == DUMB_ESC:
+                self._escaping = True
+                continue
+            if self._escaping:
+                self._escaping = False
+                b = DUMB_UNESCAPES.get(b, b)
+            
+            upper_bit = b >> 7
+            b &= 0x7F
+            if upper_bit != self._skip_bit:
+                self._skip_idx = len(self._chunk)
+                self._chunk.append(0)
+                self._skip_cnt += 1
+            self._skip_bit = upper_bit ^ 1
+            
+            add_later = len(self._chunk) >= 9
+            if not add_later:
+                self._chunk.append(b)
+            if len(self._chunk) >= 9:
+                self._end_chunk()
+            if add_later:
+                self._chunk.append(b)
+    
+    def finish(self):
+        self._end_chunk()
+        ret = bytes(self.out)
+        self.reset()
+        return ret
+
+
+# Same bucketing as src/histogram.cpp: exact below 8, then 4 buckets per power of two
+class Histogram:
+    SUB_BUCKETS = 4
+    BUCKETS = SUB_BUCKETS * 24
+    
+    def __init__(self):
+        self.reset()
     
-    for c in data:
-        j = 0x80
-        while j > 0:
-            bit = (cur & 0x8000) > 0
-            if (c & j) > 0:
-                bit = not bit
-            cur <<= 1
-            cur &= 0xFFFF
-            if bit:
-                cur ^= poly
-            j >>= 1
+    def reset(self):
+        self.buckets = [0] * self.BUCKETS
+        self.count = 0
+        self.max = 0
+    
+    @classmethod
+    def _index(cls, value):
+        if value < 2 * cls.SUB_BUCKETS:
+            return value
+        msb = value.bit_length() - 1
+        sub = (value >> (msb - 2)) & (cls.SUB_BUCKETS - 1)
+        return min((msb - 1) * cls.SUB_BUCKETS + sub, cls.BUCKETS - 1)
+    
+    @classmethod
+    def _low(cls, index):
+        if index < 2 * cls.SUB_BUCKETS:
+            return index
+        msb = index // cls.SUB_BUCKETS + 1
+        return (cls.SUB_BUCKETS + index % cls.SUB_BUCKETS) << (msb - 2)
+    
+    def add(self, value):
+        value = max(0, int(value))
+        self.buckets[self._index(value)] += 1
+        self.count += 1
+        self.max = max(self.max, value)
+    
+    def percentile(self, p):
+        if self.count == 0:
+            return 0
+        target = (self.count * p + 99) // 100
+        seen = 0
+        for i, c in enumerate(self.buckets):
+            seen += c
+            if seen >= target:
+                high = self._low(i + 1) - 1 if i + 1 < self.BUCKETS else self.max
+                return min(high, self.max)
+        return self.max
+    
+    def __str__(self):
+        return f'count={self.count} p50={self.percentile(50)}us p99={self.percentile(99)}us max={self.max}us'
+
 
-    return cur
+def now_us():
+    return (time.perf_counter_ns() // 1000) & 0xFFFFFFFF
 
 
 def open_udp(port):
@@ -32,73 +185,827 @@ def open_udp(port):
 
 
 TARGET_ADDRESS = '127.0.0.1'
-PREAMBLE = bytes([0xCF, 0xEB, 0x01, 0x81])
+# Frame: sync(preamble framing only), type, length, sequence number(see retransmit.py), timestamps(FRAME_FLAG_TIMESTAMPS only),
+# type specific header, payload, CRC16 over type..payload. See src/packet_framing.h
+FRAME_SYNC = bytes([0xCF, 0xEB, 0x01])
+FRAME_TYPE_DATA = 0x81
+FRAME_TYPE_BATCH = 0x82
+FRAME_TYPE_CONTROL = 0x83
+FRAME_TYPE_FRAGMENT = 0x84
+FRAME_TYPE_DELTA = 0x85
+FRAME_TYPE_TELEMETRY = 0x86
+FRAME_TYPE_LOG = 0x87
+FRAME_TYPE_NACK = 0x88
+# Host->dongle only. header: ports, address count; payload: addresses, datagram. Count 0 = subnet broadcast
+FRAME_TYPE_MULTICAST = 0x89
+FRAME_FLAG_TIMESTAMPS = 0x40
+FRAME_FLAG_RETRANSMIT = 0x20
+# Kept for NACKs, numbered in a sequence of their own
+FRAME_FLAG_RELIABLE = 0x10
+FRAME_FLAGS = FRAME_FLAG_TIMESTAMPS | FRAME_FLAG_RETRANSMIT | FRAME_FLAG_RELIABLE
+# Address and ports are laid out by the framing profile, see framing_profile.py
+FRAME_HEADERS = {
+    FRAME_TYPE_DATA: DEFAULT_PROFILE.addressing_format, # address, local port, remote port
+    FRAME_TYPE_BATCH: '<',
+    FRAME_TYPE_CONTROL: '<',
+    FRAME_TYPE_FRAGMENT: DEFAULT_PROFILE.addressing_format + 'BHH', # addressing, datagram id, fragment index, fragment count
+    FRAME_TYPE_DELTA: '<BB', # stream, sequence, see delta.py
+    FRAME_TYPE_TELEMETRY: '<B', # kind, TELEMETRY_*
+    FRAME_TYPE_LOG: '<',
+    FRAME_TYPE_NACK: '<', # payload: missing sequence numbers(2 each)
+}
+# Longer datagrams are split into FRAGMENT frames, the dongle doesn't take longer DATA or FRAGMENT frames
+FRAGMENT_SIZE = DEFAULT_PROFILE.fragment_size
+# Datagrams being put together at the same time, dropped after this long without a new fragment
+REASSEMBLY_SLOTS = 8
+REASSEMBLY_TIMEOUT_S = 0.5
+BATCH_SAME_PORTS = 0x8000
+# Bytes that can start a frame, everything else is text
+FRAME_START_RE = re.compile(b'[%s]' % re.escape(bytes([FRAME_SYNC[0], DUMB_FRAME_START, FEC_FRAME_START])))
+# A lost DELTA frame breaks its stream until the next keyframe, ask for them at most this often
+RESYNC_INTERVAL_S = 0.05
+# Longer DATA, FRAGMENT and DELTA frames can't be valid, others can't be longer than this
+FRAME_MAX_LENGTH = 1024
+# A dumb_serial or FEC frame without its end byte after this many bytes is dropped
+DUMB_MAX_FRAME_BYTES = 4096
+# The bridge loop wakes up at least this often to notice close()
+SELECT_TIMEOUT_S = 0.5
+# Datagrams read from one UDP socket before looking at the others again
+UDP_READS_PER_EVENT = 64
+# How the same datagram for several trackers is sent, see SerialProxy._encode_fanout
+# off - a frame per tracker, list - one MULTICAST frame naming them, broadcast - same, but a datagram for every
+# tracker the host knows of is broadcast to the subnet
+FANOUT_MODES = ['off', 'list', 'broadcast']
+
+# Control frame payload: command, sequence number, arguments. The dongle answers every command with
+# command | CONTROL_ACK, the same sequence number, status, reply data
+CONTROL_LATENCY_REPORT = 0x01
+CONTROL_SET_CONFIG = 0x02
+CONTROL_GET_CONFIG = 0x03
+CONTROL_ADD_PORT = 0x04
+CONTROL_REMOVE_PORT = 0x05
+CONTROL_SET_BAUD = 0x06
+CONTROL_BAUD_CONFIRM = 0x07
+CONTROL_ECHO = 0x08
+CONTROL_RESYNC = 0x09
+CONTROL_SET_RELIABLE = 0x0A
+CONTROL_PROFILER_REPORT = 0x0B
+CONTROL_ACK = 0x80
+CONTROL_STATUS = ['ok', 'unknown command or key', 'bad value', 'failed']
+
+# TELEMETRY frame kinds, in its header. Same as src/telemetry.h
+TELEMETRY_STATS = 0
+TELEMETRY_LATENCY = 1
+TELEMETRY_PROFILE = 2
+# TELEMETRY_STATS payload: globals, tracker count(1), tracker records
+TELEMETRY_GLOBALS = ('<IIIBIIIIIIHHIIHIIIIIIIIIIIBI', [
+    'interval_ms', 'loops', 'baud', 'framing', 'bad_frames', 'repaired_chunks',
+    'udp_queue_dropped', 'serial_rx_dropped_bytes', 'tx_queue_dropped', 'incomplete_fragmented',
+    'tx_queue_depth', 'tx_queue_max_depth', 'tx_queue_bytes', 'tx_queue_budget', 'uart_tx_free',
+    'tx_superseded', 'tx_age_avg_us', 'tx_age_max_us',
+    'frames_lost', 'frames_recovered', 'frames_resent', 'keyframes', 'deltas', 'saved_bytes',
+    'heap_free_min', 'heap_max_block_min', 'pbuf_pool_in_use', 'pbuf_pool_exhausted'])
+TELEMETRY_TRACKER = ('<BIIIIIIII', [
+    'address', 'wifi2serial_packets', 'wifi2serial_bytes', 'serial2wifi_packets', 'serial2wifi_bytes',
+    'send_errors', 'dropped', 'crc_failures', 'last_seen_ago_ms'])
+TELEMETRY_NEVER = 0xFFFFFFFF
+# TELEMETRY_LATENCY payload: count, p50, p99, max for each of these, same order as LatencyHop in src/latency.h
+DONGLE_LATENCY_HOPS = ['udp_rx->serial_tx', 'host_tx->serial_rx(rel)', 'serial_rx->udp_tx']
+LATENCY_HOP_REPORT = '<IIII'
+# TELEMETRY_PROFILE payload: a stage, then index(1) and count(4) of its histogram buckets that aren't empty
+# Stages in the order of ProfileStage in src/loop_profiler.h
+PROFILE_STAGES = ['loop', 'led', 'serial2wifi', 'frame_rx', 'wifi2serial', 'serial_tx', 'frame_tx', 'uart_write', 'yield', 'wait']
+PROFILE_STAGE_REPORT = ('<BIHIIIIIIH', ['stage', 'window_us', 'cpu_mhz', 'count', 'min', 'avg', 'p50', 'p99', 'max', 'share'])
+
+# LOG frame payload: records dropped(2), records of id(1), level << 4 | argument count(1), millis(4), arguments(4 each)
+# The dongle only sends the message id, formats are indexed by LogId in src/log.h
+LOG_LEVELS = ['debug', 'info', 'warn', 'error']
+LOG_SUPPRESSED = 0
+# (name, format of the arguments)
+LOG_MESSAGES = [
+    ('suppressed', '{1} more {0}'),
+    ('crc_mismatch', 'expected {0:04X}, got {1:04X} ; frame type {2:02X} ; {3} bytes'),
+    ('frame_too_long', 'frame type {0:02X} claims {1} bytes'),
+    ('codec_bad_frame', '{0} bytes ; frame type {1:02X}'),
+    ('baud_not_confirmed', 'back to {0}'),
+    ('baud_fallback', 'serial link broken at {0} baud, back to {1}'),
+]
+
+# Runtime settings, see CONFIG_* in src/packet_framing.h
+CONFIG_KEYS = {
+    'stats_interval_ms': 0x01,
+    'tx_power_qdbm': 0x02,
+    'phy_mode': 0x03,
+    'sleep_mode': 0x04,
+    'udp_queue_len': 0x05,
+    'batch_max_bytes': 0x06,
+    'batch_hold_us': 0x07,
+    'tx_queue_bytes': 0x08,
+    # 0 = drop oldest, 1 = drop from the tracker holding the most bytes
+    'tx_drop_policy': 0x09,
+    # 1 = send datagrams as changes to the previous one of the same tracker and ports
+    'compression': 0x0A,
+    # Profile of the FEC framing, set as PARITY/LENGTH
+    'fec': 0x0B,
+    # Bit n lets a newer SlimeVR packet replace a queued one under rule n of src/coalesce.cpp, 0x7F = all of them
+    'coalesce': 0x0C,
+}
+CONFIG_NAMES = {v: k for k, v in CONFIG_KEYS.items()}
+
+# Same as SERIAL_BAUD/BAUD_CONFIRM_MS in src/baud.h
+DEFAULT_BAUD = 115200 * 10
+BAUD_CONFIRM_S = 1.0
+BAUD_CANDIDATES = [3000000, 2000000, 1500000, DEFAULT_BAUD, 921600, 460800, 230400, 115200]
+BAUD_TEST_FRAMES = 50
+# Consecutive 1.5s stats periods over the error threshold before stepping down
+BAUD_BAD_PERIODS = 2
+# Sync bytes, codec escapes, newline, extremes, alternating bits
+BAUD_TEST_PATTERN = bytes([0xCF, 0xEB, 0x01, 0xE6, 0xE9, 0xDB, 0x0A, 0x00, 0xFF, 0x55, 0xAA]) + bytes(range(0, 256, 7))
+
+
+def log_level_name(level):
+    return LOG_LEVELS[level] if level < len(LOG_LEVELS) else str(level)
+
+
+def format_log(msg_id, args):
+    if msg_id >= len(LOG_MESSAGES):
+        return f'message {msg_id}: {args}'
+    name, fmt = LOG_MESSAGES[msg_id]
+    if msg_id == LOG_SUPPRESSED and len(args) == 2 and args[0] < len(LOG_MESSAGES):
+        args = (LOG_MESSAGES[args[0]][0], args[1])
+    try:
+        return f'{name}: {fmt.format(*args)}'
+    except (IndexError, ValueError):
+        return f'{name}: {args}'
+
+
+# Has to be the profile the dongle was built with, call before anything is framed
+def set_framing_profile(profile):
+    global FRAGMENT_SIZE
+    set_crc16_poly(profile.crc16_poly)
+    FRAGMENT_SIZE = profile.fragment_size
+    FRAME_HEADERS[FRAME_TYPE_DATA] = profile.addressing_format
+    FRAME_HEADERS[FRAME_TYPE_FRAGMENT] = profile.addressing_format + 'BHH'
+
+
+def frame_max_length(frame_type):
+    if (frame_type & ~FRAME_FLAGS) in (FRAME_TYPE_DATA, FRAME_TYPE_FRAGMENT, FRAME_TYPE_DELTA):
+        return FRAGMENT_SIZE
+    return FRAME_MAX_LENGTH
+
+
+def frame_header_len(frame_type):
+    base_type = frame_type & ~FRAME_FLAGS
+    if base_type not in FRAME_HEADERS:
+        return None
+    # Length, sequence number
+    ret = 4 + struct.calcsize(FRAME_HEADERS[base_type])
+    if frame_type & FRAME_FLAG_TIMESTAMPS:
+        ret += 8
+    return ret
+
+
+LATENCY_HOPS = [
+    'dongle udp_rx->serial_tx',
+    'dongle_tx->host_rx(rel)',
+    'host serial_rx->udp_tx',
+    'host udp_rx->serial_tx',
+]
+
+FRAMING_MODES = ['preamble', 'dumb', 'fec']
 class SerialProxy:
-    def __init__(self, serial_port):
+    # fec - (parity, codeword length) for the FEC framing
+    # profile - framing profile the dongle was built with, set_framing_profile() has to be called with it as well
+    # fanout - FANOUT_MODES, fanout_hold - seconds to wait for the copies of a datagram for the other trackers
+    def __init__(self, serial_port, framing='preamble', latency=False, fec=(FEC_PARITY, FEC_CODEWORD), profile=DEFAULT_PROFILE,
+                 fanout='off', fanout_hold=0.001):
         self.serial_port = serial_port
+        self.profile = profile
+        self.fanout = fanout
+        self.fanout_hold = fanout_hold
+        self.framing = framing
+        self.fec = fec
+        self.latency = latency
+        self.latency_hops = {k: Histogram() for k in LATENCY_HOPS}
+        self._transit_base = None
+        self._decoder = DumbSerialDecoder()
+        self._fec_decoder = FecDecoder()
         self._port_to_conn = {}
         self._remote_addr_to_port = {}
         self._port_to_remote_addr = {}
         
+        # Serial and every UDP socket, all served by run()
         self._selector = selectors.DefaultSelector()
         self._buffered_msg = bytearray()
+        # Serial bytes not parsed yet
+        self._rx = bytearray()
         
         self._data_counter = 0
         self._loop_counter = 0
         self._checksum_fails_counter = 0
         self._packets_counter = 0
+        self._corrected_counter = 0
+        self._fragment_drops_counter = 0
+        self._resync_counter = 0
+        self._oversize_counter = 0
+        self._fanout_saved_counter = 0
         self._stats_time = time.perf_counter_ns()
+        # Never reset, for the baud rate monitor
+        self.good_frames = 0
+        self.bad_frames = 0
+        
+        # Held from numbering a frame until it is written, so frames go out in order
+        self._write_lock = threading.RLock()
+        self._control_seq = 0
+        self._control_replies = {}
+        self._control_cond = threading.Condition()
+        
+        # (address, local port, remote port, datagram id) -> [next index, count, parts, last fragment time]
+        self._reassembly = {}
+        self._fragment_id = 0
+        
+        self._delta = DeltaDecoder(profile)
+        self._last_resync = 0
+        
+        # Ports whose DATA frames are sent again when the other side NACKs them, see retransmit.py
+        self.reliable_ports = set()
+        # Of the frames that aren't kept and the ones that are
+        self._tx_sequence = 0
+        self._tx_reliable_sequence = 0
+        self._kept = RetransmitRing()
+        # Only the dongle's reliable frames are asked for again
+        self._rx_sequence = SequenceTracker(False)
+        self._rx_reliable_sequence = SequenceTracker(True)
+        self._resent_counter = 0
+        
+        # (globals, {address: tracker}) from the latest TELEMETRY frame
+        self.telemetry = None
+        self._telemetry_new = False
+        self._log_lines = []
         
         self._running = True
     
-    def _send_serial_packet(self, addr, local_port, remote_port, data):
-        crc = 0
-        header = struct.pack('<HBHH', len(data), addr, local_port, remote_port)
-        crc = crc16(header, crc)
-        crc = crc16(data, crc)
-        
-        b = bytearray()
-        b += PREAMBLE
-        b += header
-        b += data
-        b += struct.pack('<HB', crc, 10)
-        self.serial_port.write(b)
-    
-    def _next_serial_packet(self):
-        match_idx = 0
-        while match_idx < 4:
-            b = self.serial_port.read()
-            if len(b) == 0:
-                return None
-            b = b[0]
-            
-            if b == PREAMBLE[match_idx]:
-                match_idx += 1
-                continue
-            
-            if match_idx > 0:
-                self._buffered_msg.extend(PREAMBLE[:match_idx])
-                match_idx = 0
-            
-            self._buffered_msg.append(b)
+    # Appends the frame to out, as it goes out on serial. keep - it can be sent again after a NACK
+    # Call with _write_lock held
+    def _encode_serial_frame(self, out, frame_type, header, data, rx_time=None, keep=False):
+        timestamps = b''
+        if rx_time is not None:
+            frame_type |= FRAME_FLAG_TIMESTAMPS
+            timestamps = struct.pack('<II', rx_time, now_us())
+        if keep:
+            frame_type |= FRAME_FLAG_RELIABLE
+            sequence = self._tx_reliable_sequence
+            self._tx_reliable_sequence = next_sequence(sequence)
+        else:
+            sequence = self._tx_sequence
+            self._tx_sequence = next_sequence(sequence)
+        frame = struct.pack('<BHH', frame_type, len(data), sequence) + timestamps + header + data
+        if keep:
+            self._kept.keep(sequence, frame)
+        self._encode_raw_frame(out, frame)
+    
+    # Same with a frame that has everything but the CRC
+    def _encode_raw_frame(self, out, frame):
+        frame += struct.pack('<H', crc16(frame, 0))
+        if self.framing == 'dumb':
+            out += dumb_serial_encode(frame)
+        elif self.framing == 'fec':
+            out += fec_encode_frame(frame, *self.fec)
+        else:
+            out += FRAME_SYNC
+            out += frame
+        out.append(10)
+    
+    def _write_serial(self, data):
+        # Control commands are sent from other threads
+        with self._write_lock:
+            self.serial_port.write(data)
+    
+    def _send_serial_frame(self, frame_type, header, data, rx_time=None):
+        out = bytearray()
+        with self._write_lock:
+            self._encode_serial_frame(out, frame_type, header, data, rx_time)
+            self._write_serial(out)
+    
+    def _encode_serial_packet(self, out, addr, local_port, remote_port, data, rx_time):
+        # The dongle doesn't listen on ports the framing profile can't name either
+        if not (self.profile.port_fits(local_port) and self.profile.port_fits(remote_port)):
+            return
+        # The dongle would drop it once every fragment went over serial
+        if len(data) > self.profile.max_datagram_size:
+            self._oversize_counter += 1
+            return
+        timestamp = rx_time if self.latency else None
+        addressing = self.profile.pack_addressing(addr, local_port, remote_port)
+        if len(data) <= FRAGMENT_SIZE:
+            header = addressing
+            self._encode_serial_frame(out, FRAME_TYPE_DATA, header, data, timestamp, local_port in self.reliable_ports)
+        else:
+            datagram_id = self._fragment_id
+            self._fragment_id = (self._fragment_id + 1) & 0xFF
+            count = (len(data) + FRAGMENT_SIZE - 1) // FRAGMENT_SIZE
+            for index in range(count):
+                header = addressing + struct.pack('<BHH', datagram_id, index, count)
+                self._encode_serial_frame(out, FRAME_TYPE_FRAGMENT, header, data[index*FRAGMENT_SIZE:(index+1)*FRAGMENT_SIZE], timestamp)
+    
+    # The same datagram for several trackers in as few MULTICAST frames as fit, addrs - in the order they came in
+    def _encode_fanout(self, out, addrs, local_port, remote_port, data, rx_time):
+        timestamp = rx_time if self.latency else None
+        keep = local_port in self.reliable_ports
+        known = {a for a, port in self._remote_addr_to_port if port == remote_port}
+        if self.fanout == 'broadcast' and set(addrs) == known:
+            self._fanout_saved_counter += len(addrs) - 1
+            addrs = []
+        max_addrs = min((FRAGMENT_SIZE - len(data)) // self.profile.address_size, 0xFF)
+        for i in range(0, max(len(addrs), 1), max(max_addrs, 1)):
+            chunk = addrs[i:i+max_addrs]
+            header = self.profile.pack_ports(local_port, remote_port) + struct.pack('<B', len(chunk))
+            payload = b''.join(struct.pack(self.profile.address_format, a) for a in chunk) + data
+            self._encode_serial_frame(out, FRAME_TYPE_MULTICAST, header, payload, timestamp, keep)
+            self._fanout_saved_counter += max(len(chunk) - 1, 0)
+    
+    # Returns the whole datagram once its last fragment is in, otherwise None
+    def _add_fragment(self, key, index, count, data):
+        now = time.perf_counter()
+        for k in [k for k, v in self._reassembly.items() if now - v[3] > REASSEMBLY_TIMEOUT_S]:
+            del self._reassembly[k]
+            self._fragment_drops_counter += 1
         
-        crc = 0
+        if index == 0:
+            if key in self._reassembly:
+                self._fragment_drops_counter += 1
+            elif len(self._reassembly) >= REASSEMBLY_SLOTS:
+                del self._reassembly[min(self._reassembly, key=lambda k: self._reassembly[k][3])]
+                self._fragment_drops_counter += 1
+            self._reassembly[key] = [0, count, [], now]
         
-        b = self.serial_port.read(7)
-        crc = crc16(b, crc)
-        length, addr, local_port, remote_port = struct.unpack('<HBHH', b)
+        slot = self._reassembly.get(key)
+        if slot is None:
+            if index == count - 1:
+                self._fragment_drops_counter += 1
+            return None
+        if index != slot[0] or count != slot[1]:
+            del self._reassembly[key]
+            self._fragment_drops_counter += 1
+            return None
         
-        data = self.serial_port.read(length)
-        crc = crc16(data, crc)
+        slot[0] += 1
+        slot[2].append(bytes(data))
+        slot[3] = now
+        if slot[0] < count:
+            return None
+        del self._reassembly[key]
+        return b''.join(slot[2])
+    
+    # Keyframes for every stream, once a DELTA frame was lost or its stream didn't have one yet
+    def _request_resync(self):
+        now = time.perf_counter()
+        if now - self._last_resync < RESYNC_INTERVAL_S:
+            return
+        self._last_resync = now
+        self._resync_counter += 1
+        self.command(CONTROL_RESYNC, timeout=0)
+    
+    # Returns (status, reply data), None if the dongle didn't answer within timeout
+    # timeout=0 doesn't wait for the answer
+    def command(self, command, args=b'', timeout=1.0):
+        with self._control_cond:
+            seq = self._control_seq
+            self._control_seq = (seq + 1) & 0xFF
+            self._control_replies.pop(seq, None)
         
-        self._data_counter += len(data)
+        self._send_serial_frame(FRAME_TYPE_CONTROL, b'', bytes([command, seq]) + args)
+        if timeout == 0:
+            return None
         
-        checksum, newline = struct.unpack('<HB', self.serial_port.read(3))
+        with self._control_cond:
+            self._control_cond.wait_for(lambda: seq in self._control_replies, timeout)
+            return self._control_replies.pop(seq, None)
+    
+    def _handle_control(self, data):
+        if len(data) < 3 or (data[0] & CONTROL_ACK) == 0:
+            return
+        with self._control_cond:
+            self._control_replies[data[1]] = (data[2], bytes(data[3:]))
+            self._control_cond.notify_all()
+    
+    # Returns ({name: value}, [ports], [reliable ports]), None if the dongle didn't answer
+    def get_config(self):
+        reply = self.command(CONTROL_GET_CONFIG)
+        if reply is None or reply[0] != 0:
+            return None
+        data = reply[1]
+        
+        config = {}
+        pos = 0
+        for _ in range(len(CONFIG_KEYS)):
+            key, value = struct.unpack_from('<BI', data, pos)
+            pos += 5
+            config[CONFIG_NAMES.get(key, key)] = value
+        count = data[pos]
+        ports = list(struct.unpack_from(f'<{count}H', data, pos + 1))
+        reliable_mask = data[pos + 1 + count * 2]
+        return config, ports, [p for i, p in enumerate(ports) if reliable_mask & (1 << i)]
+    
+    def set_config(self, name, value):
+        return self.command(CONTROL_SET_CONFIG, struct.pack('<BI', CONFIG_KEYS[name], value))
+    
+    # Both directions, see CONTROL_SET_RELIABLE
+    def set_reliable(self, port, reliable):
+        reply = self.command(CONTROL_SET_RELIABLE, struct.pack('<HB', port, reliable))
+        if reply is not None and reply[0] == 0:
+            self._mark_reliable(port, reliable)
+        return reply
+    
+    def _mark_reliable(self, port, reliable):
+        if reliable:
+            self.reliable_ports.add(port)
+        else:
+            self.reliable_ports.discard(port)
+    
+    def add_port(self, port):
+        return self.command(CONTROL_ADD_PORT, struct.pack('<H', port))
+    
+    # The dongle forgets whether it was reliable
+    def remove_port(self, port):
+        reply = self.command(CONTROL_REMOVE_PORT, struct.pack('<H', port))
+        if reply is not None and reply[0] == 0:
+            self._mark_reliable(port, False)
+        return reply
+    
+    # Fraction of CONTROL_ECHO round trips that failed, plus chunks and codewords the decoders had to repair
+    def _echo_error_rate(self, frames):
+        errors = 0
+        corrected = self._corrected_counter
+        for _ in range(frames):
+            reply = self.command(CONTROL_ECHO, BAUD_TEST_PATTERN, timeout=0.2)
+            if reply is None or reply[0] != 0 or reply[1] != BAUD_TEST_PATTERN:
+                errors += 1
+        errors += max(0, self._corrected_counter - corrected)
+        return errors / frames
+    
+    # Looks for the dongle at the current rate, then at each candidate. Returns the rate it answered at or None
+    def find_baud(self, candidates):
+        current = self.serial_port.baudrate
+        for baud in [current] + [b for b in candidates if b != current]:
+            self.serial_port.baudrate = baud
+            for _ in range(2):
+                if self.command(CONTROL_ECHO, timeout=0.3) is not None:
+                    return baud
+        self.serial_port.baudrate = current
+        return None
+    
+    # Switches both sides to baud and measures the error rate there
+    # Returns (True, rate) if it stays, otherwise (False, rate) once the dongle is back at the previous rate
+    def try_baud(self, baud, frames, threshold):
+        old = self.serial_port.baudrate
+        if baud != old:
+            # Acked at the old rate, the dongle switches right after
+            reply = self.command(CONTROL_SET_BAUD, struct.pack('<I', baud))
+            if reply is None or reply[0] != 0:
+                return False, 1.0
+            self.serial_port.baudrate = baud
         
-        if checksum != crc:
+        rate = self._echo_error_rate(frames)
+        if rate <= threshold and (baud == old or self.command(CONTROL_BAUD_CONFIRM) is not None):
+            return True, rate
+        
+        if baud != old:
+            # Without the confirmation the dongle goes back by itself
+            self.serial_port.baudrate = old
+            time.sleep(BAUD_CONFIRM_S + 0.2)
+        return False, rate
+    
+    # Tries candidates from the fastest one down, stops at the first with an error rate within threshold
+    def negotiate_baud(self, candidates, frames, threshold):
+        if self.find_baud(candidates) is None:
+            print('[BAUD] Dongle is not answering')
+            return None
+        
+        for baud in sorted(candidates, reverse=True):
+            ok, rate = self.try_baud(baud, frames, threshold)
+            print(f'[BAUD] {baud}: error rate {rate:.3f}' + (', using it' if ok else ''))
+            if ok:
+                return baud
+        return None
+    
+    def latency_report(self):
+        ret = [f'[LATENCY] {k}: {h}' for k, h in self.latency_hops.items()]
+        for h in self.latency_hops.values():
+            h.reset()
+        self._transit_base = None
+        return ret
+    
+    def _handle_telemetry(self, kind, data):
+        if kind == TELEMETRY_LATENCY:
+            self._handle_latency(data)
+            return
+        if kind == TELEMETRY_PROFILE:
+            self._handle_profile(data)
+            return
+        if kind != TELEMETRY_STATS:
+            return
+        
+        fmt, names = TELEMETRY_GLOBALS
+        size = struct.calcsize(fmt)
+        tracker_fmt, tracker_names = TELEMETRY_TRACKER
+        tracker_size = struct.calcsize(tracker_fmt)
+        if len(data) < size + 1 or len(data) != size + 1 + data[size] * tracker_size:
+            return
+        
+        trackers = {}
+        for pos in range(size + 1, len(data), tracker_size):
+            t = dict(zip(tracker_names, struct.unpack_from(tracker_fmt, data, pos)))
+            trackers[t['address']] = t
+        self.telemetry = (dict(zip(names, struct.unpack_from(fmt, data))), trackers)
+        self._telemetry_new = True
+    
+    # The dongle's half of the latency report
+    def _handle_latency(self, data):
+        size = struct.calcsize(LATENCY_HOP_REPORT)
+        for i, pos in enumerate(range(0, len(data) - size + 1, size)):
+            count, p50, p99, max_us = struct.unpack_from(LATENCY_HOP_REPORT, data, pos)
+            name = DONGLE_LATENCY_HOPS[i] if i < len(DONGLE_LATENCY_HOPS) else f'hop {i}'
+            self._log_lines.append(f'[LATENCY] dongle {name}: count={count} p50={p50}us p99={p99}us max={max_us}us')
+    
+    # One stage of the dongle's profiler report
+    def _handle_profile(self, data):
+        fmt, names = PROFILE_STAGE_REPORT
+        size = struct.calcsize(fmt)
+        if len(data) < size or (len(data) - size) % 5 != 0:
+            return
+        r = dict(zip(names, struct.unpack_from(fmt, data)))
+        if r['stage'] == 0:
+            self._log_lines.append(f"[PROFILE] window={r['window_us']}us cpu={r['cpu_mhz']}MHz, cycles per call")
+        name = PROFILE_STAGES[r['stage']] if r['stage'] < len(PROFILE_STAGES) else f"stage {r['stage']}"
+        self._log_lines.append(f"[PROFILE] {name}: count={r['count']} min={r['min']} avg={r['avg']} p50={r['p50']} "
+                               f"p99={r['p99']} max={r['max']} time={r['share'] // 10}.{r['share'] % 10}%")
+        buckets = [struct.unpack_from('<BI', data, pos) for pos in range(size, len(data), 5)]
+        if buckets:
+            self._log_lines.append(f'[PROFILE] {name} buckets: ' + ' '.join(f'{Histogram._low(i)}:{c}' for i, c in buckets))
+    
+    def _handle_log(self, data):
+        if len(data) < 2:
+            return
+        dropped, = struct.unpack_from('<H', data)
+        pos = 2
+        while pos + 6 <= len(data):
+            msg_id, level_args, time_ms = struct.unpack_from('<BBI', data, pos)
+            pos += 6
+            count = level_args & 0x0F
+            args = struct.unpack_from(f'<{count}I', data, pos)
+            pos += count * 4
+            self._log_lines.append(f'[LOG] {time_ms / 1000:10.3f} {log_level_name(level_args >> 4):>5}: {format_log(msg_id, args)}')
+        if dropped > 0:
+            self._log_lines.append(f'[LOG] {dropped} records dropped, log ring was full')
+    
+    # Lines of LOG frames and of the reports the dongle was asked for
+    def get_log_lines(self):
+        ret = self._log_lines
+        self._log_lines = []
+        return ret
+    
+    # Lines describing the latest TELEMETRY frame, none if there wasn't a new one since the last call and only_new is set
+    def telemetry_report(self, only_new=True):
+        if self.telemetry is None or (only_new and not self._telemetry_new):
+            return []
+        self._telemetry_new = False
+        g, trackers = self.telemetry
+        dt = max(g['interval_ms'], 1) / 1000
+        
+        ret = [
+            f"[TELEMETRY] loops/sec: {g['loops'] / dt:.0f} ; baud: {g['baud']} ; framing: {FRAMING_MODES[g['framing']] if g['framing'] < len(FRAMING_MODES) else g['framing']} ; "
+            f"bad frames: {g['bad_frames']} ; repaired chunks: {g['repaired_chunks']}",
+            f"[TELEMETRY] dropped: UDP queue: {g['udp_queue_dropped']} ; serial RX bytes: {g['serial_rx_dropped_bytes']} ; "
+            f"TX queue: {g['tx_queue_dropped']} ; incomplete fragmented: {g['incomplete_fragmented']}",
+            f"[TELEMETRY] TX queue: depth: {g['tx_queue_depth']}(max: {g['tx_queue_max_depth']}) ; bytes: {g['tx_queue_bytes']}/{g['tx_queue_budget']} ; "
+            f"serial TX ring free: {g['uart_tx_free']} ; compression: keyframes: {g['keyframes']} ; deltas: {g['deltas']} ; bytes saved: {g['saved_bytes']}",
+            f"[TELEMETRY] TX age: avg: {g['tx_age_avg_us'] / 1000:.1f}ms ; max: {g['tx_age_max_us'] / 1000:.1f}ms ; "
+            f"superseded: {g['tx_superseded']}",
+            f"[TELEMETRY] serial link: host frames lost: {g['frames_lost']} ; recovered: {g['frames_recovered']} ; dongle frames resent: {g['frames_resent']}",
+            f"[TELEMETRY] heap: free min: {g['heap_free_min']} ; largest block min: {g['heap_max_block_min']} ; "
+            f"pbuf pool: in use: {g['pbuf_pool_in_use']} ; exhausted: {g['pbuf_pool_exhausted']}",
+            '[TELEMETRY] tracker | WiFi->serial pkt/s    B/s | serial->WiFi pkt/s    B/s | send errors | dropped | CRC fails | last seen',
+        ]
+        for addr in sorted(trackers):
+            t = trackers[addr]
+            last_seen = 'never' if t['last_seen_ago_ms'] == TELEMETRY_NEVER else f"{t['last_seen_ago_ms'] / 1000:.1f}s ago"
+            ret.append(f"[TELEMETRY] {addr:>7} | {t['wifi2serial_packets'] / dt:>16.1f} {t['wifi2serial_bytes'] / dt:>6.0f} | "
+                       f"{t['serial2wifi_packets'] / dt:>16.1f} {t['serial2wifi_bytes'] / dt:>6.0f} | "
+                       f"{t['send_errors']:>11} | {t['dropped']:>7} | {t['crc_failures']:>9} | {last_seen}")
+        return ret
+    
+    # Parses every complete frame in _rx, bytes outside of frames go to _buffered_msg
+    # Returns a list of (address, local port, remote port, data) and the number of corrupted frames
+    def _parse_serial(self):
+        buf = self._rx
+        pos = 0
+        packets = []
+        bad = 0
+        with memoryview(buf) as view:
+            while pos < len(buf):
+                m = FRAME_START_RE.search(buf, pos)
+                start = len(buf) if m is None else m.start()
+                self._buffered_msg += view[pos:start]
+                pos = start
+                if pos >= len(buf):
+                    break
+                
+                if buf[pos] == DUMB_FRAME_START:
+                    ret, used = self._parse_dumb_frame(buf, view, pos)
+                elif buf[pos] == FEC_FRAME_START:
+                    ret, used = self._parse_fec_frame(buf, view, pos)
+                else:
+                    ret, used = self._parse_preamble_frame(buf, view, pos)
+                if used == 0:
+                    # Not complete yet
+                    break
+                if ret is None:
+                    self._buffered_msg += view[pos:pos+used]
+                elif ret is False:
+                    bad += 1
+                else:
+                    packets += ret
+                pos += used
+        del buf[:pos]
+        return packets, bad
+    
+    # Returns (result, bytes used), no bytes used if the frame isn't complete yet
+    # result is a list of packets, False for a corrupted frame or None if the bytes turned out to be text
+    def _parse_preamble_frame(self, buf, view, pos):
+        type_pos = pos + len(FRAME_SYNC)
+        if len(buf) <= type_pos:
+            return None, (0 if FRAME_SYNC.startswith(buf[pos:]) else 1)
+        frame_type = buf[type_pos]
+        if not buf.startswith(FRAME_SYNC, pos) or frame_header_len(frame_type) is None:
+            return None, 1
+        
+        header_end = type_pos + 1 + frame_header_len(frame_type)
+        if len(buf) < header_end:
+            return None, 0
+        length, = struct.unpack_from('<H', buf, type_pos + 1)
+        if length > frame_max_length(frame_type):
+            # Corrupted length, don't wait for a payload that might never come
+            return False, header_end - pos
+        
+        # CRC and newline
+        frame_end = header_end + length + 3
+        if len(buf) < frame_end:
+            return None, 0
+        checksum, = struct.unpack_from('<H', buf, frame_end - 3)
+        if checksum != crc16(view[type_pos:frame_end - 3], 0):
+            return False, frame_end - pos
+        return self._unpack_frame(frame_type, bytes(view[type_pos + 3:header_end]), bytes(view[header_end:frame_end - 3])), frame_end - pos
+    
+    def _parse_dumb_frame(self, buf, view, pos):
+        end = buf.find(DUMB_FRAME_END, pos + 1)
+        restart = buf.find(DUMB_FRAME_START, pos + 1, len(buf) if end < 0 else end)
+        if restart >= 0:
+            # Previous frame was never terminated
+            return [], restart - pos
+        if end < 0:
+            return (False, len(buf) - pos) if len(buf) - pos > DUMB_MAX_FRAME_BYTES else (None, 0)
+        
+        self._decoder.feed(view[pos + 1:end])
+        body = self._decoder.finish()
+        self._corrected_counter += self._decoder.corrected
+        self._decoder.corrected = 0
+        return self._unpack_body(body), end + 1 - pos
+    
+    def _parse_fec_frame(self, buf, view, pos):
+        end = buf.find(FEC_FRAME_END, pos + 1)
+        restart = buf.find(FEC_FRAME_START, pos + 1, len(buf) if end < 0 else end)
+        if restart >= 0:
+            # Previous frame was never terminated
+            return [], restart - pos
+        if end < 0:
+            return (False, len(buf) - pos) if len(buf) - pos > DUMB_MAX_FRAME_BYTES else (None, 0)
+        
+        body = self._fec_decoder.decode(view[pos + 1:end])
+        self._corrected_counter += self._fec_decoder.corrected
+        self._fec_decoder.corrected = 0
+        return self._unpack_body(body or b''), end + 1 - pos
+    
+    # Checks a decoded dumb_serial or FEC frame, returns a list of packets or False
+    def _unpack_body(self, body):
+        if len(body) < 1 or frame_header_len(body[0]) is None:
             return False
         
-        return addr, local_port, remote_port, data
+        frame_type = body[0]
+        header_len = 1 + frame_header_len(frame_type)
+        if len(body) < header_len + 2:
+            return False
+        
+        length, = struct.unpack('<H', body[1:3])
+        if len(body) != header_len + length + 2:
+            return False
+        
+        checksum, = struct.unpack('<H', body[-2:])
+        if checksum != crc16(body[:-2], 0):
+            return False
+        
+        return self._unpack_frame(frame_type, body[3:header_len], body[header_len:-2])
+    
+    # header - everything after the length
+    def _unpack_frame(self, frame_type, header, data):
+        self._data_counter += len(data)
+        self.good_frames += 1
+        
+        sequence, = struct.unpack_from('<H', header)
+        header = header[2:]
+        rx_sequence = self._rx_reliable_sequence if frame_type & FRAME_FLAG_RELIABLE else self._rx_sequence
+        if not rx_sequence.received(sequence, frame_type & FRAME_FLAG_RETRANSMIT, time.perf_counter()):
+            # A retransmission that was asked for more than once and came in more than once
+            return []
+        frame_type &= ~(FRAME_FLAG_RETRANSMIT | FRAME_FLAG_RELIABLE)
+        
+        if frame_type & FRAME_FLAG_TIMESTAMPS:
+            frame_type &= ~FRAME_FLAG_TIMESTAMPS
+            network_rx, serial_tx = struct.unpack('<II', header[:8])
+            header = header[8:]
+            self._add_dongle_latency(network_rx, serial_tx)
+        
+        if frame_type == FRAME_TYPE_DATA:
+            addr, local_port, remote_port = self.profile.unpack_addressing(header)
+            return [(addr, local_port, remote_port, data)]
+        
+        if frame_type == FRAME_TYPE_FRAGMENT:
+            addr, local_port, remote_port = self.profile.unpack_addressing(header)
+            datagram_id, index, count = struct.unpack_from('<BHH', header, self.profile.addressing_size)
+            datagram = self._add_fragment((addr, local_port, remote_port, datagram_id), index, count, data)
+            return [] if datagram is None else [(addr, local_port, remote_port, datagram)]
+        
+        if frame_type == FRAME_TYPE_DELTA:
+            stream, sequence = struct.unpack('<BB', header)
+            apd = self._delta.decode(stream, sequence, data)
+            if apd is None:
+                self._request_resync()
+                return []
+            return [apd]
+        
+        if frame_type == FRAME_TYPE_CONTROL:
+            self._handle_control(data)
+            return []
+        
+        if frame_type == FRAME_TYPE_TELEMETRY:
+            kind, = struct.unpack('<B', header)
+            self._handle_telemetry(kind, data)
+            return []
+        
+        if frame_type == FRAME_TYPE_LOG:
+            self._handle_log(data)
+            return []
+        
+        if frame_type == FRAME_TYPE_NACK:
+            self._handle_nack(data)
+            return []
+        
+        if frame_type == FRAME_TYPE_BATCH:
+            ret = []
+            pos = 0
+            local_port = remote_port = 0
+            while pos < len(data):
+                length, = struct.unpack_from('<H', data, pos)
+                addr, = struct.unpack_from(self.profile.address_format, data, pos + 2)
+                pos += 2 + self.profile.address_size
+                if (length & BATCH_SAME_PORTS) == 0:
+                    local_port, remote_port = self.profile.unpack_ports(data, pos)
+                    pos += 2 * self.profile.port_size
+                length &= ~BATCH_SAME_PORTS
+                ret.append((addr, local_port, remote_port, bytes(data[pos:pos+length])))
+                pos += length
+            return ret
+        
+        return []
+    
+    # Sends the kept frames the dongle asked for again, NACKs for frames that weren't kept are ignored
+    def _handle_nack(self, data):
+        out = bytearray()
+        with self._write_lock:
+            for sequence, in struct.iter_unpack('<H', data[:len(data) & ~1]):
+                frame = self._kept.find(sequence)
+                if frame is not None:
+                    self._encode_raw_frame(out, bytes([frame[0] | FRAME_FLAG_RETRANSMIT]) + frame[1:])
+                    self._resent_counter += 1
+            if len(out) > 0:
+                self._write_serial(out)
+    
+    # Asks the dongle for missing frames, and again for the ones that still didn't come
+    def _send_nacks(self):
+        missing = self._rx_reliable_sequence.take_nacks(time.perf_counter())
+        if len(missing) > 0:
+            self._send_serial_frame(FRAME_TYPE_NACK, b'', struct.pack(f'<{len(missing)}H', *missing))
+    
+    def _add_dongle_latency(self, network_rx, serial_tx):
+        self.latency_hops['dongle udp_rx->serial_tx'].add((serial_tx - network_rx) & 0xFFFFFFFF)
+        
+        # Clocks aren't synchronized, measure against the fastest frame since the last report
+        diff = (now_us() - serial_tx) & 0xFFFFFFFF
+        if diff >= 0x80000000:
+            diff -= 0x100000000
+        if self._transit_base is None or diff < self._transit_base:
+            self._transit_base = diff
+        self.latency_hops['dongle_tx->host_rx(rel)'].add(diff - self._transit_base)
     
     def _send_loopback_packet(self, addr, target_port, remote_port, data):
         key = (addr, remote_port)
@@ -108,7 +1015,7 @@ class SerialProxy:
                 local_port += 1
                 assert local_port < 65535
             
-            print(f'Binding remote address {addr}:{remote_port} to {local_port}')
+            print(f'Binding remote address {self.profile.address_str(addr)}:{remote_port} to {local_port}')
             sock = open_udp(local_port)
             self._selector.register(sock, selectors.EVENT_READ)
             
@@ -123,40 +1030,110 @@ class SerialProxy:
         
         sock.sendto(data, (TARGET_ADDRESS, target_port))
     
-    def _next_loopback_packets(self):
-        if len(self._port_to_conn) == 0:
-            return []
+    def _read_serial(self):
+        # Never blocks, the port has a timeout of 0
+        self._rx += self.serial_port.read(max(1, self.serial_port.in_waiting))
+        packets, bad = self._parse_serial()
+        if bad > 0:
+            self._checksum_fails_counter += bad
+            self.bad_frames += bad
+            # Might have been a DELTA frame, don't wait for the next one of that stream to find out
+            if self._delta.active():
+                self._request_resync()
         
-        ret = []
-        for key, mask in self._selector.select(timeout=1.0):
-            sock = key.fileobj
-            try:
-                data, addr = sock.recvfrom(1024)
-            except ConnectionResetError:
-                continue
-            
+        rx_time = now_us()
+        for apd in packets:
+            self._send_loopback_packet(*apd)
+            self._packets_counter += 1
+        if len(packets) > 0:
+            self.latency_hops['host serial_rx->udp_tx'].add((now_us() - rx_time) & 0xFFFFFFFF)
+    
+    # Adds what is waiting on the sockets to datagrams: [addresses, first rx time, (local port, remote port, data)]
+    # in the order they came in. merging - the same by (local port, remote port, data), for the ones that can take more
+    # addresses. Copies of one datagram for several trackers are merged unless fanout is off
+    def _collect_udp(self, socks, datagrams, merging, rx_times):
+        for sock in socks:
             local_port = sock.getsockname()[1]
-            target_port = addr[1]
             remote_addr, remote_port = self._port_to_remote_addr[local_port]
-            ret.append((remote_addr, target_port, remote_port, data))
-        return ret
+            for _ in range(UDP_READS_PER_EVENT):
+                try:
+                    data, addr = sock.recvfrom(65535)
+                except (BlockingIOError, ConnectionResetError):
+                    break
+                rx_time = now_us()
+                rx_times.append(rx_time)
+                key = (addr[1], remote_port, data)
+                group = merging.get(key)
+                # The same datagram twice for one tracker goes out twice
+                if self.fanout != 'off' and group is not None and remote_addr not in group[0]:
+                    group[0].append(remote_addr)
+                else:
+                    merging[key] = [[remote_addr], rx_time, key]
+                    datagrams.append(merging[key])
     
-    def inbound_loop(self):
-        while self._running:
-            self._loop_counter += 1
-            apd = self._next_serial_packet()
-            if apd is None:
-                continue
-            if apd is False:
-                self._checksum_fails_counter += 1
-                continue
-            self._send_loopback_packet(*apd)
-            self._packets_counter += 1
+    # Whether a datagram came in for more than one tracker, but not yet for all that use its remote port
+    def _fanout_incomplete(self, datagrams):
+        if self.fanout == 'off':
+            return False
+        for addrs, rx_time, (local_port, remote_port, data) in datagrams:
+            if len(addrs) > 1 and len(addrs) < sum(1 for a, port in self._remote_addr_to_port if port == remote_port):
+                return True
+        return False
     
-    def outbound_loop(self):
-        while self._running:
-            for apd in self._next_loopback_packets():
-                self._send_serial_packet(*apd)
+    # All datagrams waiting on the sockets go out in one serial write
+    def _read_udp(self, socks):
+        datagrams = []
+        merging = {}
+        rx_times = []
+        self._collect_udp(socks, datagrams, merging, rx_times)
+        # Only waits while a fan-out is under way, datagrams for a single tracker never do
+        if self.fanout_hold > 0 and self._fanout_incomplete(datagrams):
+            time.sleep(self.fanout_hold)
+            self._collect_udp(self._port_to_conn.values(), datagrams, merging, rx_times)
+        
+        out = bytearray()
+        with self._write_lock:
+            for addrs, rx_time, (local_port, remote_port, data) in datagrams:
+                # The dongle only takes MULTICAST frames of up to FRAGMENT_SIZE
+                if len(addrs) > 1 and len(data) + 2 * self.profile.address_size <= FRAGMENT_SIZE \
+                        and self.profile.port_fits(local_port) and self.profile.port_fits(remote_port):
+                    self._encode_fanout(out, addrs, local_port, remote_port, data, rx_time)
+                else:
+                    for addr in addrs:
+                        self._encode_serial_packet(out, addr, local_port, remote_port, data, rx_time)
+            
+            if len(out) == 0:
+                return
+            self._write_serial(out)
+        tx_time = now_us()
+        for rx_time in rx_times:
+            self.latency_hops['host udp_rx->serial_tx'].add((tx_time - rx_time) & 0xFFFFFFFF)
+    
+    # Serial in both directions and every UDP socket, until close()
+    def run(self):
+        self.serial_port.timeout = 0
+        self._selector.register(self.serial_port, selectors.EVENT_READ)
+        try:
+            while self._running:
+                self._loop_counter += 1
+                # Woken up in time to NACK again
+                timeout = NACK_RETRY_S if self._rx_reliable_sequence.nacks_pending() else SELECT_TIMEOUT_S
+                socks = []
+                for key, mask in self._selector.select(timeout=timeout):
+                    if key.fileobj is self.serial_port:
+                        self._read_serial()
+                    else:
+                        socks.append(key.fileobj)
+                if len(socks) > 0:
+                    self._read_udp(socks)
+                self._send_nacks()
+        finally:
+            self._selector.close()
+            for sock in self._port_to_conn.values():
+                sock.close()
+            self._port_to_conn.clear()
+            self._remote_addr_to_port.clear()
+            self._port_to_remote_addr.clear()
     
     def get_buffered_msg(self):
         ret = bytes(self._buffered_msg)
@@ -180,31 +1157,163 @@ class SerialProxy:
         packets_per_sec = self._packets_counter / dt
         self._packets_counter = 0
         
+        corrected_per_sec = self._corrected_counter / dt
+        self._corrected_counter = 0
+        
+        fragment_drops_per_sec = self._fragment_drops_counter / dt
+        self._fragment_drops_counter = 0
+        
+        resyncs_per_sec = self._resync_counter / dt
+        self._resync_counter = 0
+        
+        oversize_per_sec = self._oversize_counter / dt
+        self._oversize_counter = 0
+        
+        fanout_saved_per_sec = self._fanout_saved_counter / dt
+        self._fanout_saved_counter = 0
+        
+        lost_per_sec = (self._rx_sequence.lost + self._rx_reliable_sequence.lost) / dt
+        recovered_per_sec = self._rx_reliable_sequence.recovered / dt
+        resent_per_sec = self._resent_counter / dt
+        self._rx_sequence.lost = self._rx_reliable_sequence.lost = self._rx_reliable_sequence.recovered = 0
+        self._resent_counter = 0
+        
         return {
             'Inbound bytes/sec': bps,
             'Inbound loop time': loop_time,
             'Inbound checksum fails/sec': fails_per_sec,
-            'Inbound packets/sec': packets_per_sec
+            'Inbound packets/sec': packets_per_sec,
+            'Inbound repaired chunks/sec': corrected_per_sec,
+            'Inbound incomplete fragmented/sec': fragment_drops_per_sec,
+            'Inbound delta resyncs/sec': resyncs_per_sec,
+            'Inbound frames lost/sec': lost_per_sec,
+            'Inbound frames recovered/sec': recovered_per_sec,
+            'Outbound frames resent/sec': resent_per_sec,
+            'Outbound oversize dropped/sec': oversize_per_sec,
+            'Outbound copies merged/sec': fanout_saved_per_sec
         }
     
+    # run() returns within SELECT_TIMEOUT_S
     def close(self):
         self._running = False
-        for sock in self._port_to_conn.values():
-            self._selector.unregister(sock)
-        time.sleep(1.5)
-        for sock in self._port_to_conn.values():
-            sock.close()
-        self._port_to_conn.clear()
-        self._remote_addr_to_port.clear()
-        self._port_to_remote_addr.clear()
 
 
-args = sys.argv[1:]
-if len(args) < 1:
-    print('Usage: python ./slime_ap.py <serial port>')
-    exit()
+CLI_HELP = """Commands:
+  config                 show the dongle's settings and UDP ports
+  set NAME VALUE         change a setting, NAME is one of: """ + ', '.join(CONFIG_KEYS) + """
+  add_port PORT          listen on another UDP port
+  remove_port PORT       stop listening on a UDP port
+  reliable PORT on|off   send datagrams of a port again when the other side misses them, both ways
+  latency                print latency histograms now(dongle needs -DLATENCY_STATS)
+  profiler               print the cycles each stage of the dongle's loop took since the last time(needs -DLOOP_PROFILER)
+  trackers               print the latest per tracker telemetry
+  help"""
+
+# PARITY/LENGTH, as CONFIG_FEC takes it
+def parse_fec_profile(text):
+    parity, length = (int(v, 0) for v in text.split('/'))
+    if not fec_profile_valid(parity, length):
+        raise ValueError('parity 1-8 and length 2 * parity-64 expected')
+    return parity, length
+
+def format_config_value(name, value):
+    if name == 'fec':
+        return f'{value & 0xFF}/{value >> 8}'
+    if name == 'coalesce':
+        return hex(value)
+    return str(value)
 
-port = args[0]
+def format_reply(reply):
+    if reply is None:
+        return 'no answer'
+    status = reply[0]
+    return CONTROL_STATUS[status] if status < len(CONTROL_STATUS) else f'status {status}'
+
+def run_cli_command(proxy, line):
+    words = line.split()
+    if len(words) == 0:
+        return
+    cmd, cmd_args = words[0], words[1:]
+    
+    try:
+        if cmd == 'config' and len(cmd_args) == 0:
+            ret = proxy.get_config()
+            if ret is None:
+                print('[CLI] config: no answer')
+                return
+            config, ports, reliable = ret
+            for k, v in config.items():
+                print(f'[CLI] {k} = {format_config_value(k, v)}')
+            print(f'[CLI] ports = {" ".join(map(str, ports))}')
+            print(f'[CLI] reliable ports = {" ".join(map(str, reliable))}')
+        elif cmd == 'set' and len(cmd_args) == 2 and cmd_args[0] in CONFIG_KEYS:
+            if cmd_args[0] == 'fec':
+                parity, length = parse_fec_profile(cmd_args[1])
+                value = parity | length << 8
+            else:
+                value = int(cmd_args[1], 0)
+            print(f'[CLI] set {cmd_args[0]}: {format_reply(proxy.set_config(cmd_args[0], value))}')
+        elif cmd == 'reliable' and len(cmd_args) == 2 and cmd_args[1] in ('on', 'off'):
+            print(f'[CLI] reliable: {format_reply(proxy.set_reliable(int(cmd_args[0]), cmd_args[1] == "on"))}')
+        elif cmd in ('add_port', 'remove_port') and len(cmd_args) == 1:
+            port = int(cmd_args[0])
+            reply = proxy.add_port(port) if cmd == 'add_port' else proxy.remove_port(port)
+            print(f'[CLI] {cmd}: {format_reply(reply)}')
+        elif cmd == 'trackers' and len(cmd_args) == 0:
+            for line in proxy.telemetry_report(only_new=False) or ['[CLI] trackers: no telemetry yet']:
+                print(line)
+        elif cmd == 'profiler' and len(cmd_args) == 0:
+            # The stages come as TELEMETRY frames, printed with the log lines
+            print(f'[CLI] profiler: {format_reply(proxy.command(CONTROL_PROFILER_REPORT))}')
+        elif cmd == 'latency' and len(cmd_args) == 0:
+            print(f'[CLI] latency: {format_reply(proxy.command(CONTROL_LATENCY_REPORT))}')
+            for line in proxy.latency_report():
+                print(line)
+        else:
+            print(CLI_HELP)
+    except (ValueError, struct.error) as e:
+        print(f'[CLI] {line}: {e}')
+
+def cli_loop(proxy):
+    for line in sys.stdin:
+        run_cli_command(proxy, line)
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument('port', help='Serial port the dongle is connected to')
+parser.add_argument('--profile', default='default', metavar='NAME',
+                    help='Framing profile the dongle was built with(custom_framing_profile in platformio.ini), '
+                         'one of ' + ', '.join(load_profiles()))
+parser.add_argument('--fanout', choices=FANOUT_MODES, default='off',
+                    help='Send a datagram the server sends to several trackers once, naming them(list) or to the whole '
+                         'subnet if it goes to every known tracker(broadcast), instead of a copy per tracker(off, default)')
+parser.add_argument('--fanout-hold-ms', type=float, default=1, metavar='MS',
+                    help='Once a datagram came in for two trackers, how long to wait for the copies for the others')
+parser.add_argument('--framing', choices=FRAMING_MODES, default='preamble',
+                    help='Serial framing to use, the dongle replies using the same one')
+parser.add_argument('--fec', type=parse_fec_profile, default=(FEC_PARITY, FEC_CODEWORD), metavar='PARITY/LENGTH',
+                    help='Parity bytes per codeword and codeword length for --framing fec, "set fec" changes the dongle\'s side. '
+                         'Every codeword corrects as many lost bytes as it has parity bytes, or half as many wrong ones')
+parser.add_argument('--latency', type=float, default=0, metavar='SECONDS',
+                    help='Timestamp frames and print per hop latency histograms every SECONDS, '
+                         'the dongle needs to be built with -DLATENCY_STATS for its half')
+parser.add_argument('--control', action='append', default=[], metavar='COMMAND',
+                    help='Run a control command once connected, e.g. --control "set stats_interval_ms 1000". '
+                         'The same commands can be typed while running, "help" lists them')
+parser.add_argument('--baud', default='auto',
+                    help='Serial baud rate, or "auto" to negotiate the fastest one that works(default)')
+parser.add_argument('--baud-candidates', default=','.join(map(str, BAUD_CANDIDATES)), metavar='LIST',
+                    help='Comma separated rates tried by --baud auto')
+parser.add_argument('--baud-max-errors', type=float, default=0.02, metavar='FRACTION',
+                    help='Highest acceptable error rate for --baud auto, also used to detect a degrading link')
+args = parser.parse_args()
+profile = load_profile(args.profile)
+set_framing_profile(profile)
+if args.framing == 'fec' and not profile.fec:
+    parser.error(f'framing profile {profile.name} is built without FEC framing')
+baud_candidates = [int(b) for b in args.baud_candidates.split(',')]
+
+port = args.port
 
 threads = []
 
@@ -212,41 +1321,88 @@ ser = serial.Serial()
 proxy = None
 try:
     ser.port = port
-    ser.baudrate = 115200 * 10
+    ser.baudrate = DEFAULT_BAUD if args.baud == 'auto' else int(args.baud)
     ser.open()
     assert ser.is_open
     print('Serial open')
     
-    proxy = SerialProxy(ser)
+    proxy = SerialProxy(ser, args.framing, args.latency > 0, args.fec, profile, args.fanout, args.fanout_hold_ms / 1000)
     
-    threads.append(threading.Thread(name='Inbound', target=proxy.inbound_loop))
-    threads.append(threading.Thread(name='Outbound', target=proxy.outbound_loop))
+    threads.append(threading.Thread(name='Bridge', target=proxy.run))
     
     for t in threads:
         t.start()
     print('Threads started')
     
+    if args.baud == 'auto':
+        proxy.negotiate_baud(baud_candidates, BAUD_TEST_FRAMES, args.baud_max_errors)
+    
+    for line in args.control:
+        run_cli_command(proxy, line)
+    # Not joined on exit, it is stuck reading stdin
+    threading.Thread(name='CLI', target=cli_loop, args=(proxy,), daemon=True).start()
+    
+    next_latency_report = time.perf_counter() + args.latency
     x = bytearray()
+    good_frames = bad_frames = 0
+    bad_periods = 0
     while True:
         time.sleep(1.5)
-        x += proxy.get_buffered_msg()
+        text = proxy.get_buffered_msg()
+        
+        if args.baud == 'auto':
+            good = proxy.good_frames - good_frames
+            bad = proxy.bad_frames - bad_frames
+            good_frames, bad_frames = proxy.good_frames, proxy.bad_frames
+            
+            if bad > 0 and bad / (good + bad) > args.baud_max_errors:
+                bad_periods += 1
+            elif good == 0 and len(text) > 0 and proxy.command(CONTROL_ECHO) is None:
+                # Only noise coming in and no answer, the dongle might have fallen back to its default rate
+                bad_periods += BAUD_BAD_PERIODS
+            else:
+                bad_periods = 0
+            
+            if bad_periods >= BAUD_BAD_PERIODS:
+                bad_periods = 0
+                print(f'[BAUD] Link degraded at {ser.baudrate}, stepping down')
+                lower = [b for b in baud_candidates if b < ser.baudrate]
+                if proxy.find_baud(baud_candidates) is not None and proxy.negotiate_baud(lower, BAUD_TEST_FRAMES, args.baud_max_errors) is None:
+                    proxy.find_baud(baud_candidates)
+                good_frames, bad_frames = proxy.good_frames, proxy.bad_frames
+        
+        if args.latency > 0 and time.perf_counter() >= next_latency_report:
+            next_latency_report += args.latency
+            # The dongle sends its own half as a TELEMETRY frame, printed with the log lines
+            proxy.command(CONTROL_LATENCY_REPORT, timeout=0)
+            for line in proxy.latency_report():
+                print(line)
+        
+        x += text
         while b'\n' in x:
             i = x.index(b'\n')
             print(repr(bytes(x[:i]))[2:-1])
             x = x[i+1:]
         
+        for line in proxy.get_log_lines():
+            print(line)
+        
+        for line in proxy.telemetry_report():
+            print(line)
+        
         stats = {'Open connections': len(proxy._port_to_conn)}
         stats.update(proxy.get_stats())
         
         print('; '.join(f'{k}: {v}' for k, v in stats.items()))
+except KeyboardInterrupt:
+    pass
 finally:
     print('Shutting down..')
     if proxy is not None:
         proxy.close()
-        print('Closed proxy')
-    ser.close()
-    print('Closed serial')
-    
     for t in threads:
         t.join()
     print('Threads joined')
+    
+    ser.close()
+    print('Closed serial')
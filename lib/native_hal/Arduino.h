@@ -0,0 +1,105 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Subset of the ESP8266 Arduino core used by the dongle, implemented on Linux
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define F_CPU 80000000L
+#define IRAM_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define LED_BUILTIN 2
+
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void optimistic_yield(uint32_t interval_us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+
+class String {
+public:
+    String(const char* str = "") : str(str) {}
+    const char* c_str() const { return str.c_str(); }
+    size_t length() const { return str.length(); }
+
+private:
+    std::string str;
+};
+
+
+// Serial is a pseudo terminal, the slave side path is printed to stderr on begin()
+// stdout is redirected to it as well(through ets_install_putc1()), same as printf going to UART0 on the ESP
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    void end();
+    // A pty has no baud rate, only logged
+    void updateBaudRate(unsigned long baud);
+
+    int available();
+    int availableForWrite();
+    int read();
+    size_t read(uint8_t* buffer, size_t size);
+    size_t read(char* buffer, size_t size) { return read((uint8_t*)buffer, size); }
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+    size_t println() { return write("\r\n"); }
+    void flush();
+
+    // Native only: pty file descriptor, for the UART interrupt emulation
+    int native_fd() const { return fd; }
+    // Native only: bytes the NATIVE_SERIAL_CHANNEL model produced that read() hasn't returned yet
+    size_t native_rx_pending() const;
+
+private:
+    int fd = -1;
+};
+
+extern HardwareSerial Serial;
+
+
+class EspClass {
+public:
+    void deepSleep(uint64_t time_us);
+    void restart();
+    // Emulated 80MHz cycle counter
+    uint32_t getCycleCount();
+    uint32_t getFreeHeap();
+    uint32_t getMaxFreeBlockSize();
+};
+
+extern EspClass ESP;
+
+
+// Native only: stand-in for the SDK running while the loop is suspended(delay, yield, esp_delay, between loop() calls)
+// On the ESP that is where lwIP callbacks and interrupts happen, here watched file descriptors get their handlers called
+void native_watch_fd(int fd, void (*handler)(void* arg), void* arg);
+void native_unwatch_fd(int fd);
+// Runs handlers of ready descriptors, waits up to timeoutMs for one if none are ready and nothing called esp_schedule()
+void native_run_events(uint32_t timeoutMs);
+// Calls the UART interrupt handler for TX FIFO refills and for RX bytes the channel model still holds, see esp8266_peri.h
+// Returns true if TX is still going or the channel model has RX bytes left, so it has to be called again soon
+bool native_uart_service();
+
+#endif
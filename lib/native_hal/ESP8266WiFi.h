@@ -0,0 +1,29 @@
+#ifndef NATIVE_ESP8266WIFI_H
+#define NATIVE_ESP8266WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+enum WiFiPhyMode_t { WIFI_PHY_MODE_11B = 1, WIFI_PHY_MODE_11G = 2, WIFI_PHY_MODE_11N = 3 };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 };
+
+// The access point is emulated with a loopback subnet
+// 192.168.4.x on the dongle side maps to $NATIVE_SUBNET.x(127.0.4.x by default)
+class ESP8266WiFiClass {
+public:
+    bool mode(WiFiMode_t m) { return true; }
+    void setOutputPower(float dBm) {}
+    bool setPhyMode(WiFiPhyMode_t mode) { return true; }
+    bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) { return true; }
+    bool softAP(const char* ssid, const char* pass = NULL, int channel = 1, int hidden = 0, int maxConnection = 4);
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+// Converts between dongle side and Linux side addresses
+uint32_t native_to_host_addr(const IPAddress& addr);
+IPAddress native_from_host_addr(uint32_t addr);
+
+#endif
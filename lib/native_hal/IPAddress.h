@@ -0,0 +1,29 @@
+#ifndef NATIVE_IPADDRESS_H
+#define NATIVE_IPADDRESS_H
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+    IPAddress() : IPAddress(0, 0, 0, 0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        bytes[0] = a;
+        bytes[1] = b;
+        bytes[2] = c;
+        bytes[3] = d;
+    }
+
+    uint8_t operator[](int index) const { return bytes[index]; }
+    uint8_t& operator[](int index) { return bytes[index]; }
+
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+        return String(buf);
+    }
+
+private:
+    uint8_t bytes[4];
+};
+
+#endif
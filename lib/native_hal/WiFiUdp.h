@@ -0,0 +1,34 @@
+#ifndef NATIVE_WIFIUDP_H
+#define NATIVE_WIFIUDP_H
+
+#include <memory>
+#include <vector>
+
+#include "ESP8266WiFi.h"
+
+struct NativeUdpContext;
+
+// Copies share the same socket, same as the ESP8266 implementation
+class WiFiUDP {
+public:
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    int parsePacket();
+    int available();
+    int read(uint8_t* buffer, size_t len);
+    int read(char* buffer, size_t len) { return read((uint8_t*)buffer, len); }
+    IPAddress remoteIP();
+    uint16_t remotePort();
+    uint16_t localPort();
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    int endPacket();
+
+private:
+    std::shared_ptr<NativeUdpContext> ctx;
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+// Nothing on the dongle uses I2C
+
+#endif
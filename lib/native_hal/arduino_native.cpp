@@ -0,0 +1,136 @@
+#include "Arduino.h"
+#include "coredecls.h"
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const uint64_t startNs = now_ns();
+
+unsigned long millis() {
+    return (now_ns() - startNs) / 1000000ull;
+}
+
+unsigned long micros() {
+    return (now_ns() - startNs) / 1000ull;
+}
+
+void delay(unsigned long ms) {
+    esp_delay(ms, []() { return true; });
+}
+
+void yield() {
+    native_run_events(0);
+}
+
+void optimistic_yield(uint32_t interval_us) {
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+}
+
+
+EspClass ESP;
+
+void EspClass::deepSleep(uint64_t time_us) {
+    fprintf(stderr, "deepSleep(%llu), exiting\n", (unsigned long long)time_us);
+    exit(1);
+}
+
+void EspClass::restart() {
+    fprintf(stderr, "restart(), exiting\n");
+    exit(0);
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(now_ns() * (F_CPU / 1000000) / 1000);
+}
+
+uint32_t EspClass::getFreeHeap() {
+    // Nothing meaningful to report
+    return 0;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+    return 0;
+}
+
+
+struct NativeWatch {
+    int fd;
+    void (*handler)(void* arg);
+    void* arg;
+};
+
+static std::vector<NativeWatch> watches;
+static bool scheduled = false;
+
+void native_watch_fd(int fd, void (*handler)(void* arg), void* arg) {
+    native_unwatch_fd(fd);
+    watches.push_back({fd, handler, arg});
+}
+
+void native_unwatch_fd(int fd) {
+    for (size_t i = 0; i < watches.size(); i++)
+        if (watches[i].fd == fd) {
+            watches.erase(watches.begin() + i);
+            return;
+        }
+}
+
+void native_run_events(uint32_t timeoutMs) {
+    // A TX FIFO that drains at the emulated baud rate needs refilling before the next event
+    if (native_uart_service())
+        timeoutMs = std::min(timeoutMs, (uint32_t)1);
+    if (scheduled)
+        timeoutMs = 0;
+    scheduled = false;
+
+    std::vector<pollfd> pfds;
+    for (auto& w : watches)
+        pfds.push_back({w.fd, POLLIN, 0});
+
+    if (poll(pfds.data(), pfds.size(), timeoutMs) <= 0)
+        return;
+
+    // A handler may change the watch list, look each descriptor up again
+    for (auto& pfd : pfds) {
+        if ((pfd.revents & (POLLIN | POLLERR | POLLHUP)) == 0)
+            continue;
+        for (auto& w : watches)
+            if (w.fd == pfd.fd) {
+                w.handler(w.arg);
+                break;
+            }
+    }
+}
+
+void esp_schedule() {
+    scheduled = true;
+}
+
+
+void setup();
+void loop();
+
+int main() {
+    setup();
+    while (true) {
+        loop();
+        // The SDK gets its turn between loop() calls
+        native_run_events(0);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef NATIVE_COREDECLS_H
+#define NATIVE_COREDECLS_H
+
+#include "Arduino.h"
+
+// Wakes the loop suspended in esp_delay() so it re-checks its condition, safe to call from interrupts
+void esp_schedule();
+
+// Suspends the loop until blocked() returns false or timeout_ms passes
+// blocked() is checked again whenever something calls esp_schedule()
+template <typename T>
+void esp_delay(const uint32_t timeout_ms, T&& blocked) {
+    const uint32_t start = millis();
+    while (blocked()) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout_ms)
+            return;
+        native_run_events(timeout_ms - elapsed);
+    }
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef NATIVE_ESP8266_PERI_H
+#define NATIVE_ESP8266_PERI_H
+
+#include "Arduino.h"
+
+// UART0 registers, enough for an interrupt driven RX/TX handler
+// Whenever the Serial pty has data, up to 128 bytes(the size of the real FIFO) are read into an emulated RX FIFO
+// and the attached interrupt handler is called. The TX FIFO drains into the pty as soon as anything looks at it,
+// or at the rate in the NATIVE_SERIAL_BAUD environment variable if set. While the TX FIFO empty interrupt is enabled
+// the handler is called between loop iterations and events
+// Configuration writes are stored, only the RX threshold is used
+struct NativeUartRegs {
+    uint32_t conf1;
+    uint32_t intEnable;
+    uint32_t intClear;
+};
+
+extern NativeUartRegs nativeUart0;
+
+uint32_t native_uart_int_status();
+uint32_t native_uart_rx_count();
+uint8_t native_uart_rx_read();
+uint32_t native_uart_tx_count();
+void native_uart_tx_write(uint8_t c);
+
+// Reading pops the RX FIFO, writing pushes to the TX FIFO
+struct NativeUartFifo {
+    operator uint8_t() { return native_uart_rx_read(); }
+    NativeUartFifo& operator=(uint8_t c) {
+        native_uart_tx_write(c);
+        return *this;
+    }
+};
+
+#define USF(u) (NativeUartFifo())
+#define USS(u) ((native_uart_rx_count() << USRXC) | (native_uart_tx_count() << USTXC))
+#define USIS(u) native_uart_int_status()
+#define USIC(u) nativeUart0.intClear
+#define USIE(u) nativeUart0.intEnable
+#define USC1(u) nativeUart0.conf1
+
+// Status register
+#define USTXC 16 // TX FIFO count(8 bit)
+#define USRXC 0  // RX FIFO count(8 bit)
+
+// Interrupt registers
+#define UITO 8 // RX FIFO timeout
+#define UIOF 4 // RX FIFO overflow
+#define UIFE 1 // TX FIFO empty
+#define UIFF 0 // RX FIFO full
+
+// CONF1 register
+#define UCTOE 31 // RX timeout enable
+#define UCTOT 24 // RX timeout threshold(7 bit)
+#define UCFET 8  // TX FIFO empty threshold(7 bit)
+#define UCFFT 0  // RX FIFO full threshold(7 bit)
+
+#endif
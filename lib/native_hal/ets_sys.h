@@ -0,0 +1,19 @@
+#ifndef NATIVE_ETS_SYS_H
+#define NATIVE_ETS_SYS_H
+
+#include "Arduino.h"
+
+typedef void (*int_handler_t)(void* arg, void* frame);
+
+// Only the UART interrupt is emulated, see esp8266_peri.h
+void native_uart_attach_isr(int_handler_t handler, void* arg);
+void native_uart_intr_enable(bool enable);
+
+#define ETS_UART_INTR_ATTACH(func, arg) native_uart_attach_isr((int_handler_t)(func), (void*)(arg))
+#define ETS_UART_INTR_ENABLE() native_uart_intr_enable(true)
+#define ETS_UART_INTR_DISABLE() native_uart_intr_enable(false)
+
+// Where printf output goes, one character at a time. Writes straight to Serial until replaced
+void ets_install_putc1(void (*routine)(char c));
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef NATIVE_LWIP_IP_ADDR_H
+#define NATIVE_LWIP_IP_ADDR_H
+
+#include <stdint.h>
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t s8_t;
+
+typedef s8_t err_t;
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_BUF -2
+#define ERR_RTE -4
+#define ERR_VAL -6
+#define ERR_USE -8
+
+// IPv4 only, addr is in network byte order
+typedef struct ip4_addr {
+    u32_t addr;
+} ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
+
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define IP_ADDR4(ipaddr, a, b, c, d) \
+    ((ipaddr)->addr = (u32_t)(a) | ((u32_t)(b) << 8) | ((u32_t)(c) << 16) | ((u32_t)(d) << 24))
+#define ip4_addr1(ipaddr) (((const u8_t*)(&(ipaddr)->addr))[0])
+#define ip4_addr2(ipaddr) (((const u8_t*)(&(ipaddr)->addr))[1])
+#define ip4_addr3(ipaddr) (((const u8_t*)(&(ipaddr)->addr))[2])
+#define ip4_addr4(ipaddr) (((const u8_t*)(&(ipaddr)->addr))[3])
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef NATIVE_LWIP_PBUF_H
+#define NATIVE_LWIP_PBUF_H
+
+#include "lwip/ip_addr.h"
+
+// Same values as lwIP 2: the layer is the header room reserved in front of the payload
+typedef enum {
+    PBUF_TRANSPORT = 14 + 20 + 8,
+    PBUF_IP = 14 + 20,
+    PBUF_LINK = 14,
+    PBUF_RAW = 0
+} pbuf_layer;
+
+// All types are allocated as one contiguous block
+typedef enum {
+    PBUF_RAM,
+    PBUF_ROM,
+    PBUF_REF,
+    PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf* next;
+    void* payload;
+    u16_t tot_len;
+    u16_t len;
+    u8_t type_internal;
+    u8_t flags;
+    u8_t ref;
+    u8_t if_idx;
+};
+
+// Memory of the pbuf belongs to the caller, custom_free_function is called instead of freeing it
+#define PBUF_FLAG_IS_CUSTOM 0x02U
+
+typedef void (*pbuf_free_custom_fn)(struct pbuf* p);
+
+struct pbuf_custom {
+    struct pbuf pbuf;
+    pbuf_free_custom_fn custom_free_function;
+};
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+// payload_mem has to take the layer's header room and length bytes, NULL if it doesn't
+struct pbuf* pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type, struct pbuf_custom* p, void* payload_mem, u16_t payload_mem_len);
+void pbuf_ref(struct pbuf* p);
+u8_t pbuf_free(struct pbuf* p);
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset);
+err_t pbuf_take(struct pbuf* buf, const void* dataptr, u16_t len);
+// Appends t to the chain h, h takes over the reference to t
+void pbuf_cat(struct pbuf* h, struct pbuf* t);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef NATIVE_LWIP_UDP_H
+#define NATIVE_LWIP_UDP_H
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+// Raw lwIP UDP API on real sockets
+// Sockets are bound to the emulated AP address(see ESP8266WiFi.h) whatever address is passed to udp_bind
+// Receive callbacks run from native_run_events(), like the SDK calling them while the loop is suspended
+struct udp_pcb;
+
+typedef void (*udp_recv_fn)(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port);
+
+struct udp_pcb* udp_new();
+void udp_remove(struct udp_pcb* pcb);
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port);
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg);
+// Sending to x.x.x.255 of the emulated subnet sends to every other address of it, the loopback interface has no broadcasts
+err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* dst_ip, u16_t dst_port);
+
+// Socket options are left alone
+#define SOF_BROADCAST 0x20
+#define ip_set_option(pcb, opt) ((void)(pcb), (void)(opt))
+
+#endif
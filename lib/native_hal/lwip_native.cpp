@@ -0,0 +1,220 @@
+#include "ESP8266WiFi.h"
+#include "lwip/udp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+
+const ip_addr_t ip_addr_any = {0};
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+    struct pbuf* p = (struct pbuf*)malloc(sizeof(struct pbuf) + layer + length);
+    if (p == NULL)
+        return NULL;
+
+    p->next = NULL;
+    p->payload = (u8_t*)(p + 1) + layer;
+    p->tot_len = p->len = length;
+    p->type_internal = type;
+    p->flags = 0;
+    p->ref = 1;
+    p->if_idx = 0;
+    return p;
+}
+
+struct pbuf* pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type, struct pbuf_custom* p, void* payload_mem, u16_t payload_mem_len) {
+    if (((size_t)l + length) > payload_mem_len)
+        return NULL;
+
+    p->pbuf.next = NULL;
+    p->pbuf.payload = (u8_t*)payload_mem + l;
+    p->pbuf.tot_len = p->pbuf.len = length;
+    p->pbuf.type_internal = type;
+    p->pbuf.flags = PBUF_FLAG_IS_CUSTOM;
+    p->pbuf.ref = 1;
+    p->pbuf.if_idx = 0;
+    return &p->pbuf;
+}
+
+void pbuf_ref(struct pbuf* p) {
+    if (p != NULL)
+        p->ref++;
+}
+
+u8_t pbuf_free(struct pbuf* p) {
+    u8_t count = 0;
+    while ((p != NULL) && (--p->ref == 0)) {
+        struct pbuf* next = p->next;
+        if (p->flags & PBUF_FLAG_IS_CUSTOM)
+            ((struct pbuf_custom*)p)->custom_free_function(p);
+        else
+            free(p);
+        count++;
+        p = next;
+    }
+    return count;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset) {
+    u16_t copied = 0;
+    for (; (p != NULL) && (copied < len); p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u16_t n = std::min((u16_t)(p->len - offset), (u16_t)(len - copied));
+        memcpy((u8_t*)dataptr + copied, (const u8_t*)p->payload + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+err_t pbuf_take(struct pbuf* buf, const void* dataptr, u16_t len) {
+    if ((buf == NULL) || (buf->tot_len < len))
+        return ERR_MEM;
+
+    u16_t copied = 0;
+    for (struct pbuf* p = buf; copied < len; p = p->next) {
+        u16_t n = std::min(p->len, (u16_t)(len - copied));
+        memcpy(p->payload, (const u8_t*)dataptr + copied, n);
+        copied += n;
+    }
+    return ERR_OK;
+}
+
+void pbuf_cat(struct pbuf* h, struct pbuf* t) {
+    struct pbuf* p = h;
+    for (; p->next != NULL; p = p->next)
+        p->tot_len += t->tot_len;
+    p->tot_len += t->tot_len;
+    p->next = t;
+}
+
+
+struct udp_pcb {
+    int fd = -1;
+    udp_recv_fn recv = NULL;
+    void* recvArg = NULL;
+};
+
+static void ip_from_host(uint32_t hostAddr, ip_addr_t* addr) {
+    IPAddress ip = native_from_host_addr(hostAddr);
+    IP_ADDR4(addr, ip[0], ip[1], ip[2], ip[3]);
+}
+
+static uint32_t ip_to_host(const ip_addr_t* addr) {
+    return native_to_host_addr(IPAddress(ip4_addr1(addr), ip4_addr2(addr), ip4_addr3(addr), ip4_addr4(addr)));
+}
+
+static void udp_on_readable(void* arg) {
+    struct udp_pcb* pcb = (struct udp_pcb*)arg;
+    static u8_t buffer[65536];
+
+    // Hand over everything that is queued, the way lwIP delivers a burst of frames from the WiFi driver
+    while (true) {
+        sockaddr_in from = {};
+        socklen_t fromLen = sizeof(from);
+        ssize_t len = recvfrom(pcb->fd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+        if (len < 0)
+            return;
+
+        if (pcb->recv == NULL)
+            continue;
+
+        struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+        if (p == NULL)
+            continue;
+        memcpy(p->payload, buffer, len);
+
+        ip_addr_t addr;
+        ip_from_host(from.sin_addr.s_addr, &addr);
+        // The callback owns the pbuf from here on
+        pcb->recv(pcb->recvArg, pcb, p, &addr, ntohs(from.sin_port));
+    }
+}
+
+struct udp_pcb* udp_new() {
+    return new udp_pcb();
+}
+
+void udp_remove(struct udp_pcb* pcb) {
+    if (pcb == NULL)
+        return;
+    if (pcb->fd >= 0) {
+        native_unwatch_fd(pcb->fd);
+        close(pcb->fd);
+    }
+    delete pcb;
+}
+
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port) {
+    if (pcb->fd >= 0)
+        return ERR_USE;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return ERR_MEM;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // Same as WiFiUDP, only the emulated AP address
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = native_to_host_addr(WiFi.softAPIP());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("[native] UDP bind failed");
+        close(fd);
+        return ERR_USE;
+    }
+
+    pcb->fd = fd;
+    native_watch_fd(fd, udp_on_readable, pcb);
+    return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* recv_arg) {
+    pcb->recv = recv;
+    pcb->recvArg = recv_arg;
+}
+
+err_t udp_sendto(struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* dst_ip, u16_t dst_port) {
+    if (pcb->fd < 0)
+        return ERR_RTE;
+
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(dst_port);
+    to.sin_addr.s_addr = ip_to_host(dst_ip);
+
+    const void* data = p->payload;
+    std::vector<u8_t> flat;
+    if (p->next != NULL) {
+        flat.resize(p->tot_len);
+        pbuf_copy_partial(p, flat.data(), p->tot_len, 0);
+        data = flat.data();
+    }
+
+    if (ip4_addr4(dst_ip) == 255) {
+        // .1 is the access point itself
+        ip_addr_t each;
+        for (int host = 2; host < 255; host++) {
+            IP_ADDR4(&each, ip4_addr1(dst_ip), ip4_addr2(dst_ip), ip4_addr3(dst_ip), host);
+            to.sin_addr.s_addr = ip_to_host(&each);
+            sendto(pcb->fd, data, p->tot_len, 0, (sockaddr*)&to, sizeof(to));
+        }
+        return ERR_OK;
+    }
+
+    ssize_t ret = sendto(pcb->fd, data, p->tot_len, 0, (sockaddr*)&to, sizeof(to));
+    return (ret == (ssize_t)p->tot_len) ? ERR_OK : ERR_BUF;
+}
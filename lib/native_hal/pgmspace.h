@@ -0,0 +1,12 @@
+#ifndef NATIVE_PGMSPACE_H
+#define NATIVE_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Flash and RAM are the same here, on the ESP8266 PROGMEM data can only be read 4 bytes at a time
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define memcpy_P memcpy
+
+#endif
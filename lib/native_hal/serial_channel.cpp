@@ -0,0 +1,140 @@
+#include "serial_channel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Looks like the dongle's own text output
+static const char TEXT_LINE[] = "[native] text in the middle of a frame\n";
+
+
+SerialChannel::SerialChannel() {
+    configure("");
+}
+
+bool SerialChannel::configure(const char* spec) {
+    return configure(spec, 0);
+}
+
+bool SerialChannel::configure(const char* spec, uint32_t seedOffset) {
+    dropP = flipP = garbageP = burstP = textP = 0;
+    burstLen = burstLeft = 0;
+    memset(&counters, 0, sizeof(counters));
+    uint64_t seed = 1;
+
+    bool ok = true;
+    const char* cur = spec;
+    while (ok && (*cur != '\0')) {
+        const char* end = strchr(cur, ',');
+        size_t len = (end != NULL) ? (size_t)(end - cur) : strlen(cur);
+        char item[64];
+        if (len >= sizeof(item)) {
+            ok = false;
+            break;
+        }
+        memcpy(item, cur, len);
+        item[len] = '\0';
+        cur += len + ((end != NULL) ? 1 : 0);
+        if (len == 0)
+            continue;
+
+        char* value = strchr(item, '=');
+        if (value == NULL) {
+            ok = false;
+            break;
+        }
+        *(value++) = '\0';
+
+        char* rest = NULL;
+        double p = strtod(value, &rest);
+        if ((rest == value) || (p < 0) || ((p > 1) && (strcmp(item, "seed") != 0))) {
+            ok = false;
+        } else if (strcmp(item, "drop") == 0) {
+            dropP = p;
+        } else if (strcmp(item, "flip") == 0) {
+            flipP = p;
+        } else if (strcmp(item, "garbage") == 0) {
+            garbageP = p;
+        } else if (strcmp(item, "text") == 0) {
+            textP = p;
+        } else if (strcmp(item, "burst") == 0) {
+            burstP = p;
+            burstLen = 16;
+            if (*rest == ':')
+                burstLen = strtoul(rest + 1, &rest, 10);
+            ok = burstLen > 0;
+        } else if (strcmp(item, "seed") == 0) {
+            seed = strtoull(value, &rest, 10);
+        } else {
+            ok = false;
+        }
+        if (ok && (*rest != '\0'))
+            ok = false;
+    }
+
+    if (!ok)
+        dropP = flipP = garbageP = burstP = textP = 0;
+    // xorshift64 never leaves 0
+    rng = (seed + seedOffset) * 0x9E3779B97F4A7C15ULL;
+    if (rng == 0)
+        rng = 1;
+    return ok;
+}
+
+bool SerialChannel::lossless() const {
+    return (dropP == 0) && (flipP == 0) && (garbageP == 0) && (burstP == 0) && (textP == 0);
+}
+
+uint32_t SerialChannel::next() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng >> 32;
+}
+
+double SerialChannel::uniform() {
+    return next() / 4294967296.0;
+}
+
+void SerialChannel::apply(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+    if (lossless()) {
+        out.insert(out.end(), data, data + len);
+        counters.bytes += len;
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        counters.bytes++;
+        uint8_t b = data[i];
+
+        if ((textP > 0) && (uniform() < textP)) {
+            out.insert(out.end(), TEXT_LINE, TEXT_LINE + sizeof(TEXT_LINE) - 1);
+            counters.textLines++;
+        }
+        if ((garbageP > 0) && (uniform() < garbageP)) {
+            uint32_t n = 1 + next() % 8;
+            for (uint32_t k = 0; k < n; k++)
+                out.push_back(next());
+            counters.inserted += n;
+        }
+
+        if ((burstLeft == 0) && (burstP > 0) && (uniform() < burstP))
+            burstLeft = burstLen;
+        if (burstLeft > 0) {
+            burstLeft--;
+            counters.burstBytes++;
+            out.push_back(next());
+            continue;
+        }
+
+        if ((dropP > 0) && (uniform() < dropP)) {
+            counters.dropped++;
+            continue;
+        }
+        if ((flipP > 0) && (uniform() < flipP)) {
+            b ^= 1 << (next() % 8);
+            counters.flipped++;
+        }
+        out.push_back(b);
+    }
+}
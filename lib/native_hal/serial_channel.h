@@ -0,0 +1,51 @@
+#ifndef SERIAL_CHANNEL_H
+#define SERIAL_CHANNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+// Lossy serial line model, for reproducing link errors without hardware
+// Serial uses it in both directions when NATIVE_SERIAL_CHANNEL is set, bench/channel_bench.cpp measures the framings with it
+// Configured with a comma separated list, probabilities are per byte:
+//   drop=P      the byte is lost, what a skipped byte or a FIFO overflow looks like
+//   flip=P      one random bit of the byte is flipped
+//   garbage=P   1-8 random bytes are inserted before the byte, line noise
+//   burst=P:LEN the byte and the LEN - 1 after it are replaced by random ones
+//   text=P      a line of text is inserted before the byte, printf output landing in the middle of a frame
+//   seed=N      the same seed and input always give the same output
+class SerialChannel {
+public:
+    struct Stats {
+        uint64_t bytes;
+        uint64_t dropped, flipped, inserted, burstBytes, textLines;
+    };
+
+    SerialChannel();
+
+    // Returns false if spec is malformed, the channel is then left lossless
+    bool configure(const char* spec);
+    // Same as configure, with a different seed, so both directions don't get the same errors
+    bool configure(const char* spec, uint32_t seedOffset);
+    bool lossless() const;
+
+    // Appends what comes out of the line when data is sent into it
+    void apply(const uint8_t* data, size_t len, std::vector<uint8_t>& out);
+
+    // Counters since configure
+    const Stats& stats() const { return counters; }
+
+private:
+    uint32_t next();
+    // Uniform in [0, 1)
+    double uniform();
+
+    double dropP, flipP, garbageP, burstP, textP;
+    uint32_t burstLen;
+    uint32_t burstLeft;
+    uint64_t rng;
+    Stats counters;
+};
+
+#endif
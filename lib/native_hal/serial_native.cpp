@@ -0,0 +1,292 @@
+#include "Arduino.h"
+#include "esp8266_peri.h"
+#include "ets_sys.h"
+#include "serial_channel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// How long a write may wait for the other side before the data is dropped
+// A real UART keeps sending even if nobody listens
+#define SERIAL_WRITE_TIMEOUT_MS 100
+
+#define UART_FIFO_SIZE 128
+
+
+HardwareSerial Serial;
+
+// 0 - no baud rate limit, see NATIVE_SERIAL_BAUD
+static uint32_t txBytesPerSec = 0;
+static uint64_t txDrainUs = 0;
+
+// Link errors, see NATIVE_SERIAL_CHANNEL. Inserted bytes can make more come out than was asked for, rx keeps the rest
+static SerialChannel rxChannel, txChannel;
+static std::vector<uint8_t> rxChannelOut, txChannelOut;
+static size_t rxChannelPos = 0;
+
+static void serial_putc(char c) {
+    Serial.write((const uint8_t*)&c, 1);
+}
+
+static void (*putc1)(char c) = serial_putc;
+
+void ets_install_putc1(void (*routine)(char c)) {
+    putc1 = routine;
+}
+
+static ssize_t stdout_write(void* cookie, const char* buf, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        putc1(buf[i]);
+    return size;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    if (fd >= 0)
+        return;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0)) {
+        perror("[native] Couldn't create serial pty");
+        exit(1);
+    }
+
+    // Keep the slave side open ourselves, so the pty stays valid while the host reconnects
+    // and so it can be switched to raw mode(otherwise the line discipline echoes data back to us)
+    const char* slaveName = ptsname(fd);
+    int slave = open(slaveName, O_RDWR | O_NOCTTY);
+    termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // printf goes to the serial port on the ESP, do the same here
+    fflush(stdout);
+    cookie_io_functions_t io = {NULL, stdout_write, NULL, NULL};
+    stdout = fopencookie(NULL, "w", io);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    fprintf(stderr, "[native] Serial(%lu baud) on %s\n", baud, slaveName);
+
+    const char* limit = getenv("NATIVE_SERIAL_BAUD");
+    if (limit != NULL) {
+        txBytesPerSec = strtoul(limit, NULL, 10) / 10;
+        fprintf(stderr, "[native] Serial TX limited to %lu bytes/s\n", (unsigned long)txBytesPerSec);
+    }
+
+    const char* channel = getenv("NATIVE_SERIAL_CHANNEL");
+    if (channel != NULL) {
+        if (!rxChannel.configure(channel, 0) || !txChannel.configure(channel, 1)) {
+            fprintf(stderr, "[native] NATIVE_SERIAL_CHANNEL should look like drop=0.001,flip=0.0001,burst=0.00001:16, see serial_channel.h\n");
+            exit(1);
+        }
+        fprintf(stderr, "[native] Serial channel errors: %s\n", channel);
+    }
+}
+
+void HardwareSerial::end() {
+}
+
+void HardwareSerial::updateBaudRate(unsigned long baud) {
+    fprintf(stderr, "[native] Serial baud rate %lu\n", baud);
+}
+
+int HardwareSerial::available() {
+    int ret = 0;
+    if ((fd < 0) || (ioctl(fd, FIONREAD, &ret) != 0))
+        return 0;
+    return ret + native_rx_pending();
+}
+
+size_t HardwareSerial::native_rx_pending() const {
+    return rxChannelOut.size() - rxChannelPos;
+}
+
+int HardwareSerial::availableForWrite() {
+    // A pty doesn't say how much room it has left, assume the size of the ESP8266 TX FIFO
+    return (fd < 0) ? 0 : 128;
+}
+
+int HardwareSerial::read() {
+    uint8_t c;
+    if (read(&c, 1) != 1)
+        return -1;
+    return c;
+}
+
+size_t HardwareSerial::read(uint8_t* buffer, size_t size) {
+    if (fd < 0)
+        return 0;
+    if (rxChannel.lossless()) {
+        ssize_t ret = ::read(fd, buffer, size);
+        return (ret > 0) ? ret : 0;
+    }
+
+    if (native_rx_pending() == 0) {
+        uint8_t raw[UART_FIFO_SIZE];
+        ssize_t ret = ::read(fd, raw, sizeof(raw));
+        rxChannelOut.clear();
+        rxChannelPos = 0;
+        if (ret > 0)
+            rxChannel.apply(raw, ret, rxChannelOut);
+    }
+
+    size_t n = std::min(size, native_rx_pending());
+    memcpy(buffer, &rxChannelOut[rxChannelPos], n);
+    rxChannelPos += n;
+    return n;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (fd < 0)
+        return 0;
+
+    size_t requested = size;
+    if (!txChannel.lossless()) {
+        txChannelOut.clear();
+        txChannel.apply(buffer, size, txChannelOut);
+        buffer = txChannelOut.data();
+        size = txChannelOut.size();
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t ret = ::write(fd, buffer + written, size - written);
+        if (ret > 0) {
+            written += ret;
+            continue;
+        }
+        if ((ret < 0) && (errno != EAGAIN) && (errno != EINTR))
+            break;
+
+        pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, SERIAL_WRITE_TIMEOUT_MS) <= 0)
+            break;
+    }
+    // Bytes the channel dropped count as written, the same as on a real line
+    return (written == size) ? requested : std::min(written, requested);
+}
+
+void HardwareSerial::flush() {
+}
+
+
+NativeUartRegs nativeUart0;
+
+static int_handler_t uartIsr = NULL;
+static void* uartIsrArg = NULL;
+static bool uartIntEnabled = false;
+
+static uint8_t rxFifo[UART_FIFO_SIZE];
+static size_t rxFifoLen = 0, rxFifoPos = 0;
+static uint8_t txFifo[UART_FIFO_SIZE];
+static size_t txFifoLen = 0;
+
+static void uart_on_readable(void* arg) {
+    // Whatever the handler left in the FIFO stays there, only top it up
+    if (rxFifoPos > 0) {
+        memmove(rxFifo, &rxFifo[rxFifoPos], rxFifoLen - rxFifoPos);
+        rxFifoLen -= rxFifoPos;
+        rxFifoPos = 0;
+    }
+    rxFifoLen += Serial.read(&rxFifo[rxFifoLen], UART_FIFO_SIZE - rxFifoLen);
+
+    // Interrupts are only ever disabled for a moment inside loop(), never while events are handled
+    if (uartIsr && uartIntEnabled && (native_uart_int_status() != 0))
+        uartIsr(uartIsrArg, NULL);
+}
+
+void native_uart_attach_isr(int_handler_t handler, void* arg) {
+    uartIsr = handler;
+    uartIsrArg = arg;
+
+    int fd = Serial.native_fd();
+    if (fd < 0)
+        return;
+    if (uartIsr)
+        native_watch_fd(fd, uart_on_readable, NULL);
+    else
+        native_unwatch_fd(fd);
+}
+
+void native_uart_intr_enable(bool enable) {
+    uartIntEnabled = enable;
+}
+
+bool native_uart_service() {
+    // The channel model inserted more than fit into the FIFO, the pty won't signal for it again
+    if (Serial.native_rx_pending() > 0)
+        uart_on_readable(NULL);
+
+    // Bounded, in case the handler never turns the interrupt off
+    for (int i = 0; i < 64; i++) {
+        if (!uartIsr || !uartIntEnabled || ((native_uart_int_status() & (1 << UIFE)) == 0))
+            break;
+        uartIsr(uartIsrArg, NULL);
+    }
+    return (native_uart_tx_count() > 0) || (nativeUart0.intEnable & (1 << UIFE)) || (Serial.native_rx_pending() > 0);
+}
+
+uint32_t native_uart_int_status() {
+    uint32_t status = 0;
+
+    uint32_t count = native_uart_rx_count();
+    if (count > 0) {
+        // The pty was drained in one go, so anything short of the threshold means the sender went quiet
+        uint32_t threshold = (nativeUart0.conf1 >> UCFFT) & 0x7F;
+        status |= (count >= threshold) ? (1 << UIFF) : (1 << UITO);
+    }
+
+    uint32_t txThreshold = (nativeUart0.conf1 >> UCFET) & 0x7F;
+    if (native_uart_tx_count() < txThreshold)
+        status |= (1 << UIFE);
+
+    return status & nativeUart0.intEnable;
+}
+
+uint32_t native_uart_rx_count() {
+    return rxFifoLen - rxFifoPos;
+}
+
+uint8_t native_uart_rx_read() {
+    if (rxFifoPos >= rxFifoLen)
+        return 0;
+    return rxFifo[rxFifoPos++];
+}
+
+uint32_t native_uart_tx_count() {
+    if (txBytesPerSec == 0) {
+        // Whatever was written so far has gone out by the time anyone looks
+        if (txFifoLen > 0)
+            Serial.write(txFifo, txFifoLen);
+        txFifoLen = 0;
+        return 0;
+    }
+
+    uint64_t now = micros();
+    size_t drained = std::min((uint64_t)txFifoLen, (now - txDrainUs) * txBytesPerSec / 1000000);
+    if (drained > 0) {
+        Serial.write(txFifo, drained);
+        memmove(txFifo, &txFifo[drained], txFifoLen - drained);
+        txFifoLen -= drained;
+        txDrainUs += drained * 1000000 / txBytesPerSec;
+    }
+    // An idle line doesn't bank time
+    if (txFifoLen == 0)
+        txDrainUs = now;
+    return txFifoLen;
+}
+
+void native_uart_tx_write(uint8_t c) {
+    // The real FIFO would drop it, but nothing here writes without checking the count first
+    if (txFifoLen >= UART_FIFO_SIZE) {
+        Serial.write(txFifo, txFifoLen);
+        txFifoLen = 0;
+    }
+    txFifo[txFifoLen++] = c;
+}
@@ -0,0 +1,159 @@
+#include "ESP8266WiFi.h"
+#include "WiFiUdp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+ESP8266WiFiClass WiFi;
+
+static uint8_t subnet[3] = {127, 0, 4};
+
+bool ESP8266WiFiClass::softAP(const char* ssid, const char* pass, int channel, int hidden, int maxConnection) {
+    const char* env = getenv("NATIVE_SUBNET");
+    if (env != NULL) {
+        unsigned a, b, c;
+        if (sscanf(env, "%u.%u.%u", &a, &b, &c) != 3) {
+            fprintf(stderr, "[native] NATIVE_SUBNET should look like 127.0.4\n");
+            return false;
+        }
+        subnet[0] = a;
+        subnet[1] = b;
+        subnet[2] = c;
+    }
+
+    fprintf(stderr, "[native] Access point %s is %u.%u.%u.1\n", ssid, subnet[0], subnet[1], subnet[2]);
+    return true;
+}
+
+uint32_t native_to_host_addr(const IPAddress& addr) {
+    uint8_t bytes[4] = {addr[0], addr[1], addr[2], addr[3]};
+    if ((addr[0] == 192) && (addr[1] == 168) && (addr[2] == 4))
+        memcpy(bytes, subnet, 3);
+
+    uint32_t ret;
+    memcpy(&ret, bytes, 4);
+    return ret;
+}
+
+IPAddress native_from_host_addr(uint32_t addr) {
+    uint8_t bytes[4];
+    memcpy(bytes, &addr, 4);
+    if (memcmp(bytes, subnet, 3) == 0)
+        return IPAddress(192, 168, 4, bytes[3]);
+    return IPAddress(bytes[0], bytes[1], bytes[2], bytes[3]);
+}
+
+
+struct NativeUdpContext {
+    int fd = -1;
+    uint16_t port = 0;
+
+    uint8_t rxBuffer[65536];
+    size_t rxLen = 0, rxPos = 0;
+    sockaddr_in rxFrom = {};
+
+    std::vector<uint8_t> txBuffer;
+    sockaddr_in txTo = {};
+
+    ~NativeUdpContext() {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    auto newCtx = std::make_shared<NativeUdpContext>();
+    newCtx->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (newCtx->fd < 0)
+        return 0;
+
+    int one = 1;
+    setsockopt(newCtx->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    fcntl(newCtx->fd, F_SETFL, fcntl(newCtx->fd, F_GETFL) | O_NONBLOCK);
+
+    // Bind to the emulated AP address only, so a server on the same machine can still use the same ports
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = native_to_host_addr(WiFi.softAPIP());
+    if (bind(newCtx->fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("[native] UDP bind failed");
+        return 0;
+    }
+
+    newCtx->port = port;
+    ctx = newCtx;
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    ctx.reset();
+}
+
+int WiFiUDP::parsePacket() {
+    if (!ctx)
+        return 0;
+
+    socklen_t fromLen = sizeof(ctx->rxFrom);
+    ssize_t ret = recvfrom(ctx->fd, ctx->rxBuffer, sizeof(ctx->rxBuffer), 0, (sockaddr*)&ctx->rxFrom, &fromLen);
+    ctx->rxPos = 0;
+    ctx->rxLen = (ret > 0) ? ret : 0;
+    return ctx->rxLen;
+}
+
+int WiFiUDP::available() {
+    return ctx ? (ctx->rxLen - ctx->rxPos) : 0;
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t len) {
+    size_t n = std::min(len, (size_t)available());
+    if (n > 0) {
+        memcpy(buffer, &ctx->rxBuffer[ctx->rxPos], n);
+        ctx->rxPos += n;
+    }
+    return n;
+}
+
+IPAddress WiFiUDP::remoteIP() {
+    return ctx ? native_from_host_addr(ctx->rxFrom.sin_addr.s_addr) : IPAddress();
+}
+
+uint16_t WiFiUDP::remotePort() {
+    return ctx ? ntohs(ctx->rxFrom.sin_port) : 0;
+}
+
+uint16_t WiFiUDP::localPort() {
+    return ctx ? ctx->port : 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    if (!ctx)
+        return 0;
+
+    ctx->txBuffer.clear();
+    ctx->txTo = {};
+    ctx->txTo.sin_family = AF_INET;
+    ctx->txTo.sin_port = htons(port);
+    ctx->txTo.sin_addr.s_addr = native_to_host_addr(ip);
+    return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+    if (!ctx)
+        return 0;
+    ctx->txBuffer.insert(ctx->txBuffer.end(), buffer, buffer + size);
+    return size;
+}
+
+int WiFiUDP::endPacket() {
+    if (!ctx)
+        return 0;
+
+    ssize_t ret = sendto(ctx->fd, ctx->txBuffer.data(), ctx->txBuffer.size(), 0, (sockaddr*)&ctx->txTo, sizeof(ctx->txTo));
+    return ret == (ssize_t)ctx->txBuffer.size();
+}
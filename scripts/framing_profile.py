@@ -0,0 +1,24 @@
+# PlatformIO pre script: turns custom_framing_profile of the environment into the defines of src/framing_profile.h
+# The profiles are in framing_profiles.json, host/slime_ap.py --profile reads the same file
+import json
+import os
+
+Import("env")
+
+name = env.GetProjectOption("custom_framing_profile", "default")
+with open(os.path.join(env.subst("$PROJECT_DIR"), "framing_profiles.json")) as f:
+    profiles = json.load(f)
+if name not in profiles:
+    raise ValueError("Unknown framing profile %s, framing_profiles.json has: %s" % (name, ", ".join(profiles)))
+
+profile = profiles[name]
+print("Framing profile: %s" % name)
+env.Append(CPPDEFINES=[
+    ("FRAGMENT_SIZE", profile["fragment_size"]),
+    ("FRAME_MAX_DATAGRAM_SIZE", profile["max_datagram_size"]),
+    ("FRAME_ADDRESS_SIZE", profile["address_size"]),
+    ("FRAME_PORT_SIZE", profile["port_size"]),
+    ("FRAME_PORT_BASE", profile.get("port_base", 0)),
+    ("FRAME_FEC", int(profile.get("fec", True))),
+    ("CRC16_POLY", profile["crc16_poly"]),
+])
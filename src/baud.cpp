@@ -0,0 +1,83 @@
+#include <Arduino.h>
+
+#include "baud.h"
+#include "log.h"
+#include "uart.h"
+
+
+static uint32_t currentBaud = SERIAL_BAUD;
+static uint32_t previousBaud = SERIAL_BAUD;
+
+static bool confirmPending = false;
+static uint32_t confirmStartMs = 0;
+
+static uint32_t lastGoodFrameMs = 0;
+static size_t garbageBytes = 0;
+
+static void apply(uint32_t baud) {
+    // Whatever is still queued would go out at the new rate
+    uart_tx_flush();
+    Serial.updateBaudRate(baud);
+    currentBaud = baud;
+
+    lastGoodFrameMs = millis();
+    garbageBytes = 0;
+}
+
+void baud_begin() {
+    Serial.begin(SERIAL_BAUD);
+    uart_begin();
+    currentBaud = previousBaud = SERIAL_BAUD;
+    lastGoodFrameMs = millis();
+}
+
+uint32_t baud_current() {
+    return currentBaud;
+}
+
+bool baud_switch(uint32_t baud) {
+    if ((baud < BAUD_MIN) || (baud > BAUD_MAX))
+        return false;
+
+    // Switching again before confirming keeps the last confirmed rate to go back to
+    if (!confirmPending)
+        previousBaud = currentBaud;
+    apply(baud);
+
+    confirmPending = true;
+    confirmStartMs = millis();
+    return true;
+}
+
+void baud_confirm() {
+    confirmPending = false;
+    previousBaud = currentBaud;
+}
+
+void baud_frame_ok() {
+    lastGoodFrameMs = millis();
+    garbageBytes = 0;
+}
+
+void baud_rx_garbage(size_t bytes) {
+    garbageBytes += bytes;
+}
+
+void baud_update() {
+    uint32_t now = millis();
+
+    if (confirmPending && ((now - confirmStartMs) >= BAUD_CONFIRM_MS)) {
+        confirmPending = false;
+        apply(previousBaud);
+        LOG(LOG_WARN, LOG_BAUD_NOT_CONFIRMED, currentBaud);
+        return;
+    }
+
+    if ((currentBaud != SERIAL_BAUD) && (garbageBytes >= BAUD_FALLBACK_BYTES) && ((now - lastGoodFrameMs) >= BAUD_FALLBACK_MS)) {
+        uint32_t failedBaud = currentBaud;
+        confirmPending = false;
+        apply(SERIAL_BAUD);
+        previousBaud = SERIAL_BAUD;
+        LOG(LOG_WARN, LOG_BAUD_FALLBACK, failedBaud, currentBaud);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef BAUD_H
+#define BAUD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Serial baud rate, negotiated by the host(see CONTROL_SET_BAUD in packet_framing.h)
+// The dongle always boots at SERIAL_BAUD and falls back to it if the link stops working
+#define SERIAL_BAUD (115200 * 10)
+#define BAUD_MIN 9600
+#define BAUD_MAX 4000000
+
+// A new rate is dropped again unless the host confirms it within this time
+#define BAUD_CONFIRM_MS 1000
+// Back to SERIAL_BAUD after this many garbage bytes and this long without a valid frame
+// A host that was restarted talks at SERIAL_BAUD again, so that is the rate it will look for us at first
+#define BAUD_FALLBACK_BYTES 256
+#define BAUD_FALLBACK_MS 2000
+
+// Starts Serial and the UART interrupt(uart.h)
+void baud_begin();
+uint32_t baud_current();
+
+// Waits for pending TX to go out, then switches. Has to be confirmed with baud_confirm()
+bool baud_switch(uint32_t baud);
+void baud_confirm();
+
+// Link health, fed by the frame parser
+void baud_frame_ok();
+void baud_rx_garbage(size_t bytes);
+
+// Handles confirmation timeouts and the fallback, call from loop()
+void baud_update();
+
+#endif
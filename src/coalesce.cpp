@@ -0,0 +1,57 @@
+#include "coalesce.h"
+
+
+struct CoalesceRule {
+    // SlimeVR PACKET_* type
+    uint8_t type;
+    // Bytes that tell apart streams of the same type(sensor id, data type), part of the class. keyLen 0 - none
+    uint8_t keyOffset, keyLen;
+};
+
+// Header: type(4), packet number(8)
+static constexpr CoalesceRule COALESCE_RULES[] = {
+    // PACKET_ROTATION_DATA: sensor id(1), data type(1, normal or correction), quaternion, accuracy
+    {17, 12, 2},
+    // PACKET_ACCEL: vector(12), sensor id(1)
+    {4, 24, 1},
+    // PACKET_ROTATION, sensor 0 only
+    {1, 0, 0},
+    // PACKET_MAGNETOMETER_ACCURACY: sensor id(1), accuracy
+    {18, 12, 1},
+    // PACKET_BATTERY_LEVEL
+    {12, 0, 0},
+    // PACKET_SIGNAL_STRENGTH: sensor id(1), RSSI
+    {19, 12, 1},
+    // PACKET_TEMPERATURE: sensor id(1), temperature
+    {20, 12, 1},
+};
+#define RULE_COUNT (sizeof(COALESCE_RULES) / sizeof(COALESCE_RULES[0]))
+static_assert(RULE_COUNT <= 32, "CONFIG_COALESCE has a bit per rule");
+
+uint32_t coalesce_class(const pbuf* p, uint32_t enabledRules) {
+    if ((enabledRules == 0) || (p->tot_len < 12))
+        return COALESCE_NONE;
+
+    uint8_t header[4];
+    pbuf_copy_partial(p, header, 4, 0);
+    if ((header[0] != 0) || (header[1] != 0) || (header[2] != 0))
+        return COALESCE_NONE;
+
+    for (uint8_t i = 0; i < RULE_COUNT; i++) {
+        const CoalesceRule& rule = COALESCE_RULES[i];
+        if (!(enabledRules & (1u << i)) || (header[3] != rule.type))
+            continue;
+        if (p->tot_len < (rule.keyOffset + rule.keyLen))
+            return COALESCE_NONE;
+
+        // type, key bytes
+        uint8_t key[2] = {0, 0};
+        pbuf_copy_partial(p, key, rule.keyLen, rule.keyOffset);
+        return ((uint32_t)rule.type << 16) | (key[0] << 8) | key[1];
+    }
+    return COALESCE_NONE;
+}
+
+uint32_t coalesce_rules_mask() {
+    return (RULE_COUNT < 32) ? ((1u << RULE_COUNT) - 1) : 0xFFFFFFFF;
+}
@@ -0,0 +1,28 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stdint.h>
+
+#include <lwip/pbuf.h>
+
+// "Latest wins" for the WiFi->serial queue(see tx_queue.h): a queued datagram that hasn't started going out is
+// replaced in place by a newer one of the same class from the same tracker and ports. Once the serial link falls
+// behind, the server then gets the newest rotation instead of a backlog that is already tens of milliseconds old
+// The class comes from the SlimeVR packet header: packet type(4, big endian), packet number(8), then for most types
+// the sensor id. Only the types in COALESCE_RULES(coalesce.cpp) are ever replaced, so handshakes, pings, bundles
+// and anything that isn't a SlimeVR packet always go out
+
+// Bit n enables rule n, CONFIG_COALESCE changes it at runtime. Off by default
+#ifndef COALESCE_RULES_ENABLED
+#define COALESCE_RULES_ENABLED 0
+#endif
+
+// Never replaced
+#define COALESCE_NONE 0xFFFFFFFF
+
+// Class of the datagram under the enabled rules, COALESCE_NONE if no enabled rule matches it
+uint32_t coalesce_class(const pbuf* p, uint32_t enabledRules);
+// Bits of rules that exist
+uint32_t coalesce_rules_mask();
+
+#endif
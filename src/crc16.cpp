@@ -0,0 +1,81 @@
+#include "crc16.h"
+
+
+#if CRC16_IMPL == CRC16_BITWISE
+
+// Source: https://github.com/esp8266/Arduino/blob/master/cores/esp8266/crc32.cpp
+void update_crc16(const uint8_t* data, size_t length, uint16_t* crc) {
+    uint16_t cur = *crc;
+    while (length--)
+    {
+        uint8_t c = *(data++);
+        for (uint32_t i = 0x80; i > 0; i >>= 1)
+        {
+            bool bit = cur & 0x8000;
+            if (c & i)
+                bit = !bit;
+            cur <<= 1;
+            if (bit)
+                cur ^= CRC16_POLY;
+        }
+    }
+    *crc = cur;
+}
+
+#else
+
+#if CRC16_IMPL == CRC16_SLICE4
+#define CRC16_TABLE_COUNT 4
+#else
+#define CRC16_TABLE_COUNT 1
+#endif
+
+struct crc16_tables_t {
+    uint16_t t[CRC16_TABLE_COUNT][256];
+};
+
+// tables.t[0][x] - CRC of byte x
+// tables.t[k][x] - CRC of byte x followed by k zero bytes
+// Since the CRC is linear, CRC of a few bytes is a XOR of these
+static constexpr crc16_tables_t make_crc16_tables() {
+    crc16_tables_t ret = {};
+    for (uint32_t x = 0; x < 256; x++) {
+        uint16_t cur = x << 8;
+        for (int i = 0; i < 8; i++)
+            cur = (cur & 0x8000) ? ((cur << 1) ^ CRC16_POLY) : (cur << 1);
+        ret.t[0][x] = cur;
+    }
+
+    for (int k = 1; k < CRC16_TABLE_COUNT; k++)
+        for (uint32_t x = 0; x < 256; x++) {
+            uint16_t prev = ret.t[k - 1][x];
+            ret.t[k][x] = (uint16_t)(prev << 8) ^ ret.t[0][prev >> 8];
+        }
+
+    return ret;
+}
+
+static constexpr crc16_tables_t CRC16_TABLES = make_crc16_tables();
+
+void update_crc16(const uint8_t* data, size_t length, uint16_t* crc) {
+    uint16_t cur = *crc;
+
+#if CRC16_TABLE_COUNT == 4
+    // The current CRC overlaps the first two bytes of each 4 byte step
+    while (length >= 4) {
+        cur = CRC16_TABLES.t[3][(cur >> 8) ^ data[0]]
+            ^ CRC16_TABLES.t[2][(cur & 0xFF) ^ data[1]]
+            ^ CRC16_TABLES.t[1][data[2]]
+            ^ CRC16_TABLES.t[0][data[3]];
+        data += 4;
+        length -= 4;
+    }
+#endif
+
+    while (length--)
+        cur = (uint16_t)(cur << 8) ^ CRC16_TABLES.t[0][(cur >> 8) ^ *(data++)];
+
+    *crc = cur;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// MSB-first CRC16, init 0, no final xor. Must match crc16() in host/crc16.py, bench/crc_bench.cpp checks that
+// The polynomial is part of the framing profile, see framing_profile.h
+#ifndef CRC16_POLY
+#define CRC16_POLY 0x5935
+#endif
+
+// Implementation selection, pick with -DCRC16_IMPL=... in platformio.ini
+// CRC16_BITWISE - no tables, 8 shift/xor steps per byte
+// CRC16_TABLE   - one 256 entry table(512 bytes of RAM)
+// CRC16_SLICE4  - four 256 entry tables(2KB of RAM), consumes 4 bytes per step
+#define CRC16_BITWISE 0
+#define CRC16_TABLE 1
+#define CRC16_SLICE4 2
+
+#ifndef CRC16_IMPL
+#define CRC16_IMPL CRC16_TABLE
+#endif
+
+void update_crc16(const uint8_t* data, size_t length, uint16_t* crc);
+
+#endif
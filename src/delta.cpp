@@ -0,0 +1,103 @@
+#include "delta.h"
+
+#include <string.h>
+
+
+DeltaEncoder::DeltaEncoder() : on(DELTA_COMPRESSION), useCounter(0), keyframes(0), deltas(0), savedBytes(0) {
+    memset(streams, 0, sizeof(streams));
+}
+
+void DeltaEncoder::set_enabled(bool enable) {
+    on = enable;
+    resync();
+}
+
+void DeltaEncoder::resync() {
+    for (int i = 0; i < DELTA_STREAMS; i++)
+        streams[i].needKeyframe = true;
+}
+
+uint8_t DeltaEncoder::find(frame_address_t address, uint16_t localPort, uint16_t remotePort, uint16_t length) {
+    uint8_t oldest = 0;
+    for (int i = 0; i < DELTA_STREAMS; i++) {
+        const Stream& s = streams[i];
+        if ((s.length == length) && (s.address == address) && (s.localPort == localPort) && (s.remotePort == remotePort))
+            return i;
+        if ((int32_t)(s.lastUsed - streams[oldest].lastUsed) < 0)
+            oldest = i;
+    }
+
+    Stream& s = streams[oldest];
+    s.address = address;
+    s.localPort = localPort;
+    s.remotePort = remotePort;
+    s.length = length;
+    s.needKeyframe = true;
+    return oldest;
+}
+
+const uint8_t* DeltaEncoder::encode(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint8_t* stream, uint8_t* sequence, uint16_t* outputLength) {
+    uint16_t len = p->tot_len;
+    pbuf_copy_partial(p, input, len, 0);
+
+    *stream = find(address, localPort, remotePort, len);
+    Stream* s = &streams[*stream];
+    s->lastUsed = ++useCounter;
+    s->sequence = (s->sequence + 1) & DELTA_SEQUENCE_MASK;
+
+    uint16_t outLen = 0;
+    bool keyframe = s->needKeyframe || (s->sinceKeyframe >= DELTA_KEYFRAME_INTERVAL);
+    for (uint16_t group = 0; !keyframe && (group < len); group += 8) {
+        uint16_t maskIdx = outLen++;
+        uint8_t mask = 0;
+        for (uint8_t i = 0; (i < 8) && ((group + i) < len); i++) {
+            if (input[group + i] != s->data[group + i]) {
+                mask |= 1 << i;
+                output[outLen++] = input[group + i];
+            }
+        }
+        output[maskIdx] = mask;
+        // Not worth it, every group left needs at least its mask
+        int groupsLeft = ((int)len - group - 1) / 8;
+        if ((outLen + groupsLeft) >= len)
+            keyframe = true;
+    }
+
+    memcpy(s->data, input, len);
+
+    if (keyframe) {
+        put_frame_addressing(output, address, localPort, remotePort);
+        memcpy(&output[DELTA_KEYFRAME_HEADER_SIZE], input, len);
+        s->needKeyframe = false;
+        s->sinceKeyframe = 0;
+        keyframes++;
+        *sequence = s->sequence | DELTA_KEYFRAME;
+        *outputLength = DELTA_KEYFRAME_HEADER_SIZE + len;
+        return output;
+    }
+
+    s->sinceKeyframe++;
+    deltas++;
+    savedBytes += len - outLen;
+    *sequence = s->sequence;
+    *outputLength = outLen;
+    return output;
+}
+
+uint32_t DeltaEncoder::take_keyframes() {
+    uint32_t ret = keyframes;
+    keyframes = 0;
+    return ret;
+}
+
+uint32_t DeltaEncoder::take_deltas() {
+    uint32_t ret = deltas;
+    deltas = 0;
+    return ret;
+}
+
+uint32_t DeltaEncoder::take_saved_bytes() {
+    uint32_t ret = savedBytes;
+    savedBytes = 0;
+    return ret;
+}
@@ -0,0 +1,89 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+
+#include <lwip/pbuf.h>
+
+#include "framing_profile.h"
+
+// WiFi->serial compression for FRAME_TYPE_DELTA(see packet_framing.h)
+// Trackers send the same packet type, tracker id and slowly changing counters over and over, so each datagram
+// is sent as the bytes that changed since the previous one of the same stream(address, local port, remote port, length)
+// The length is part of the key because trackers interleave packet types, which mostly differ in length
+// A stream starts with a keyframe: the addressing and the datagram as it is. After that its frames only carry
+// the stream number, which both sides map back to the addressing
+// Keyframes are also sent every DELTA_KEYFRAME_INTERVAL datagrams, when a delta wouldn't be smaller and after CONTROL_RESYNC
+// host/delta.py has the matching decoder
+
+// Off by default, CONFIG_COMPRESSION turns it on at runtime
+#ifndef DELTA_COMPRESSION
+#define DELTA_COMPRESSION 0
+#endif
+// Streams with context kept, the least recently used one is replaced
+#ifndef DELTA_STREAMS
+#define DELTA_STREAMS 16
+#endif
+// Longer datagrams are sent as they are
+#ifndef DELTA_MAX_LEN
+#define DELTA_MAX_LEN 128
+#endif
+#ifndef DELTA_KEYFRAME_INTERVAL
+#define DELTA_KEYFRAME_INTERVAL 64
+#endif
+
+// In the sequence byte of a DELTA frame, the rest is a counter per stream
+#define DELTA_KEYFRAME 0x80
+#define DELTA_SEQUENCE_MASK 0x7F
+// Address and ports in front of the datagram in a keyframe
+#define DELTA_KEYFRAME_HEADER_SIZE FRAME_ADDRESSING_SIZE
+
+class DeltaEncoder {
+public:
+    DeltaEncoder();
+
+    // Turning it off forgets every stream
+    void set_enabled(bool enable);
+    bool enabled() const { return on; }
+    // Whether encode takes a datagram of this length
+    bool accepts(uint16_t length) const { return on && (length > 0) && (length <= DELTA_MAX_LEN); }
+
+    // Returned pointer - DELTA frame payload of length outputLength, valid until the next call to encode
+    // stream and sequence are output values for the frame header
+    const uint8_t* encode(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint8_t* stream, uint8_t* sequence, uint16_t* outputLength);
+    // Every stream starts over with a keyframe
+    void resync();
+
+    // Counters since the last call
+    uint32_t take_keyframes();
+    uint32_t take_deltas();
+    // Payload bytes not sent thanks to deltas
+    uint32_t take_saved_bytes();
+
+private:
+    struct Stream {
+        frame_address_t address;
+        uint16_t localPort, remotePort;
+        // 0 if the slot is free
+        uint16_t length;
+        bool needKeyframe;
+        uint8_t sequence;
+        uint8_t sinceKeyframe;
+        uint32_t lastUsed;
+        // Previous datagram
+        uint8_t data[DELTA_MAX_LEN];
+    };
+
+    uint8_t find(frame_address_t address, uint16_t localPort, uint16_t remotePort, uint16_t length);
+
+    bool on;
+    Stream streams[DELTA_STREAMS];
+    uint32_t useCounter;
+    uint8_t input[DELTA_MAX_LEN];
+    // Keyframe, or a delta until it is as long as the datagram, the last group can add up to 9 bytes
+    uint8_t output[DELTA_MAX_LEN + 9];
+
+    uint32_t keyframes, deltas, savedBytes;
+};
+
+#endif
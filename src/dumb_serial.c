@@ -1,4 +1,3 @@
-#include <stdlib.h>
 #include <memory.h>
 
 #include "dumb_serial.h"
@@ -32,33 +31,10 @@
 
 void end_chunk(read_state_t* s);
 
-struct read_state_struct {
-    uint8_t* outBuffer;
-    size_t outBufferPtr, outBufferSize;
-	size_t lastEndPtr;
-	
-    size_t chunkPtr;
-    uint8_t chunk[9];
-
-    uint8_t skipDetectBit;
-    uint8_t skipCnt;
-    size_t skipIndex;
-
-    uint8_t isEscaping;
-    uint8_t isData;
-};
-
-
-read_state_t* init_read_state(uint8_t* outBuffer, size_t outBufferSize) {
-    read_state_t* ret = malloc(sizeof(read_state_t));
-    memset(ret, 0, sizeof(read_state_t));
-    ret->outBuffer = outBuffer;
-    ret->outBufferSize = outBufferSize;
-    return ret;
-}
-
-void deinit_read_state(read_state_t* s) {
-    free(s);
+void init_read_state(read_state_t* s, uint8_t* outBuffer, size_t outBufferSize) {
+    memset(s, 0, sizeof(read_state_t));
+    s->outBuffer = outBuffer;
+    s->outBufferSize = outBufferSize;
 }
 
 size_t read_reset_buffer(read_state_t* s) {
@@ -69,6 +45,12 @@ size_t read_reset_buffer(read_state_t* s) {
     return ret;
 }
 
+size_t read_take_corrected(read_state_t* s) {
+    size_t ret = s->correctedCnt;
+    s->correctedCnt = 0;
+    return ret;
+}
+
 size_t read_process_byte(read_state_t* s, uint8_t byte) {
     if (byte == FRAME_START) {
 		// In case the previous frame wasn't properly terminated, and we're still reading it
@@ -160,6 +142,7 @@ void end_chunk(read_state_t* s) {
         for (size_t i = 0; i < l; i++)
             parity ^= s->chunk[i];
         s->chunk[s->skipIndex] = parity;
+        s->correctedCnt++;
     }
     
     // Since the highest bit is used for skip detection, we have to move it somewhere else
@@ -177,27 +160,10 @@ void end_chunk(read_state_t* s) {
 
 // Writing
 
-struct write_state_struct {
-    uint8_t* outBuffer;
-    size_t outBufferPtr, outBufferSize;
-
-    size_t chunkPtr;
-    uint8_t chunk[9];
-
-    uint8_t skipDetectBit;
-	uint8_t frameStarted;
-};
-
-write_state_t* init_write_state(uint8_t* outBuffer, size_t outBufferSize) {
-    write_state_t* ret = malloc(sizeof(write_state_t));
-    memset(ret, 0, sizeof(write_state_t));
-    ret->outBuffer = outBuffer;
-    ret->outBufferSize = outBufferSize;
-    return ret;
-}
-
-void deinit_write_state(write_state_t* s) {
-    free(s);
+void init_write_state(write_state_t* s, uint8_t* outBuffer, size_t outBufferSize) {
+    memset(s, 0, sizeof(write_state_t));
+    s->outBuffer = outBuffer;
+    s->outBufferSize = outBufferSize;
 }
 
 size_t write_reset_buffer(write_state_t* s) {
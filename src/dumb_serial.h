@@ -2,13 +2,40 @@
 #define _DUMB_SERIAL_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct read_state_struct read_state_t;
-typedef struct write_state_struct write_state_t;
+// Declared here so the state can live inside its owner instead of on the heap, only dumb_serial.c touches the fields
+typedef struct read_state_struct {
+    uint8_t* outBuffer;
+    size_t outBufferPtr, outBufferSize;
+    size_t lastEndPtr;
+
+    size_t chunkPtr;
+    uint8_t chunk[9];
+
+    uint8_t skipDetectBit;
+    uint8_t skipCnt;
+    size_t skipIndex;
+    size_t correctedCnt;
+
+    uint8_t isEscaping;
+    uint8_t isData;
+} read_state_t;
+
+typedef struct write_state_struct {
+    uint8_t* outBuffer;
+    size_t outBufferPtr, outBufferSize;
+
+    size_t chunkPtr;
+    uint8_t chunk[9];
+
+    uint8_t skipDetectBit;
+    uint8_t frameStarted;
+} write_state_t;
 
 // read_process_byte special return values:
 // Byte consumed, but state not changed
@@ -20,13 +47,13 @@ typedef struct write_state_struct write_state_t;
 // Keep feeding bytes
 #define NOT_COMPLETE ((size_t) -1)
 
-read_state_t* init_read_state(uint8_t* outBuffer, size_t outBufferSize);
-void deinit_read_state(read_state_t* s);
+void init_read_state(read_state_t* s, uint8_t* outBuffer, size_t outBufferSize);
 size_t read_reset_buffer(read_state_t* s);
 size_t read_process_byte(read_state_t* s, uint8_t byte);
+// Number of chunks repaired with parity since the last call
+size_t read_take_corrected(read_state_t* s);
 
-write_state_t* init_write_state(uint8_t* outBuffer, size_t outBufferSize);
-void deinit_write_state(write_state_t* s);
+void init_write_state(write_state_t* s, uint8_t* outBuffer, size_t outBufferSize);
 size_t write_reset_buffer(write_state_t* s);
 void write_process_bytes(write_state_t* s, const uint8_t* b, size_t cnt);
 size_t write_end_frame(write_state_t* s);
@@ -0,0 +1,506 @@
+#include "fec.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <pgmspace.h>
+
+
+// GF(256) with x^8 + x^4 + x^3 + x^2 + 1, 2 generates it
+#define GF_POLY 0x11D
+// In gf_tables_t::gen, for a coefficient of 0
+#define GF_LOG_ZERO 0xFF
+// Lone top bit repeats taken as skipped symbols, a frame with more is decoded as if there were none
+#define FEC_MAX_SKIPS 16
+
+struct gf_tables_t {
+    // exp[i] = 2^i, twice over so a sum of two logs needs no modulo
+    uint8_t exp[512];
+    uint8_t log[256];
+    // gen[p] - logs of the generator polynomial with roots 2^0..2^(p-1), highest power first without its leading 1
+    uint8_t gen[FEC_MAX_PARITY + 1][FEC_MAX_PARITY];
+};
+
+static constexpr gf_tables_t make_gf_tables() {
+    gf_tables_t ret = {};
+    uint32_t x = 1;
+    for (int i = 0; i < 255; i++) {
+        ret.exp[i] = x;
+        ret.exp[i + 255] = x;
+        ret.log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+
+    for (int p = 1; p <= FEC_MAX_PARITY; p++) {
+        // (x + 2^0)(x + 2^1)..., one factor at a time
+        uint8_t g[FEC_MAX_PARITY + 1] = {1};
+        for (int i = 0; i < p; i++)
+            for (int j = i + 1; j > 0; j--)
+                if (g[j - 1] != 0)
+                    g[j] ^= ret.exp[ret.log[g[j - 1]] + i];
+        for (int j = 0; j < p; j++)
+            ret.gen[p][j] = (g[j + 1] != 0) ? ret.log[g[j + 1]] : GF_LOG_ZERO;
+    }
+    return ret;
+}
+
+// Built at compile time into flash, 800 bytes the ESP8266 would otherwise keep in RAM
+static const gf_tables_t GF PROGMEM = make_gf_tables();
+
+static inline uint8_t gf_exp(uint32_t i) {
+    return pgm_read_byte(&GF.exp[i]);
+}
+
+static inline uint8_t gf_log(uint8_t a) {
+    return pgm_read_byte(&GF.log[a]);
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return ((a == 0) || (b == 0)) ? 0 : gf_exp(gf_log(a) + gf_log(b));
+}
+
+// a * 2^power, power < 255
+static inline uint8_t gf_mul_exp(uint8_t a, uint32_t power) {
+    return (a == 0) ? 0 : gf_exp(gf_log(a) + power);
+}
+
+static inline uint8_t gf_inv(uint8_t a) {
+    return gf_exp(255 - gf_log(a));
+}
+
+
+bool fec_profile_valid(uint8_t parity, uint8_t length) {
+    return (parity >= 1) && (parity <= FEC_MAX_PARITY) && (length <= FEC_MAX_CODEWORD) && ((2 * parity) <= length);
+}
+
+void fec_encode(const uint8_t* data, size_t dataLength, uint8_t parity, uint8_t* out) {
+    // Remainder of data * x^parity divided by the generator, as a shift register
+    uint8_t gen[FEC_MAX_PARITY];
+    memcpy_P(gen, GF.gen[parity], parity);
+    memset(out, 0, parity);
+    for (size_t i = 0; i < dataLength; i++) {
+        uint8_t feedback = data[i] ^ out[0];
+        if (feedback == 0) {
+            memmove(out, out + 1, parity - 1);
+            out[parity - 1] = 0;
+            continue;
+        }
+
+        uint8_t logFeedback = gf_log(feedback);
+        for (int j = 0; j < parity; j++) {
+            uint8_t next = (j + 1 < parity) ? out[j + 1] : 0;
+            out[j] = (gen[j] != GF_LOG_ZERO) ? (next ^ gf_exp(logFeedback + gen[j])) : next;
+        }
+    }
+}
+
+int fec_decode(uint8_t* codeword, size_t length, uint8_t parity, const uint8_t* erasures, size_t erasureCount) {
+    if (erasureCount > parity)
+        return -1;
+
+    // The codeword at 2^0..2^(parity-1), all 0 when it is intact
+    // Byte j is the coefficient of x^(length - 1 - j)
+    uint8_t syndromes[FEC_MAX_PARITY];
+    bool clean = true;
+    for (int i = 0; i < parity; i++) {
+        uint8_t s = 0;
+        for (size_t j = 0; j < length; j++)
+            s = gf_mul_exp(s, i) ^ codeword[j];
+        syndromes[i] = s;
+        clean = clean && (s == 0);
+    }
+    // Lost bytes that were right after all, no other codeword is that close
+    if (clean)
+        return 0;
+
+    // Locator of lost and wrong bytes, lowest power first, with a root at 2^-(length - 1 - j) for byte j
+    // Berlekamp-Massey, starting from the locator of the lost bytes
+    uint8_t lambda[FEC_MAX_PARITY + 1] = {1};
+    for (size_t k = 0; k < erasureCount; k++) {
+        uint32_t power = length - 1 - erasures[k];
+        for (size_t j = k + 1; j > 0; j--)
+            lambda[j] ^= gf_mul_exp(lambda[j - 1], power);
+    }
+
+    uint8_t prev[FEC_MAX_PARITY + 1];
+    memcpy(prev, lambda, sizeof(prev));
+    int degree = erasureCount;
+    for (int r = erasureCount; r < parity; r++) {
+        uint8_t delta = 0;
+        for (int i = 0; (i <= degree) && (i <= r); i++)
+            delta ^= gf_mul(lambda[i], syndromes[r - i]);
+
+        memmove(prev + 1, prev, parity);
+        prev[0] = 0;
+        if (delta == 0)
+            continue;
+
+        uint8_t next[FEC_MAX_PARITY + 1];
+        for (int i = 0; i <= parity; i++)
+            next[i] = lambda[i] ^ gf_mul(delta, prev[i]);
+        if ((2 * degree) <= (r + (int)erasureCount)) {
+            uint8_t inv = gf_inv(delta);
+            for (int i = 0; i <= parity; i++)
+                prev[i] = gf_mul(lambda[i], inv);
+            degree = r + 1 + erasureCount - degree;
+        }
+        memcpy(lambda, next, parity + 1);
+    }
+    if ((2 * degree - (int)erasureCount) > parity)
+        return -1;
+
+    // Evaluator, syndromes * lambda mod x^parity
+    uint8_t omega[FEC_MAX_PARITY];
+    for (int i = 0; i < parity; i++) {
+        omega[i] = 0;
+        for (int j = 0; (j <= i) && (j <= degree); j++)
+            omega[i] ^= gf_mul(lambda[j], syndromes[i - j]);
+    }
+
+    // Roots of the locator give the positions, Forney's formula the values
+    uint8_t positions[FEC_MAX_PARITY];
+    uint8_t values[FEC_MAX_PARITY];
+    int found = 0;
+    for (size_t j = 0; j < length; j++) {
+        uint32_t power = length - 1 - j;
+        uint32_t invPower = (255 - power) % 255;
+        uint8_t v = 0;
+        for (int i = degree; i >= 0; i--)
+            v = gf_mul_exp(v, invPower) ^ lambda[i];
+        if (v != 0)
+            continue;
+        if (found == degree)
+            return -1;
+
+        uint8_t num = 0;
+        for (int i = parity - 1; i >= 0; i--)
+            num = gf_mul_exp(num, invPower) ^ omega[i];
+        // Formal derivative, only odd powers are left
+        uint8_t den = 0;
+        for (int i = 1; i <= degree; i += 2)
+            den ^= gf_mul_exp(lambda[i], (invPower * (i - 1)) % 255);
+        if (den == 0)
+            return -1;
+
+        positions[found] = j;
+        values[found++] = gf_mul_exp(gf_mul(num, gf_inv(den)), power);
+    }
+    // Fewer roots than the degree means positions outside of the codeword
+    if (found != degree)
+        return -1;
+
+    int changed = 0;
+    for (int i = 0; i < found; i++) {
+        codeword[positions[i]] ^= values[i];
+        changed += (values[i] != 0);
+    }
+    return changed;
+}
+
+
+// Turns bytes into 7 bit symbols with the alternating top bit, escapes them and passes them on in pieces
+class SymbolWriter {
+public:
+    SymbolWriter(void (*write)(const uint8_t* data, size_t len)) : out(write), len(0), phase(0), bits(0), bitCount(0) {}
+
+    void put_raw(uint8_t b) {
+        buffer[len++] = b;
+        if (len == sizeof(buffer))
+            flush();
+    }
+
+    void put_byte(uint8_t b) {
+        bits = (bits << 8) | b;
+        bitCount += 8;
+        while (bitCount >= 7) {
+            bitCount -= 7;
+            put_symbol(bits >> bitCount);
+        }
+    }
+
+    // Pads the last symbol with zero bits
+    void finish_bits() {
+        if (bitCount > 0)
+            put_symbol(bits << (7 - bitCount));
+        bitCount = 0;
+    }
+
+    void flush() {
+        if (len > 0)
+            out(buffer, len);
+        len = 0;
+    }
+
+private:
+    void put_symbol(uint32_t symbol) {
+        uint8_t b = (symbol & 0x7F) | phase;
+        phase ^= 0x80;
+        if ((b == FEC_FRAME_START) || (b == FEC_FRAME_END) || (b == FEC_ESC)) {
+            put_raw(FEC_ESC);
+            b ^= FEC_ESC_XOR;
+        }
+        put_raw(b);
+    }
+
+    void (*out)(const uint8_t* data, size_t len);
+    uint8_t buffer[32];
+    size_t len;
+    uint8_t phase;
+    uint32_t bits;
+    uint8_t bitCount;
+};
+
+// The other way around, with a lost symbol put back in front of every raw index in skipAt
+class SymbolReader {
+public:
+    SymbolReader(const uint8_t* symbols, size_t count, const uint16_t* skipAt, size_t skips)
+        : symbols(symbols), count(count), skipAt(skipAt), skips(skips), raw(0), skipIdx(0), bits(0), lostBits(0), bitCount(0) {}
+
+    // lost is set if any bit of the byte came from a lost symbol. Returns false once the symbols run out
+    bool next_byte(uint8_t* byte, bool* lost) {
+        while (bitCount < 8) {
+            uint8_t symbol = 0;
+            uint8_t lostMask = 0;
+            if ((skipIdx < skips) && (skipAt[skipIdx] == raw)) {
+                skipIdx++;
+                lostMask = 0x7F;
+            } else if (raw < count) {
+                symbol = symbols[raw++] & 0x7F;
+            } else {
+                return false;
+            }
+            bits = (bits << 7) | symbol;
+            lostBits = (lostBits << 7) | lostMask;
+            bitCount += 7;
+        }
+
+        bitCount -= 8;
+        *byte = bits >> bitCount;
+        *lost = (uint8_t)(lostBits >> bitCount) != 0;
+        return true;
+    }
+
+    size_t symbols_left() const {
+        return (count - raw) + (skips - skipIdx);
+    }
+
+private:
+    const uint8_t* symbols;
+    size_t count;
+    const uint16_t* skipAt;
+    size_t skips;
+    size_t raw, skipIdx;
+    uint32_t bits, lostBits;
+    uint8_t bitCount;
+};
+
+
+FecEncoder::FecEncoder() : parityCount(FEC_PARITY), codewordLength(FEC_CODEWORD), frameLen(0) {
+    if (!fec_profile_valid(parityCount, codewordLength)) {
+        parityCount = 2;
+        codewordLength = 16;
+    }
+}
+
+bool FecEncoder::set_profile(uint8_t parity, uint8_t length) {
+    if (!fec_profile_valid(parity, length))
+        return false;
+    parityCount = parity;
+    codewordLength = length;
+    return true;
+}
+
+void FecEncoder::begin() {
+    frameLen = 0;
+}
+
+void FecEncoder::add(const uint8_t* data, size_t len) {
+    size_t n = std::min(len, sizeof(frame) - frameLen);
+    memcpy(&frame[frameLen], data, n);
+    frameLen += n;
+}
+
+size_t FecEncoder::max_encoded_size(size_t frameLength) const {
+    size_t dataPerCodeword = codewordLength - parityCount;
+    size_t count = (frameLength + dataPerCodeword - 1) / dataPerCodeword;
+    size_t symbols = FEC_HEADER_SYMBOLS + ((frameLength + count * parityCount) * 8 + 6) / 7;
+    // Every symbol might need escaping, plus start and end
+    return symbols * 2 + 2;
+}
+
+void FecEncoder::end(void (*write)(const uint8_t* data, size_t len)) {
+    if (frameLen == 0)
+        return;
+
+    // Frame bytes are spread evenly, the first frameLen % count codewords get one more
+    uint8_t p = parityCount;
+    size_t dataPerCodeword = codewordLength - p;
+    size_t count = (frameLen + dataPerCodeword - 1) / dataPerCodeword;
+    size_t shortData = frameLen / count;
+    size_t longCount = frameLen % count;
+    for (size_t i = 0; i < count; i++)
+        fec_encode(&frame[i * shortData + std::min(i, longCount)], shortData + (i < longCount), p, &parity[i * p]);
+
+    SymbolWriter out(write);
+    out.put_raw(FEC_FRAME_START);
+
+    uint8_t header[FEC_HEADER_SIZE + FEC_HEADER_PARITY] = {codewordLength, (uint8_t)(p | ((frameLen >> 8) << 4)), (uint8_t)frameLen};
+    fec_encode(header, FEC_HEADER_SIZE, FEC_HEADER_PARITY, &header[FEC_HEADER_SIZE]);
+    for (size_t i = 0; i < sizeof(header); i++)
+        out.put_byte(header[i]);
+
+    // Row by row, only the longer codewords have a byte in the last row
+    size_t rows = shortData + p + ((longCount > 0) ? 1 : 0);
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t i = 0; i < count; i++) {
+            size_t dataLen = shortData + (i < longCount);
+            if (row < dataLen)
+                out.put_byte(frame[i * shortData + std::min(i, longCount) + row]);
+            else if (row < (dataLen + p))
+                out.put_byte(parity[i * p + row - dataLen]);
+        }
+    }
+    out.finish_bits();
+
+    out.put_raw(FEC_FRAME_END);
+    out.flush();
+}
+
+
+FecDecoder::FecDecoder() : corrected(0) {
+    begin();
+}
+
+void FecDecoder::begin() {
+    escaping = false;
+    overflow = false;
+    symbolCount = 0;
+}
+
+void FecDecoder::add(uint8_t byte) {
+    if (byte == FEC_ESC) {
+        escaping = true;
+        return;
+    }
+    if (escaping) {
+        escaping = false;
+        byte ^= FEC_ESC_XOR;
+    }
+
+    if (symbolCount < sizeof(symbols))
+        symbols[symbolCount++] = byte;
+    else
+        overflow = true;
+}
+
+uint32_t FecDecoder::take_corrected() {
+    uint32_t ret = corrected;
+    corrected = 0;
+    return ret;
+}
+
+int FecDecoder::finish(uint8_t* out, size_t outSize) {
+    if (overflow)
+        return -1;
+
+    // A symbol with the same top bit as the one before it comes right after a skipped one,
+    // unless the next one repeats it as well, then its top bit was flipped
+    uint16_t skipAt[FEC_MAX_SKIPS];
+    size_t skips = 0;
+    bool tooMany = false;
+    for (size_t s = 0; s < symbolCount; s++) {
+        uint8_t prevPhase = (s > 0) ? (symbols[s - 1] & 0x80) : 0x80;
+        if ((symbols[s] & 0x80) != prevPhase)
+            continue;
+        if (((s + 1) < symbolCount) && ((symbols[s + 1] & 0x80) == (symbols[s] & 0x80))) {
+            s++;
+            continue;
+        }
+        if (skips == FEC_MAX_SKIPS) {
+            tooMany = true;
+            break;
+        }
+        skipAt[skips++] = s;
+    }
+
+    // Inserted bytes look like skips too, the symbol count tells which guess was right
+    int ret = -1;
+    if ((skips > 0) && !tooMany)
+        ret = decode(out, outSize, skipAt, skips);
+    if (ret < 0)
+        ret = decode(out, outSize, NULL, 0);
+    return ret;
+}
+
+int FecDecoder::decode(uint8_t* out, size_t outSize, const uint16_t* skipAt, size_t skips) {
+    SymbolReader in(symbols, symbolCount, skipAt, skips);
+
+    uint8_t header[FEC_HEADER_SIZE + FEC_HEADER_PARITY];
+    uint8_t lost[FEC_MAX_PARITY];
+    size_t lostCount = 0;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        bool isLost;
+        if (!in.next_byte(&header[i], &isLost))
+            return -1;
+        if (isLost) {
+            if (lostCount == FEC_HEADER_PARITY)
+                return -1;
+            lost[lostCount++] = i;
+        }
+    }
+    if (fec_decode(header, sizeof(header), FEC_HEADER_PARITY, lost, lostCount) < 0)
+        return -1;
+
+    uint8_t length = header[0];
+    uint8_t parity = header[1] & 0x0F;
+    size_t frameLength = ((header[1] >> 4) << 8) | header[2];
+    if (!fec_profile_valid(parity, length) || (frameLength == 0) || (frameLength > std::min(outSize, (size_t)FEC_MAX_RX_FRAME)))
+        return -1;
+
+    size_t dataPerCodeword = length - parity;
+    size_t count = (frameLength + dataPerCodeword - 1) / dataPerCodeword;
+    size_t shortData = frameLength / count;
+    size_t longCount = frameLength % count;
+    size_t bodyLen = frameLength + count * parity;
+    // Anything else means bytes were inserted, or the skips were guessed wrong
+    if (in.symbols_left() != ((bodyLen * 8 + 6) / 7))
+        return -1;
+
+    memset(erased, 0, (bodyLen + 7) / 8);
+    for (size_t t = 0; t < bodyLen; t++) {
+        bool isLost = false;
+        in.next_byte(&body[t], &isLost);
+        if (isLost)
+            erased[t / 8] |= 1 << (t % 8);
+    }
+
+    uint32_t repaired = 0;
+    size_t shortLen = shortData + parity;
+    for (size_t i = 0; i < count; i++) {
+        size_t dataLen = shortData + (i < longCount);
+        uint8_t codeword[FEC_MAX_CODEWORD];
+        lostCount = 0;
+        for (size_t j = 0; j < (dataLen + parity); j++) {
+            size_t t = (j < shortLen) ? (j * count + i) : (shortLen * count + i);
+            codeword[j] = body[t];
+            if (erased[t / 8] & (1 << (t % 8))) {
+                if (lostCount == parity)
+                    return -1;
+                lost[lostCount++] = j;
+            }
+        }
+
+        int ret = fec_decode(codeword, dataLen + parity, parity, lost, lostCount);
+        if (ret < 0)
+            return -1;
+        if (ret > 0)
+            repaired++;
+        memcpy(&out[i * shortData + std::min(i, longCount)], codeword, dataLen);
+    }
+
+    corrected += repaired;
+    return frameLength;
+}
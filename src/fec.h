@@ -0,0 +1,116 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "framing_profile.h"
+
+// Forward error correction for FRAMING_FEC(see packet_framing.h)
+// A frame(type..CRC, the bytes FRAMING_PREAMBLE sends after the sync bytes) is split into codewords of a
+// Reed-Solomon code over GF(256): up to length - parity bytes of the frame followed by parity bytes
+// A codeword corrects e wrong and f lost bytes as long as 2e + f <= parity, so the overhead is parity/length
+// Codewords are sent interleaved, byte j of every codeword before byte j + 1 of any, so a burst of errors is spread over all of them
+// Bytes go out 7 bits at a time with the top bit alternating, like dumb_serial, so a skipped byte shows up as
+// two in a row with the same top bit and the bits it carried can be decoded as lost instead of wrong
+// Line format: FEC_FRAME_START, header(8 symbols), codewords(ceil(bytes * 8 / 7) symbols), FEC_FRAME_END
+// Header: codeword length(1), parity | frame length >> 8 << 4(1), frame length(1), FEC_HEADER_PARITY parity bytes
+// Every frame names its profile, so each side picks its own and can change it at any time
+// host/fec.py has the same code
+
+#define FEC_FRAME_START ((uint8_t)0xE7)
+#define FEC_FRAME_END ((uint8_t)0xE8)
+// Escaped as FEC_ESC, byte ^ FEC_ESC_XOR. All three keep the top bit, which the escape doesn't change
+#define FEC_ESC ((uint8_t)0xDB)
+#define FEC_ESC_XOR 0x20
+
+#define FEC_HEADER_SIZE 3
+#define FEC_HEADER_PARITY 4
+// 7 bytes fit 8 symbols exactly
+#define FEC_HEADER_SYMBOLS 8
+
+// Profile limits, parity can't be more than half the codeword
+#define FEC_MAX_PARITY 8
+#define FEC_MAX_CODEWORD 64
+// Defaults for what the dongle sends, CONFIG_FEC changes them at runtime
+#ifndef FEC_PARITY
+#define FEC_PARITY 2
+#endif
+#ifndef FEC_CODEWORD
+#define FEC_CODEWORD 16
+#endif
+
+// Longest frames either side takes
+#ifndef FEC_MAX_TX_FRAME
+#define FEC_MAX_TX_FRAME 1024
+#endif
+#ifndef FEC_MAX_RX_FRAME
+#define FEC_MAX_RX_FRAME FRAME_BUFFER_SIZE
+#endif
+
+// Frame and parity bytes of a frame of this length, with parity at most half of every codeword
+#define FEC_MAX_BODY(frameLength) (2 * (frameLength) + FEC_MAX_CODEWORD)
+#define FEC_MAX_SYMBOLS(frameLength) (FEC_HEADER_SYMBOLS + (FEC_MAX_BODY(frameLength) * 8 + 6) / 7)
+
+bool fec_profile_valid(uint8_t parity, uint8_t length);
+
+// Parity bytes of one codeword, data is the first length - parity bytes of it
+void fec_encode(const uint8_t* data, size_t dataLength, uint8_t parity, uint8_t* out);
+// Corrects a codeword of length bytes in place, erasures - positions of bytes known to be lost
+// Returns the number of bytes it changed, -1 if there were too many errors
+int fec_decode(uint8_t* codeword, size_t length, uint8_t parity, const uint8_t* erasures, size_t erasureCount);
+
+class FecEncoder {
+public:
+    FecEncoder();
+
+    // Returns false and keeps the old profile if it is out of range
+    bool set_profile(uint8_t parity, uint8_t length);
+    uint8_t get_parity() const { return parityCount; }
+    uint8_t get_length() const { return codewordLength; }
+
+    // The frame is collected first, interleaving needs all of it
+    // Anything past FEC_MAX_TX_FRAME is dropped, which breaks the frame's CRC
+    void begin();
+    void add(const uint8_t* data, size_t len);
+    // Encodes the frame and passes it to write in pieces
+    void end(void (*write)(const uint8_t* data, size_t len));
+
+    // Upper bound for what end passes to write for a frame of this length
+    size_t max_encoded_size(size_t frameLength) const;
+
+private:
+    uint8_t parityCount, codewordLength;
+    uint16_t frameLen;
+    uint8_t frame[FEC_MAX_TX_FRAME];
+    uint8_t parity[FEC_MAX_TX_FRAME + FEC_MAX_CODEWORD];
+};
+
+class FecDecoder {
+public:
+    FecDecoder();
+
+    // Call on FEC_FRAME_START
+    void begin();
+    // Every byte after FEC_FRAME_START up to FEC_FRAME_END
+    void add(uint8_t byte);
+    // Decodes the frame into out, returns its length or -1 if it was broken beyond repair
+    int finish(uint8_t* out, size_t outSize);
+
+    // Codewords that needed repairs since the last call
+    uint32_t take_corrected();
+
+private:
+    int decode(uint8_t* out, size_t outSize, const uint16_t* skipAt, size_t skips);
+
+    bool escaping, overflow;
+    uint16_t symbolCount;
+    uint32_t corrected;
+    // Symbols as they came in, top bit included
+    uint8_t symbols[FEC_MAX_SYMBOLS(FEC_MAX_RX_FRAME)];
+    // Codeword bytes in line order, and which ones are lost
+    uint8_t body[FEC_MAX_BODY(FEC_MAX_RX_FRAME)];
+    uint8_t erased[(FEC_MAX_BODY(FEC_MAX_RX_FRAME) + 7) / 8];
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef FRAMING_PROFILE_H
+#define FRAMING_PROFILE_H
+
+#include <IPAddress.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// What a serial frame carries and how it is laid out, fixed at compile time. Host and dongle have to agree on it
+// The named profiles are in framing_profiles.json: scripts/framing_profile.py turns custom_framing_profile of a
+// platformio.ini environment into these defines, slime_ap.py --profile reads the same file
+// The defaults below are the "default" profile
+
+// Largest payload of a DATA or FRAGMENT frame, longer datagrams are fragmented. Sizes most of the buffers
+#ifndef FRAGMENT_SIZE
+#define FRAGMENT_SIZE 256
+#endif
+// Longest datagram the host may send to a tracker, in fragments of FRAGMENT_SIZE
+// Every fragment takes a buffer of pbufPool until the datagram is sent, see PBUF_POOL_SLOTS
+#ifndef FRAME_MAX_DATAGRAM_SIZE
+#define FRAME_MAX_DATAGRAM_SIZE 2048
+#endif
+// Tracker address: 1 - last byte of 192.168.4.x, 4 - the whole IPv4 address
+#ifndef FRAME_ADDRESS_SIZE
+#define FRAME_ADDRESS_SIZE 1
+#endif
+// Each port: 2 - as it is, 1 - offset from FRAME_PORT_BASE, datagrams from or to other ports can't be framed
+#ifndef FRAME_PORT_SIZE
+#define FRAME_PORT_SIZE 2
+#endif
+#ifndef FRAME_PORT_BASE
+#define FRAME_PORT_BASE 0
+#endif
+// 1 - FRAMING_FEC can be used(see fec.h), 0 - leaves out its encoder and decoder buffers, about 3.6KB of RAM
+#ifndef FRAME_FEC
+#define FRAME_FEC 1
+#endif
+// The checksum is CRC16_POLY in crc16.h
+
+static_assert((FRAME_ADDRESS_SIZE == 1) || (FRAME_ADDRESS_SIZE == 4), "FRAME_ADDRESS_SIZE has to be 1 or 4");
+static_assert((FRAME_PORT_SIZE == 1) || (FRAME_PORT_SIZE == 2), "FRAME_PORT_SIZE has to be 1 or 2");
+static_assert((FRAGMENT_SIZE >= 16) && (FRAGMENT_SIZE <= 1024), "FRAGMENT_SIZE is out of range");
+static_assert((FRAME_MAX_DATAGRAM_SIZE >= FRAGMENT_SIZE) && (FRAME_MAX_DATAGRAM_SIZE <= 65507), "FRAME_MAX_DATAGRAM_SIZE is out of range");
+
+// Fragments of the longest datagram from the host
+#define FRAME_MAX_FRAGMENTS ((FRAME_MAX_DATAGRAM_SIZE + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE)
+
+// Address, local port, remote port as they are in DATA and FRAGMENT headers and delta keyframes
+#define FRAME_ADDRESSING_SIZE (FRAME_ADDRESS_SIZE + 2 * FRAME_PORT_SIZE)
+// Longest frame the parser takes: type, length, sequence number, timestamps, FRAGMENT header, payload and CRC
+#define FRAME_BUFFER_SIZE ((size_t)(5 + 8 + FRAME_ADDRESSING_SIZE + 5 + FRAGMENT_SIZE + 2))
+
+// The bytes of the IPv4 address in order, read as a little endian number
+#if FRAME_ADDRESS_SIZE == 4
+typedef uint32_t frame_address_t;
+#else
+typedef uint8_t frame_address_t;
+#endif
+
+// Tracker addresses as frames carry them
+static inline frame_address_t frame_address(const IPAddress& ip) {
+#if FRAME_ADDRESS_SIZE == 4
+    return ip[0] | (ip[1] << 8) | (ip[2] << 16) | ((uint32_t)ip[3] << 24);
+#else
+    return ip[3]; // This is the only byte that should actually change
+#endif
+}
+
+static inline IPAddress frame_address_ip(frame_address_t address) {
+#if FRAME_ADDRESS_SIZE == 4
+    return IPAddress(address, address >> 8, address >> 16, address >> 24);
+#else
+    return IPAddress(192, 168, 4, address);
+#endif
+}
+
+// Last byte of the address, the one telemetry tells trackers apart by
+static inline uint8_t frame_address_last_byte(frame_address_t address) {
+    return (uint8_t)(address >> (8 * (FRAME_ADDRESS_SIZE - 1)));
+}
+
+static inline bool frame_port_fits(uint16_t port) {
+#if FRAME_PORT_SIZE == 1
+    return (port >= FRAME_PORT_BASE) && (port <= (FRAME_PORT_BASE + 0xFF));
+#else
+    (void)port;
+    return true;
+#endif
+}
+
+// Both write or read one field and return the bytes after it, little endian like the rest of the frame
+static inline uint8_t* put_frame_address(uint8_t* ptr, frame_address_t address) {
+    memcpy(ptr, &address, FRAME_ADDRESS_SIZE);
+    return ptr + FRAME_ADDRESS_SIZE;
+}
+
+static inline const uint8_t* get_frame_address(const uint8_t* ptr, frame_address_t* address) {
+    memcpy(address, ptr, FRAME_ADDRESS_SIZE);
+    return ptr + FRAME_ADDRESS_SIZE;
+}
+
+// Ports that don't fit have to be filtered out before, see frame_port_fits
+static inline uint8_t* put_frame_ports(uint8_t* ptr, uint16_t localPort, uint16_t remotePort) {
+#if FRAME_PORT_SIZE == 1
+    ptr[0] = (uint8_t)(localPort - FRAME_PORT_BASE);
+    ptr[1] = (uint8_t)(remotePort - FRAME_PORT_BASE);
+#else
+    memcpy(ptr, &localPort, 2);
+    memcpy(ptr + 2, &remotePort, 2);
+#endif
+    return ptr + 2 * FRAME_PORT_SIZE;
+}
+
+static inline const uint8_t* get_frame_ports(const uint8_t* ptr, uint16_t* localPort, uint16_t* remotePort) {
+#if FRAME_PORT_SIZE == 1
+    *localPort = FRAME_PORT_BASE + ptr[0];
+    *remotePort = FRAME_PORT_BASE + ptr[1];
+#else
+    memcpy(localPort, ptr, 2);
+    memcpy(remotePort, ptr + 2, 2);
+#endif
+    return ptr + 2 * FRAME_PORT_SIZE;
+}
+
+static inline uint8_t* put_frame_addressing(uint8_t* ptr, frame_address_t address, uint16_t localPort, uint16_t remotePort) {
+    return put_frame_ports(put_frame_address(ptr, address), localPort, remotePort);
+}
+
+static inline const uint8_t* get_frame_addressing(const uint8_t* ptr, frame_address_t* address, uint16_t* localPort, uint16_t* remotePort) {
+    return get_frame_ports(get_frame_address(ptr, address), localPort, remotePort);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#include "histogram.h"
+
+#include <memory.h>
+
+
+void Histogram::reset() {
+    memset(buckets, 0, sizeof(buckets));
+    total = 0;
+    minValue = UINT32_MAX;
+    maxValue = 0;
+}
+
+void Histogram::add(uint32_t value) {
+    uint32_t idx = bucket_index(value);
+    if (buckets[idx] < UINT32_MAX)
+        buckets[idx]++;
+    total++;
+    if (value < minValue)
+        minValue = value;
+    if (value > maxValue)
+        maxValue = value;
+}
+
+uint32_t Histogram::percentile(uint32_t p) {
+    if (total == 0)
+        return 0;
+
+    uint32_t target = ((uint64_t)total * p + 99) / 100;
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            // Next bucket starts right after this one ends
+            uint32_t high = (i + 1 < HISTOGRAM_BUCKETS) ? (bucket_low(i + 1) - 1) : maxValue;
+            return (high < maxValue) ? high : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+uint32_t Histogram::bucket_index(uint32_t value) {
+    if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+        return value;
+
+    uint32_t msb = 31 - __builtin_clz(value);
+    uint32_t sub = (value >> (msb - 2)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    uint32_t idx = (msb - 1) * HISTOGRAM_SUB_BUCKETS + sub;
+    return (idx < HISTOGRAM_BUCKETS) ? idx : (HISTOGRAM_BUCKETS - 1);
+}
+
+uint32_t Histogram::bucket_low(uint32_t index) {
+    if (index < 2 * HISTOGRAM_SUB_BUCKETS)
+        return index;
+
+    uint32_t msb = index / HISTOGRAM_SUB_BUCKETS + 1;
+    uint32_t sub = index % HISTOGRAM_SUB_BUCKETS;
+    return (HISTOGRAM_SUB_BUCKETS + sub) << (msb - 2);
+}
@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear histogram: values below 8 are exact, above that every power of two is split into 4 buckets(~19% wide)
+// Goes up to 2^24, everything above lands in the last bucket. Counts saturate at 2^32-1
+#define HISTOGRAM_SUB_BUCKETS 4
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * 24)
+
+class Histogram {
+public:
+    Histogram() { reset(); }
+
+    void reset();
+    void add(uint32_t value);
+
+    uint32_t count() { return total; }
+    uint32_t min_value() { return total ? minValue : 0; }
+    uint32_t max_value() { return maxValue; }
+    // Upper bound of the bucket holding the given percentile(0-100)
+    uint32_t percentile(uint32_t p);
+
+    uint32_t bucket_count(uint32_t index) { return buckets[index]; }
+    // Smallest value that lands in the bucket
+    static uint32_t bucket_low(uint32_t index);
+
+private:
+    static uint32_t bucket_index(uint32_t value);
+
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t total;
+    uint32_t minValue, maxValue;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "latency.h"
+
+#include <stddef.h>
+
+#include "histogram.h"
+
+
+#ifdef LATENCY_STATS
+
+static Histogram hops[LATENCY_HOP_COUNT];
+// Smallest clock difference seen this window, per hop
+static int32_t transitBase[LATENCY_HOP_COUNT];
+static bool transitBaseValid[LATENCY_HOP_COUNT];
+static bool reportPending;
+static LatencyHopReport report[LATENCY_HOP_COUNT];
+
+void latency_add(LatencyHop hop, uint32_t us) {
+    hops[hop].add(us);
+}
+
+void latency_add_transit(LatencyHop hop, uint32_t sentUs, uint32_t receivedUs) {
+    int32_t diff = (int32_t)(receivedUs - sentUs);
+    if (!transitBaseValid[hop] || (diff < transitBase[hop])) {
+        transitBase[hop] = diff;
+        transitBaseValid[hop] = true;
+    }
+    hops[hop].add(diff - transitBase[hop]);
+}
+
+bool latency_report() {
+    reportPending = true;
+    return true;
+}
+
+uint16_t latency_pending() {
+    return reportPending ? sizeof(report) : 0;
+}
+
+const uint8_t* latency_take(uint16_t* outputLength) {
+    for (int i = 0; i < LATENCY_HOP_COUNT; i++) {
+        Histogram& h = hops[i];
+        report[i].count = h.count();
+        report[i].p50Us = h.percentile(50);
+        report[i].p99Us = h.percentile(99);
+        report[i].maxUs = h.max_value();
+        h.reset();
+        transitBaseValid[i] = false;
+    }
+    reportPending = false;
+    *outputLength = sizeof(report);
+    return (const uint8_t*)report;
+}
+
+#else
+
+bool latency_report() {
+    return false;
+}
+
+uint16_t latency_pending() {
+    return 0;
+}
+
+const uint8_t* latency_take(uint16_t* outputLength) {
+    *outputLength = 0;
+    return NULL;
+}
+
+#endif
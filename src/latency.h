@@ -0,0 +1,43 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Per hop latency histograms, enabled with -DLATENCY_STATS
+// With it enabled, data and batch frames sent to the host carry timestamps(see FRAME_FLAG_TIMESTAMPS)
+enum LatencyHop : uint8_t {
+    // Datagram received from WiFi -> its frame fully written to serial(oldest datagram for batches)
+    HOP_UDP_TO_SERIAL,
+    // Host serial TX -> frame parsed here
+    // Clocks aren't synchronized, so this is relative to the fastest frame in the current window
+    HOP_SERIAL_TRANSIT,
+    // Frame parsed -> datagram handed to WiFi
+    HOP_SERIAL_TO_UDP,
+    LATENCY_HOP_COUNT
+};
+
+#ifdef LATENCY_STATS
+void latency_add(LatencyHop hop, uint32_t us);
+// For hops that cross from the host clock to ours
+void latency_add_transit(LatencyHop hop, uint32_t sentUs, uint32_t receivedUs);
+#else
+inline void latency_add(LatencyHop hop, uint32_t us) {}
+inline void latency_add_transit(LatencyHop hop, uint32_t sentUs, uint32_t receivedUs) {}
+#endif
+
+// TELEMETRY_LATENCY payload(see telemetry.h): one of these for each hop, host/slime_ap.py has the hop names
+struct __attribute__((packed)) LatencyHopReport {
+    uint32_t count;
+    uint32_t p50Us, p99Us, maxUs;
+};
+
+// Asks for a report, false without LATENCY_STATS
+// The window ends when the report is taken, so one asked for again before that isn't lost
+bool latency_report();
+// Size of the payload latency_take would return now, 0 if there is nothing to send
+uint16_t latency_pending();
+// Returned pointer - TELEMETRY_LATENCY payload of length outputLength, valid until the next call
+// Starts a new window
+const uint8_t* latency_take(uint16_t* outputLength);
+
+#endif
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+
+#include "log.h"
+#include "ring_buffer.h"
+
+
+struct LogSite {
+    bool logged;
+    uint8_t level;
+    uint16_t suppressed;
+    uint32_t lastMs;
+};
+
+static RingBuffer<LOG_RING_SIZE> ring;
+static LogSite sites[LOG_ID_COUNT];
+// Some site has suppressed records to report
+static bool suppressedPending = false;
+static uint16_t droppedRecords = 0;
+static uint8_t frameBuffer[2 + LOG_RING_SIZE];
+
+static void ring_write(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t space = 0;
+        uint8_t* ptr = ring.write_span(&space);
+        size_t n = std::min(len, space);
+        memcpy(ptr, data, n);
+        ring.commit_write(n);
+        data += n;
+        len -= n;
+    }
+}
+
+static bool write_record(uint8_t level, LogId id, uint32_t timeMs, uint8_t argCount, const uint32_t* args) {
+    uint8_t header[6] = {id, (uint8_t)((level << 4) | argCount)};
+    memcpy(&header[2], &timeMs, 4);
+
+    if (ring.space() < (sizeof(header) + argCount * 4)) {
+        if (droppedRecords < 0xFFFF)
+            droppedRecords++;
+        return false;
+    }
+    ring_write(header, sizeof(header));
+    ring_write((const uint8_t*)args, argCount * 4);
+    return true;
+}
+
+void log_add(uint8_t level, LogId id, uint8_t argCount, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    LogSite& s = sites[id];
+    uint32_t now = millis();
+    if (s.logged && ((now - s.lastMs) < LOG_SITE_INTERVAL_MS)) {
+        if (s.suppressed < 0xFFFF)
+            s.suppressed++;
+        suppressedPending = true;
+        return;
+    }
+
+    s.logged = true;
+    s.level = level;
+    s.lastMs = now;
+    uint32_t args[LOG_MAX_ARGS] = {arg0, arg1, arg2, arg3};
+    write_record(level, id, now, argCount, args);
+}
+
+void log_update() {
+    if (!suppressedPending)
+        return;
+
+    uint32_t now = millis();
+    suppressedPending = false;
+    for (int i = 0; i < LOG_ID_COUNT; i++) {
+        LogSite& s = sites[i];
+        if (s.suppressed == 0)
+            continue;
+        uint32_t args[2] = {(uint32_t)i, s.suppressed};
+        // Kept for the next call if it is too early or the ring is full
+        if (((now - s.lastMs) >= LOG_SITE_INTERVAL_MS) && write_record(s.level, LOG_SUPPRESSED, now, 2, args))
+            s.suppressed = 0;
+        else
+            suppressedPending = true;
+    }
+}
+
+uint16_t log_pending() {
+    if ((ring.available() == 0) && (droppedRecords == 0))
+        return 0;
+    return 2 + ring.available();
+}
+
+const uint8_t* log_take(uint16_t* outputLength) {
+    memcpy(frameBuffer, &droppedRecords, 2);
+    droppedRecords = 0;
+
+    uint16_t len = 2;
+    size_t n = 0;
+    const uint8_t* ptr;
+    while ((ptr = ring.read_span(&n)), n > 0) {
+        memcpy(&frameBuffer[len], ptr, n);
+        ring.commit_read(n);
+        len += n;
+    }
+
+    *outputLength = len;
+    return frameBuffer;
+}
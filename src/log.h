@@ -0,0 +1,71 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+// Log messages for the host, sent as FRAME_TYPE_LOG frames(see packet_framing.h) instead of printf text
+// LOG() only stores the message id and its arguments in a RAM ring, the host has the format strings and does the formatting
+// The ring is only sent when the loop has nothing else to do, a full ring drops new records
+// Each message id is logged from one place and at most once every LOG_SITE_INTERVAL_MS, the ones skipped in between
+// are counted and reported with LOG_SUPPRESSED
+// Record: id(1), level(high 4 bits) and argument count(low 4 bits)(1), millis()(4), arguments(4 each)
+// Frame payload: records dropped since the previous frame(2), records
+// host/slime_ap.py has the format strings(LOG_MESSAGES), keep the two in sync
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+// Lower levels are compiled out
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
+// Bytes of records, also the largest LOG frame payload
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 256
+#endif
+#ifndef LOG_SITE_INTERVAL_MS
+#define LOG_SITE_INTERVAL_MS 1000
+#endif
+
+#define LOG_MAX_ARGS 4
+
+enum LogId : uint8_t {
+    // Records of one id skipped because of the rate limit. Arguments: id, count
+    LOG_SUPPRESSED,
+    // Serial frame with a wrong CRC. Arguments: expected CRC, received CRC, frame type, length
+    LOG_CRC_MISMATCH,
+    // Serial frame header claims more than FRAGMENT_SIZE. Arguments: frame type, length
+    LOG_FRAME_TOO_LONG,
+    // dumb_serial frame that doesn't match its header. Arguments: decoded length, frame type
+    LOG_CODEC_BAD_FRAME,
+    // Arguments: baud rate gone back to
+    LOG_BAUD_NOT_CONFIRMED,
+    // Arguments: failed baud rate, baud rate gone back to
+    LOG_BAUD_FALLBACK,
+    LOG_ID_COUNT
+};
+
+// Up to LOG_MAX_ARGS arguments, all stored as uint32_t
+#define LOG(level, id, ...) do { \
+        if ((level) >= LOG_MIN_LEVEL) \
+            log_add((level), (id), LOG_ARG_COUNT(__VA_ARGS__), ##__VA_ARGS__); \
+    } while (0)
+
+#define LOG_ARG_COUNT(...) LOG_ARG_COUNT_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define LOG_ARG_COUNT_(_0, _1, _2, _3, _4, n, ...) n
+
+// Use LOG() instead
+void log_add(uint8_t level, LogId id, uint8_t argCount, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0, uint32_t arg3 = 0);
+
+// Queues LOG_SUPPRESSED records for ids that weren't logged for LOG_SITE_INTERVAL_MS, call from the loop
+void log_update();
+
+// Size of the payload log_take would return now, 0 if there is nothing to send
+uint16_t log_pending();
+// Returned pointer - FRAME_TYPE_LOG payload of length outputLength, valid until the next call
+// Empties the ring
+const uint8_t* log_take(uint16_t* outputLength);
+
+#endif
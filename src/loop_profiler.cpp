@@ -0,0 +1,94 @@
+#include "loop_profiler.h"
+
+#include <string.h>
+
+
+#ifdef LOOP_PROFILER
+
+static Histogram stages[PROFILE_STAGE_COUNT];
+static uint64_t stageCycles[PROFILE_STAGE_COUNT];
+static uint32_t windowStartUs;
+// Stage profile_take sends next, PROFILE_STAGE_COUNT when no report is going out
+static uint8_t reportStage = PROFILE_STAGE_COUNT;
+static uint32_t reportWindowUs;
+static uint8_t reportBuffer[PROFILE_REPORT_MAX_SIZE];
+
+void profile_add(ProfileStage stage, uint32_t cycles) {
+    if (reportStage < PROFILE_STAGE_COUNT)
+        return;
+    stages[stage].add(cycles);
+    stageCycles[stage] += cycles;
+}
+
+bool profile_report() {
+    if (reportStage < PROFILE_STAGE_COUNT)
+        return true;
+    reportWindowUs = micros() - windowStartUs;
+    reportStage = 0;
+    return true;
+}
+
+uint16_t profile_pending() {
+    if (reportStage >= PROFILE_STAGE_COUNT)
+        return 0;
+    uint16_t len = sizeof(ProfileStageReport);
+    Histogram& h = stages[reportStage];
+    for (uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+        if (h.bucket_count(b) > 0)
+            len += 5;
+    return len;
+}
+
+const uint8_t* profile_take(uint16_t* outputLength) {
+    uint8_t i = reportStage;
+    Histogram& h = stages[i];
+    // Cycles wrap every ~53s at 80MHz, micros() doesn't
+    uint64_t windowCycles = (uint64_t)reportWindowUs * (F_CPU / 1000000);
+
+    ProfileStageReport r;
+    r.stage = i;
+    r.windowUs = reportWindowUs;
+    r.cpuMhz = F_CPU / 1000000;
+    r.count = h.count();
+    r.min = h.min_value();
+    r.avg = h.count() ? (uint32_t)(stageCycles[i] / h.count()) : 0;
+    r.p50 = h.percentile(50);
+    r.p99 = h.percentile(99);
+    r.max = h.max_value();
+    r.share = windowCycles ? (uint16_t)(stageCycles[i] * 1000 / windowCycles) : 0;
+    memcpy(reportBuffer, &r, sizeof(r));
+
+    uint16_t len = sizeof(r);
+    for (uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        uint32_t count = h.bucket_count(b);
+        if (count == 0)
+            continue;
+        reportBuffer[len] = b;
+        memcpy(&reportBuffer[len + 1], &count, 4);
+        len += 5;
+    }
+
+    h.reset();
+    stageCycles[i] = 0;
+    if (++reportStage == PROFILE_STAGE_COUNT)
+        windowStartUs = micros();
+    *outputLength = len;
+    return reportBuffer;
+}
+
+#else
+
+bool profile_report() {
+    return false;
+}
+
+uint16_t profile_pending() {
+    return 0;
+}
+
+const uint8_t* profile_take(uint16_t* outputLength) {
+    *outputLength = 0;
+    return NULL;
+}
+
+#endif
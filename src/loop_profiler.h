@@ -0,0 +1,77 @@
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Where the time of a loop() goes, in CPU cycles. Enabled with -DLOOP_PROFILER
+// Every stage keeps min/avg/max, its share of the time and a histogram(see histogram.h) until the next report
+enum ProfileStage : uint8_t {
+    // loop() without wait_for_work(), every other stage but the waits is part of it
+    STAGE_LOOP,
+    STAGE_LED,
+    STAGE_SERIAL2WIFI,
+    // Parsing a frame from the host: FEC/dumb decoding and the CRC check. Part of STAGE_SERIAL2WIFI
+    STAGE_FRAME_RX,
+    // One update_wifi2serial() pass over a socket
+    STAGE_WIFI2SERIAL,
+    STAGE_SERIAL_TX,
+    // Framing one queued datagram: delta encoding, CRC, encoding and the UART write. Part of STAGE_SERIAL_TX
+    STAGE_FRAME_TX,
+    // Copying into the UART TX ring, feeding the FIFO itself when that is full. Part of whatever sends
+    STAGE_UART_WRITE,
+    // optimistic_yield() between datagrams in update_serial_tx()
+    STAGE_YIELD,
+    // wait_for_work(), the SDK and WiFi run in there
+    STAGE_WAIT,
+    PROFILE_STAGE_COUNT
+};
+
+#ifdef LOOP_PROFILER
+void profile_add(ProfileStage stage, uint32_t cycles);
+
+// Adds the cycles between its construction and destruction to a stage
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) : stage(stage), start(ESP.getCycleCount()) {}
+    ~ProfileScope() { profile_add(stage, ESP.getCycleCount() - start); }
+
+private:
+    ProfileStage stage;
+    uint32_t start;
+};
+#else
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) {}
+};
+#endif
+
+// TELEMETRY_PROFILE payload(see telemetry.h): this, then index(1) and count(4) of every histogram bucket that isn't empty
+// host/slime_ap.py has the stage names and the bucket bounds
+struct __attribute__((packed)) ProfileStageReport {
+    uint8_t stage;
+    uint32_t windowUs;
+    uint16_t cpuMhz;
+    uint32_t count;
+    // Cycles per call
+    uint32_t min, avg, p50, p99, max;
+    // Share of the window, in 0.1%
+    uint16_t share;
+};
+
+#define PROFILE_REPORT_MAX_SIZE (sizeof(ProfileStageReport) + HISTOGRAM_BUCKETS * 5)
+
+// Asks for a report, false without LOOP_PROFILER
+// The window ends here, nothing is added to the stages until the last of them is taken. Asking again before that
+// changes nothing
+bool profile_report();
+// Size of the payload profile_take would return now, 0 if there is nothing to send
+uint16_t profile_pending();
+// Returned pointer - TELEMETRY_PROFILE payload of the next stage of length outputLength, valid until the next call
+// The window after the report starts with the last stage taken
+const uint8_t* profile_take(uint16_t* outputLength);
+
+#endif
@@ -1,50 +1,120 @@
 #include <Arduino.h>
 #include <Wire.h>
-
-#include <vector>
+#include <coredecls.h>
 
 #include <ESP8266WiFi.h>
-#include <WiFiUdp.h>
 
 #include "defines.h"
 
 
 #include "LEDManager.h"
+#include "baud.h"
+#include "delta.h"
+#include "latency.h"
+#include "log.h"
+#include "loop_profiler.h"
 #include "packet_framing.h"
+#include "pbuf_pool.h"
+#include "raw_udp.h"
+#include "reassembly.h"
+#include "retransmit.h"
+#include "telemetry.h"
+#include "tx_queue.h"
+#include "uart.h"
 
 LEDManager ledManager;
 
 
+// Listening on these after boot, more can be added over the control channel up to MAX_UDP_PORTS
 uint16_t targetPorts[] = {6969, 6970};
+#define TARGET_PORT_COUNT (sizeof(targetPorts) / sizeof(targetPorts[0]))
+#define MAX_UDP_PORTS 4
 
-std::vector<WiFiUDP> Udps;
-char incomingPacket[512];
+// Unused sockets have localPort() == 0
+RawUdp Udps[MAX_UDP_PORTS];
+// CONTROL_SET_RELIABLE, same index as Udps
+bool reliablePorts[MAX_UDP_PORTS];
 
 PacketFraming framing;
+// WiFi->serial datagrams waiting for the UART
+TxQueue txQueue(FRAGMENT_SIZE);
+// Serial->WiFi datagrams longer than FRAGMENT_SIZE
+Reassembly reassembly;
+// WiFi->serial datagrams sent as changes to the previous one, when turned on
+DeltaEncoder deltaEncoder;
+// Gaps in the frames from the host, see retransmit.h. Only the ones it kept are asked for again
+SequenceTracker rxSequence(false);
+SequenceTracker rxReliableSequence(true);
+// About 2ms at the default baud rate, enough to keep the UART busy until the loop wakes up again
+#define SERIAL_TX_AHEAD_BYTES 256
 
 #define LOG_EVERY_MS 5000
 
+// Runtime settings, see CONFIG_* in packet_framing.h
+uint32_t statsIntervalMs = LOG_EVERY_MS;
+uint8_t txPowerQuarterDbm = 70; // 17.5 dBm
+WiFiPhyMode_t phyMode = WIFI_PHY_MODE_11N;
+WiFiSleepType_t sleepMode = WIFI_NONE_SLEEP;
+uint8_t udpQueueLen = RAW_UDP_QUEUE_LEN;
+
 unsigned long nextLog = 0;
 unsigned long looptimeCount = 0;
-unsigned long looptimeStart = 0;
+unsigned long lastStatsMs = 0;
+
+unsigned long serialErrorCount = 0;
+unsigned long framesResent = 0;
 
-unsigned long wifi2serialCount = 0;
-unsigned long serial2wifiCount = 0;
+// Heap watermarks since the last telemetry frame
+// getMaxFreeBlockSize() walks the heap, so they are only sampled every HEAP_SAMPLE_MS
+#define HEAP_SAMPLE_MS 100
+uint32_t heapFreeMin = UINT32_MAX;
+uint32_t heapMaxBlockMin = UINT32_MAX;
+unsigned long nextHeapSampleMs = 0;
+
+// How old WiFi->serial datagrams were once framed, since the last telemetry frame
+uint64_t txAgeSumUs = 0;
+uint32_t txAgeCount = 0;
+uint32_t txAgeMaxUs = 0;
 
 void halt() {
     ESP.deepSleep(0);
     while (true);
 }
 
+RawUdp* find_udp(uint16_t port) {
+    for (int i = 0; i < MAX_UDP_PORTS; i++)
+        if (Udps[i].localPort() == port)
+            return &Udps[i];
+    return NULL;
+}
+
+bool add_udp_port(uint16_t port) {
+    // Frames can't name ports outside the framing profile's range
+    if ((port == 0) || !frame_port_fits(port) || (find_udp(port) != NULL))
+        return false;
+
+    RawUdp* udp = find_udp(0);
+    if ((udp == NULL) || !udp->begin(port))
+        return false;
+    udp->set_queue_limit(udpQueueLen);
+    return true;
+}
+
+bool port_reliable(uint16_t port) {
+    RawUdp* udp = find_udp(port);
+    return (udp != NULL) && reliablePorts[udp - Udps];
+}
+
+void set_port_reliable(RawUdp* udp, bool reliable) {
+    reliablePorts[udp - Udps] = reliable;
+}
+
 void setup()
 {
     // halt();
 
-    // Serial.begin(115200);
-    Serial.begin(115200 * 10);
-    Serial.println();
-    Serial.println();
-    Serial.println();
+    baud_begin();
+    printf("\n\n\n");
     ledManager.setUp();
     
 
@@ -55,9 +125,9 @@ void setup()
     success &= WiFi.mode(WIFI_AP);
 
     // https://arduino-esp8266.readthedocs.io/en/latest/esp8266wifi/generic-class.html
-               WiFi.setOutputPower(17.5f);            // Higher Tx power can actually increase noise
-    success &= WiFi.setPhyMode(WIFI_PHY_MODE_11N);    // Allegedly has highest indoor range
-    success &= WiFi.setSleepMode(WIFI_NONE_SLEEP, 0); // We want lowest latency
+               WiFi.setOutputPower(txPowerQuarterDbm / 4.0f); // Higher Tx power can actually increase noise
+    success &= WiFi.setPhyMode(phyMode);                   // Allegedly has highest indoor range
+    success &= WiFi.setSleepMode(sleepMode, 0);            // We want lowest latency
     
     success &= WiFi.softAP(WIFI_SSID, WIFI_PASS, 1, WIFI_HIDDEN);
 
@@ -66,15 +136,13 @@ void setup()
         halt();
     }
 
-    printf("Set up AP with SSID %s and pass length %d\n", WIFI_SSID, strlen(WIFI_PASS));
+    printf("Set up AP with SSID %s and pass length %d\n", WIFI_SSID, (int)strlen(WIFI_PASS));
     printf("Running on %s\n", WiFi.softAPIP().toString().c_str());
 
     printf("Setting up UDP sockets\n");
-    for (int i = 0; i < (sizeof(targetPorts)/sizeof(targetPorts[0])); i++) {
-        WiFiUDP newUdp;
-        newUdp.begin(targetPorts[i]);
-        Udps.push_back(newUdp);
-    }
+    for (size_t i = 0; i < TARGET_PORT_COUNT; i++)
+        if (!add_udp_port(targetPorts[i]))
+            printf("[!!!] Couldn't bind port %d\n", targetPorts[i]);
     
     printf("Network setup done\n");
 
@@ -83,138 +151,639 @@ void setup()
     printf("Entering main loop\n");
 
     nextLog = millis();
-    looptimeStart = micros();
+    lastStatsMs = millis();
     looptimeCount = 0;
 }
 
 
 
-void handle_serial_packet(uint8_t address, uint16_t localPort, uint16_t remotePort, uint8_t* data, uint16_t len) {
-    WiFiUDP* udp = NULL;
-    for (int i = 0; i < Udps.size(); i++)
-        if (Udps[i].localPort() == localPort) {
-            udp = &Udps[i];
-            break;
-        }
-    
-    if (udp == NULL)
-        return;
-
-    IPAddress addr(192, 168, 4, address);
-    if (!udp->beginPacket(addr, remotePort)) {
-        printf("[!!!] Error sending serial packet(begin) from port=%d; to: ip=%s, port=%d ; len=%d\n", localPort, addr.toString().c_str(), remotePort, len);
+void handle_serial_packet(frame_address_t address, uint16_t localPort, uint16_t remotePort, const uint8_t* data, uint16_t len) {
+    RawUdp* udp = (localPort != 0) ? find_udp(localPort) : NULL;
+    IPAddress addr = frame_address_ip(address);
+    if ((udp == NULL) || !udp->send(addr, remotePort, data, len)) {
+        telemetry_send_error(address);
         return;
     }
+    telemetry_serial2wifi(address, len);
+    
+    //printf("Sent packet %d bytes long to %s:%d\n", len, addr.toString().c_str(), port);
 
-    udp->write(data, len);
+    ledManager.activity();
+}
 
-    if (!udp->endPacket()) {
-        printf("[!!!] Error sending serial packet(end) from port=%d; to: ip=%s, port=%d ; len=%d\n", localPort, addr.toString().c_str(), remotePort, len);
+// Same for datagrams put together from fragments
+void handle_serial_datagram(frame_address_t address, uint16_t localPort, uint16_t remotePort, pbuf* p) {
+    RawUdp* udp = (localPort != 0) ? find_udp(localPort) : NULL;
+    IPAddress addr = frame_address_ip(address);
+    if ((udp == NULL) || !udp->send(addr, remotePort, p)) {
+        telemetry_send_error(address);
         return;
     }
-    
-    //printf("Sent packet %d bytes long to %s:%d\n", len, addr.toString().c_str(), port);
+    telemetry_serial2wifi(address, p->tot_len);
 
     ledManager.activity();
 }
 
-int read_serial_char() {
-    while (true) {
-        auto next = Serial.read();
-        if (next < 0)
-            return next;
-        
-        auto byte = (uint8_t)next;
-
-        int8_t status = 0;
-        uint8_t address = 0;
-        uint16_t localPort = 0;
-        uint16_t remotePort = 0;
-        uint16_t len = 0;
-        uint8_t* ptr = framing.parse_frame(byte, &status, &address, &localPort, &remotePort, &len);
+// Same datagram to every address of a FRAME_TYPE_MULTICAST frame, or to the subnet's broadcast address if there are none
+// One pool pbuf without header room serves every copy, lwIP puts the headers of each in a pbuf of its own(see PbufPool)
+void handle_serial_multicast(uint16_t localPort, uint16_t remotePort, const uint8_t* addresses, uint8_t count, const uint8_t* data, uint16_t len) {
+    RawUdp* udp = (localPort != 0) ? find_udp(localPort) : NULL;
+    pbuf* p = (udp != NULL) ? pbufPool.alloc(PBUF_RAW, len) : NULL;
+    if (p != NULL)
+        pbuf_take(p, data, len);
+
+    if (count == 0) {
+        // The broadcast address isn't a tracker, nothing is charged to one
+        IPAddress ap = WiFi.softAPIP();
+        if ((p != NULL) && udp->send(IPAddress(ap[0], ap[1], ap[2], 255), remotePort, p))
+            ledManager.activity();
+    }
 
-        if (status == -1)
+    for (uint8_t i = 0; i < count; i++) {
+        frame_address_t address;
+        addresses = get_frame_address(addresses, &address);
+        if ((p == NULL) || !udp->send(frame_address_ip(address), remotePort, p)) {
+            telemetry_send_error(address);
             continue;
+        }
+        telemetry_serial2wifi(address, len);
+        ledManager.activity();
+    }
 
-        if (status == 0)
-            return byte;
-        
-        if (status != 1) {
-            //printf("Wrong CRC for packet\n");
-            // CRC or other error
-            continue;
+    if (p != NULL)
+        pbuf_free(p);
+}
+
+uint8_t set_config(uint8_t key, uint32_t value) {
+    switch (key) {
+    case CONFIG_STATS_INTERVAL_MS:
+        statsIntervalMs = value;
+        nextLog = millis() + value;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_TX_POWER:
+        if (value > 82)
+            return CONTROL_STATUS_BAD_VALUE;
+        txPowerQuarterDbm = value;
+        WiFi.setOutputPower(value / 4.0f);
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_PHY_MODE:
+        if ((value < WIFI_PHY_MODE_11B) || (value > WIFI_PHY_MODE_11N))
+            return CONTROL_STATUS_BAD_VALUE;
+        if (!WiFi.setPhyMode((WiFiPhyMode_t)value))
+            return CONTROL_STATUS_FAILED;
+        phyMode = (WiFiPhyMode_t)value;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_SLEEP_MODE:
+        if (value > WIFI_MODEM_SLEEP)
+            return CONTROL_STATUS_BAD_VALUE;
+        if (!WiFi.setSleepMode((WiFiSleepType_t)value, 0))
+            return CONTROL_STATUS_FAILED;
+        sleepMode = (WiFiSleepType_t)value;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_UDP_QUEUE_LEN:
+        if ((value < 1) || (value > RAW_UDP_QUEUE_LEN))
+            return CONTROL_STATUS_BAD_VALUE;
+        udpQueueLen = value;
+        for (int i = 0; i < MAX_UDP_PORTS; i++)
+            Udps[i].set_queue_limit(udpQueueLen);
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_BATCH_MAX_BYTES:
+        if ((value > 0xFFFF) || !framing.set_batch_max_bytes(value))
+            return CONTROL_STATUS_BAD_VALUE;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_BATCH_HOLD_US:
+        framing.set_batch_hold_us(value);
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_TX_QUEUE_BYTES:
+        if (!txQueue.set_budget(value))
+            return CONTROL_STATUS_BAD_VALUE;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_TX_DROP_POLICY:
+        if ((value > 0xFF) || !txQueue.set_policy(value))
+            return CONTROL_STATUS_BAD_VALUE;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_COMPRESSION:
+        if (value > 1)
+            return CONTROL_STATUS_BAD_VALUE;
+        deltaEncoder.set_enabled(value);
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_FEC:
+        if ((value > 0xFFFF) || !framing.set_fec_profile(value & 0xFF, value >> 8))
+            return CONTROL_STATUS_BAD_VALUE;
+        return CONTROL_STATUS_OK;
+
+    case CONFIG_COALESCE:
+        if (!txQueue.set_coalesce(value))
+            return CONTROL_STATUS_BAD_VALUE;
+        return CONTROL_STATUS_OK;
+    }
+
+    return CONTROL_STATUS_UNKNOWN;
+}
+
+uint32_t get_config(uint8_t key) {
+    switch (key) {
+    case CONFIG_STATS_INTERVAL_MS:
+        return statsIntervalMs;
+    case CONFIG_TX_POWER:
+        return txPowerQuarterDbm;
+    case CONFIG_PHY_MODE:
+        return phyMode;
+    case CONFIG_SLEEP_MODE:
+        return sleepMode;
+    case CONFIG_UDP_QUEUE_LEN:
+        return udpQueueLen;
+    case CONFIG_BATCH_MAX_BYTES:
+        return framing.get_batch_max_bytes();
+    case CONFIG_BATCH_HOLD_US:
+        return framing.get_batch_hold_us();
+    case CONFIG_TX_QUEUE_BYTES:
+        return txQueue.get_budget();
+    case CONFIG_TX_DROP_POLICY:
+        return txQueue.get_policy();
+    case CONFIG_COMPRESSION:
+        return deltaEncoder.enabled();
+    case CONFIG_FEC:
+        return framing.get_fec_parity() | (framing.get_fec_length() << 8);
+    case CONFIG_COALESCE:
+        return txQueue.get_coalesce();
+    }
+    return 0;
+}
+
+// data - command(1), sequence number(1), arguments, see CONTROL_* in packet_framing.h
+void handle_control(const uint8_t* data, uint16_t len) {
+    if (len < 2)
+        return;
+
+    const uint8_t* args = data + 2;
+    uint16_t argsLen = len - 2;
+
+    // Command | CONTROL_ACK, sequence number, status, reply data
+    uint8_t reply[96] = {(uint8_t)(data[0] | CONTROL_ACK), data[1], CONTROL_STATUS_OK};
+    size_t replyLen = 3;
+    uint32_t newBaud = 0;
+
+    switch (data[0]) {
+    case CONTROL_LATENCY_REPORT:
+        if (!latency_report())
+            reply[2] = CONTROL_STATUS_UNKNOWN;
+        break;
+
+    case CONTROL_PROFILER_REPORT:
+        if (!profile_report())
+            reply[2] = CONTROL_STATUS_UNKNOWN;
+        break;
+
+    case CONTROL_SET_CONFIG: {
+        if (argsLen != 5) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+        uint32_t value;
+        memcpy(&value, &args[1], 4);
+        reply[2] = set_config(args[0], value);
+        break;
+    }
+
+    case CONTROL_GET_CONFIG: {
+        for (uint8_t key = CONFIG_STATS_INTERVAL_MS; key <= CONFIG_COALESCE; key++) {
+            uint32_t value = get_config(key);
+            reply[replyLen] = key;
+            memcpy(&reply[replyLen + 1], &value, 4);
+            replyLen += 5;
+        }
+
+        uint8_t* countPtr = &reply[replyLen++];
+        *countPtr = 0;
+        uint8_t reliableMask = 0;
+        for (int i = 0; i < MAX_UDP_PORTS; i++) {
+            uint16_t port = Udps[i].localPort();
+            if (port == 0)
+                continue;
+            memcpy(&reply[replyLen], &port, 2);
+            replyLen += 2;
+            if (reliablePorts[i])
+                reliableMask |= 1 << *countPtr;
+            (*countPtr)++;
+        }
+        reply[replyLen++] = reliableMask;
+        break;
+    }
+
+    case CONTROL_ADD_PORT:
+    case CONTROL_REMOVE_PORT: {
+        uint16_t port;
+        if (argsLen != 2) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+        memcpy(&port, args, 2);
+        if (port == 0) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+
+        if (data[0] == CONTROL_ADD_PORT) {
+            if (!add_udp_port(port))
+                reply[2] = CONTROL_STATUS_FAILED;
+        } else {
+            RawUdp* udp = find_udp(port);
+            if (udp == NULL) {
+                reply[2] = CONTROL_STATUS_FAILED;
+            } else {
+                udp->stop();
+                set_port_reliable(udp, false);
+            }
+        }
+        break;
+    }
+
+    case CONTROL_SET_RELIABLE: {
+        uint16_t port;
+        if ((argsLen != 3) || (args[2] > 1)) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+        memcpy(&port, args, 2);
+        RawUdp* udp = (port != 0) ? find_udp(port) : NULL;
+        if (udp == NULL) {
+            reply[2] = CONTROL_STATUS_FAILED;
+            break;
+        }
+        set_port_reliable(udp, args[2]);
+        break;
+    }
+
+    case CONTROL_SET_BAUD:
+        if (argsLen != 4) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+        memcpy(&newBaud, args, 4);
+        if ((newBaud < BAUD_MIN) || (newBaud > BAUD_MAX)) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            newBaud = 0;
         }
+        break;
 
-        handle_serial_packet(address, localPort, remotePort, ptr, len);
-        serial2wifiCount++;
+    case CONTROL_BAUD_CONFIRM:
+        baud_confirm();
+        break;
+
+    case CONTROL_RESYNC:
+        deltaEncoder.resync();
+        break;
+
+    case CONTROL_ECHO:
+        if (argsLen > (sizeof(reply) - replyLen)) {
+            reply[2] = CONTROL_STATUS_BAD_VALUE;
+            break;
+        }
+        memcpy(&reply[replyLen], args, argsLen);
+        replyLen += argsLen;
+        break;
+
+    default:
+        reply[2] = CONTROL_STATUS_UNKNOWN;
+        break;
     }
+
+    framing.send_control(reply, replyLen);
+
+    // Only after the ack, the host expects it at the old rate
+    if (newBaud != 0)
+        baud_switch(newBaud);
 }
 
 void update_serial2wifi() {
-    while (Serial.available() > 0) {
-        // TODO: Handle serial commands
-        read_serial_char();
-        optimistic_yield(100);
+    size_t len = 0;
+    const uint8_t* data;
+    while ((data = uartRx.read_span(&len)), len > 0) {
+        int8_t status = 0;
+        FrameInfo info;
+        info.type = 0;
+        uint16_t outLen = 0;
+        size_t consumed = 0;
+        const uint8_t* ptr;
+        {
+            ProfileScope scope(STAGE_FRAME_RX);
+            ptr = framing.parse_frame(data, len, &consumed, &status, &info, &outLen);
+        }
+        uartRx.commit_read(consumed);
+
+        if (status == 0) {
+            // Not part of a frame, commands come in CONTROL frames
+            // The host never sends text, so this is line noise or the wrong baud rate
+            baud_rx_garbage(outLen);
+            continue;
+        }
+
+        if (status == 1) {
+            baud_frame_ok();
+            // A retransmission that was asked for more than once and came in more than once
+            SequenceTracker& sequence = info.reliable ? rxReliableSequence : rxSequence;
+            if (!sequence.received(info.sequence, info.retransmitted, millis()))
+                continue;
+        }
+
+        if ((status == 1) && (info.type == FRAME_TYPE_DATA)) {
+            uint32_t rxTime = micros();
+            if (info.hasTimestamps)
+                latency_add_transit(HOP_SERIAL_TRANSIT, info.serialTxUs, rxTime);
+
+            handle_serial_packet(info.address, info.localPort, info.remotePort, ptr, outLen);
+            latency_add(HOP_SERIAL_TO_UDP, micros() - rxTime);
+            optimistic_yield(100);
+        }
+
+        if ((status == 1) && (info.type == FRAME_TYPE_FRAGMENT)) {
+            pbuf* p = reassembly.add(info, ptr, outLen);
+            if (p != NULL) {
+                handle_serial_datagram(info.address, info.localPort, info.remotePort, p);
+                pbuf_free(p);
+            }
+        }
+
+        if ((status == 1) && (info.type == FRAME_TYPE_MULTICAST)) {
+            size_t addressesLen = info.addressCount * FRAME_ADDRESS_SIZE;
+            if (outLen > addressesLen)
+                handle_serial_multicast(info.localPort, info.remotePort, ptr, info.addressCount, ptr + addressesLen, outLen - addressesLen);
+        }
+
+        if ((status == 1) && (info.type == FRAME_TYPE_CONTROL))
+            handle_control(ptr, outLen);
+
+        if ((status == 1) && (info.type == FRAME_TYPE_NACK)) {
+            for (uint16_t i = 0; (i + 2) <= outLen; i += 2) {
+                uint16_t sequence;
+                memcpy(&sequence, &ptr[i], 2);
+                if (framing.resend(sequence))
+                    framesResent++;
+            }
+        }
+
+        if (status == -2) {
+            serialErrorCount++;
+            if ((info.type == FRAME_TYPE_DATA) || (info.type == FRAME_TYPE_FRAGMENT))
+                telemetry_crc_failure(info.address);
+            baud_rx_garbage(consumed);
+        }
+
+        // status == -1 - frame continues in the next bytes
     }
 }
 
-void update_wifi2serial(WiFiUDP* udp) {
+void update_wifi2serial(RawUdp* udp) {
     bool activity = false;
-    int packetLen;
-    while ((packetLen = udp->parsePacket()) > 0) {
-        auto ip = udp->remoteIP();
-        uint8_t ipLowerByte = ip[3]; // This is the only byte that should actually change
-        uint16_t localPort = udp->localPort();
-        uint16_t remotePort = udp->remotePort();
-        uint16_t writeLen = min(packetLen, (int)sizeof(incomingPacket));//packetLen;
-        int len = udp->read(incomingPacket, writeLen);
-        
-        if (len != writeLen)
-            printf("[!!!] Packet length mismatch: len=%d, writeLen=%d\n", len, writeLen);
-        if (packetLen > (int)sizeof(incomingPacket))
-            printf("[!] Packet truncated: packetLen=%d\n", packetLen);
-
-        size_t frameLen = 0;
-        uint8_t* ptr = framing.make_frame((uint8_t*)incomingPacket, writeLen, ipLowerByte, localPort, remotePort, &frameLen);
-
-        if (ptr != NULL)
-            Serial.write(ptr, frameLen);
-        optimistic_yield(100);
+    pbuf* p;
+    IPAddress ip;
+    uint16_t remotePort;
+    uint32_t rxTime;
+    while ((p = udp->take(&ip, &remotePort, &rxTime)) != NULL) {
+        frame_address_t address = frame_address(ip);
+        telemetry_seen(address);
+        if (!frame_port_fits(remotePort)) {
+            pbuf_free(p);
+            telemetry_dropped(address);
+            continue;
+        }
 
+        // Only moves the pbuf, it is framed once the UART has room for it
+        txQueue.push(p, address, udp->localPort(), remotePort, rxTime);
         activity = true;
-        wifi2serialCount++;
     }
 
+    // Datagrams the receive callback had no room for
+    frame_address_t dropped;
+    uint32_t count;
+    while (udp->take_dropped_address(&dropped, &count))
+        telemetry_dropped(dropped, count);
+
     if (activity)
         ledManager.activity();
 }
 
-void loop()
-{
-    ledManager.update();
-    
-    update_serial2wifi();
-    for (int i = 0; i < Udps.size(); i++)
-        update_wifi2serial(&Udps[i]);
-    looptimeCount++;
+// Whether a datagram of this size can be framed into the UART TX ring now
+// Only a little is kept ahead of the UART, so datagrams wait in txQueue where they are scheduled and dropped fairly
+// rather than in a FIFO
+bool serial_tx_room(uint16_t len) {
+    return (uart_tx_pending() < SERIAL_TX_AHEAD_BYTES) && (uart_tx_space() >= framing.tx_space_needed(len));
+}
 
-    if (millis() > nextLog) {
-        nextLog = millis() + LOG_EVERY_MS;
+// Frames queued datagrams, tracker by tracker, as long as the UART keeps up
+// Never waits for the UART, the TX interrupt wakes the loop again once enough has gone out
+void update_serial_tx() {
+    TxDatagram d;
+    while (txQueue.peek(&d)) {
+        uint16_t len = std::min(d.p->tot_len - d.offset, FRAGMENT_SIZE);
+        if (!serial_tx_room(len)) {
+            uart_tx_wake_below(SERIAL_TX_AHEAD_BYTES);
+            break;
+        }
+
+        {
+            ProfileScope scope(STAGE_FRAME_TX);
+            // Framed straight from the pbuf, it is only freed once it is in the TX ring
+            if (d.p->tot_len > FRAGMENT_SIZE) {
+                len = framing.make_fragment(d.p, d.offset, d.id, d.address, d.localPort, d.remotePort, d.rxTimeUs);
+            } else if (port_reliable(d.localPort)) {
+                // A frame of its own, so it can be sent again as it is
+                framing.flush_batch();
+                framing.keep_next_frame();
+                framing.make_frame(d.p, d.address, d.localPort, d.remotePort, d.rxTimeUs);
+            } else if (deltaEncoder.accepts(len)) {
+                // Never batched, send what is before it first
+                framing.flush_batch();
+                uint8_t stream, sequence;
+                uint16_t outLen;
+                const uint8_t* out = deltaEncoder.encode(d.p, d.address, d.localPort, d.remotePort, &stream, &sequence, &outLen);
+                framing.make_delta(out, outLen, stream, sequence, d.rxTimeUs);
+            } else {
+                framing.add_to_batch(d.p, d.address, d.localPort, d.remotePort, d.rxTimeUs);
+            }
+        }
+        if ((d.offset + len) >= d.p->tot_len) {
+            telemetry_wifi2serial(d.address, d.p->tot_len);
+            uint32_t age = micros() - d.rxTimeUs;
+            txAgeSumUs += age;
+            txAgeCount++;
+            txAgeMaxUs = std::max(txAgeMaxUs, age);
+        }
+        txQueue.advance(len);
+        ProfileScope scope(STAGE_YIELD);
+        optimistic_yield(100);
+    }
+}
+
+bool serial_tx_ready() {
+    TxDatagram d;
+    return txQueue.peek(&d) && serial_tx_room(std::min(d.p->tot_len - d.offset, FRAGMENT_SIZE));
+}
+
+bool has_work() {
+    if ((uartRx.available() > 0) || serial_tx_ready())
+        return true;
+    for (int i = 0; i < MAX_UDP_PORTS; i++)
+        if (Udps[i].available())
+            return true;
+    return false;
+}
+
+void sample_heap() {
+    heapFreeMin = std::min(heapFreeMin, ESP.getFreeHeap());
+    heapMaxBlockMin = std::min(heapMaxBlockMin, ESP.getMaxFreeBlockSize());
+    nextHeapSampleMs = millis() + HEAP_SAMPLE_MS;
+}
+
+void send_telemetry() {
+    uint32_t now = millis();
+    TelemetryGlobals g;
+    g.intervalMs = now - lastStatsMs;
+    lastStatsMs = now;
+    nextLog = now + statsIntervalMs;
+    g.loops = looptimeCount;
+    looptimeCount = 0;
+    g.baud = baud_current();
+    g.framing = framing.get_tx_mode();
+    g.badFrames = serialErrorCount;
+    serialErrorCount = 0;
+    g.repairedChunks = framing.take_corrected_chunks();
+
+    g.udpQueueDropped = 0;
+    for (int i = 0; i < MAX_UDP_PORTS; i++)
+        g.udpQueueDropped += Udps[i].take_dropped();
+    g.serialRxDroppedBytes = uart_rx_take_dropped();
+    g.txQueueDropped = txQueue.take_dropped();
+    g.incompleteFragmented = reassembly.take_dropped();
+
+    g.txQueueDepth = txQueue.depth();
+    g.txQueueMaxDepth = txQueue.take_max_depth();
+    g.txQueueBytes = txQueue.bytes();
+    g.txQueueBudget = txQueue.get_budget();
+    g.uartTxFree = uart_tx_space();
+    g.txSuperseded = txQueue.take_superseded();
+    g.txAgeAvgUs = (txAgeCount > 0) ? (uint32_t)(txAgeSumUs / txAgeCount) : 0;
+    g.txAgeMaxUs = txAgeMaxUs;
+    txAgeSumUs = txAgeCount = txAgeMaxUs = 0;
+
+    g.framesLost = rxSequence.take_lost() + rxReliableSequence.take_lost();
+    g.framesRecovered = rxReliableSequence.take_recovered();
+    g.framesResent = framesResent;
+    framesResent = 0;
+
+    g.keyframes = deltaEncoder.take_keyframes();
+    g.deltas = deltaEncoder.take_deltas();
+    g.savedBytes = deltaEncoder.take_saved_bytes();
+
+    sample_heap();
+    g.heapFreeMin = heapFreeMin;
+    g.heapMaxBlockMin = heapMaxBlockMin;
+    heapFreeMin = heapMaxBlockMin = UINT32_MAX;
+    g.pbufPoolInUse = pbufPool.in_use();
+    g.pbufPoolExhausted = pbufPool.take_exhausted();
+
+    uint16_t len;
+    const uint8_t* data = telemetry_build(g, &len);
+    framing.send_telemetry(TELEMETRY_STATS, data, len);
+}
+
+// Asks the host for missing frames, and again for the ones that still didn't come
+void send_nacks() {
+    uint16_t missing[NACK_MAX_MISSING];
+    if (!rxReliableSequence.nacks_pending() || (uart_tx_space() < framing.max_frame_size(sizeof(missing))))
+        return;
 
-        auto cur = micros();
-        auto dt = cur - looptimeStart;
-        looptimeStart = cur;
-        auto cnt = looptimeCount;
-        looptimeCount = 0;
+    size_t count = rxReliableSequence.take_nacks(millis(), missing);
+    if (count > 0)
+        framing.send_nack(missing, count);
+}
 
-        auto loopsPerSec = cnt * 1e6f / std::max(dt, 1ul);
+// Log records only go out when there is nothing else to do, so logging never holds back datagrams
+void send_logs() {
+    uint16_t pending = log_pending();
+    if ((pending == 0) || has_work() || (uart_tx_space() < framing.max_frame_size(pending)))
+        return;
+
+    uint16_t len;
+    const uint8_t* data = log_take(&len);
+    framing.send_log(data, len);
+}
 
-        printf("[STATS] Average loops/sec: %f(count: %ld, micros: %ld)\n", loopsPerSec, cnt, dt);
-        printf("[STATS] Packets sent since last log: WiFi->Serial: %ld ; Serial->WiFi: %ld\n", wifi2serialCount, serial2wifiCount);
-        wifi2serialCount = serial2wifiCount = 0;
+// Reports the host asked for go out as soon as there is room, they are asked for while the dongle is busy
+void send_reports() {
+    uint16_t pending = latency_pending();
+    if ((pending > 0) && (uart_tx_space() >= framing.max_frame_size(pending))) {
+        uint16_t len;
+        const uint8_t* data = latency_take(&len);
+        framing.send_telemetry(TELEMETRY_LATENCY, data, len);
     }
 
-    optimistic_yield(100);
+    // A stage per loop
+    pending = profile_pending();
+    if ((pending > 0) && (uart_tx_space() >= framing.max_frame_size(pending))) {
+        uint16_t len;
+        const uint8_t* data = profile_take(&len);
+        framing.send_telemetry(TELEMETRY_PROFILE, data, len);
+    }
+}
+
+// Sleeps until the UART interrupt(RX data or TX room) or a lwIP receive callback queues something(both call esp_schedule())
+// The timeout only drives the LED and the batch hold time
+void wait_for_work() {
+    uint32_t timeoutMs = framing.batch_pending() ? 1 : LED_MANAGER_UPDATE_MS;
+    esp_delay(timeoutMs, []() { return !has_work(); });
+}
+
+void loop()
+{
+    {
+        ProfileScope loopScope(STAGE_LOOP);
+        {
+            ProfileScope scope(STAGE_LED);
+            ledManager.update();
+        }
     
-    delay(1);
+        {
+            ProfileScope scope(STAGE_SERIAL2WIFI);
+            update_serial2wifi();
+        }
+        for (int i = 0; i < MAX_UDP_PORTS; i++) {
+            if (Udps[i].localPort() == 0)
+                continue;
+            ProfileScope scope(STAGE_WIFI2SERIAL);
+            update_wifi2serial(&Udps[i]);
+        }
+        {
+            ProfileScope scope(STAGE_SERIAL_TX);
+            update_serial_tx();
+        }
+        framing.update_batch(micros());
+        reassembly.expire(millis());
+        baud_update();
+        log_update();
+        if (millis() >= nextHeapSampleMs)
+            sample_heap();
+        looptimeCount++;
+
+        // Waits for room rather than for the UART
+        if ((statsIntervalMs > 0) && (millis() > nextLog) && (uart_tx_space() >= framing.max_frame_size(telemetry_size())))
+            send_telemetry();
+        send_nacks();
+        send_reports();
+        send_logs();
+    }
+
+    ProfileScope scope(STAGE_WAIT);
+    wait_for_work();
 }
@@ -3,127 +3,664 @@
 #include <algorithm>
 #include <memory.h>
 
-#include <cstdio>
-
 #include <Arduino.h>
 
+#include "crc16.h"
+#include "latency.h"
+#include "log.h"
+#include "uart.h"
 
-#define BUFFER_SIZE ((size_t)512)
-static const uint8_t PREAMBLE[] = {0xCF, 0xEB, 0x01, 0x81};
-
-
-// Source: https://github.com/esp8266/Arduino/blob/master/cores/esp8266/crc32.cpp
-#define CRC16_POLY 0x5935
-static void update_crc16(uint8_t* data, size_t length, uint16_t* crc) {
-    uint16_t cur = *crc;
-    while (length--)
-    {
-        uint8_t c = *(data++);
-        for (uint32_t i = 0x80; i > 0; i >>= 1)
-        {
-            bool bit = cur & 0x8000;
-            if (c & i)
-                bit = !bit;
-            cur <<= 1;
-            if (bit)
-                cur ^= CRC16_POLY;
-        }
-    }
-    *crc = cur;
-}
 
-#define WRITE_AND_CRC(data, length, crc) \
-    write(((uint8_t*)data), length); update_crc16(((uint8_t*)data), length, &crc)
-#define READ_AND_CRC(data, length, crc) \
-    read(((uint8_t*)data), length); update_crc16(((uint8_t*)data), length, &crc)
+// Longer datagrams come in fragments
+#define BUFFER_SIZE ((size_t)FRAGMENT_SIZE)
+// Type, length, sequence number
+#define COMMON_HEADER_SIZE ((size_t)5)
+#define TIMESTAMPS_SIZE ((size_t)8)
+#define CRC_SIZE ((size_t)2)
+// Followed by the frame type byte
+static const uint8_t PREAMBLE[] = {0xCF, 0xEB, 0x01};
+// Same as FRAME_START in dumb_serial.c
+#define CODEC_FRAME_START ((uint8_t)0xE6)
+// dumb_serial packs up to 7 bytes into each chunk
+#define CODEC_CHUNK_BYTES 7
 
+static_assert(FRAME_BUFFER_SIZE <= FEC_MAX_RX_FRAME, "FecDecoder has to take the longest frame");
+// Without FRAME_FEC its frame start is just text
+#if FRAME_FEC
+#define IS_FEC_FRAME_START(b) ((b) == FEC_FRAME_START)
+#else
+#define IS_FEC_FRAME_START(b) false
+#endif
+
+// Batch record header: length with the same ports flag, address, ports
+#define BATCH_SAME_PORTS ((uint16_t)0x8000)
+#define BATCH_RECORD_HEADER_SIZE ((size_t)(2 + FRAME_ADDRESSING_SIZE))
+// FRAME_TYPE_DATA header: address, ports
+#define DATA_HEADER_SIZE ((size_t)FRAME_ADDRESSING_SIZE)
+// FRAME_TYPE_FRAGMENT header: address, ports, datagram id, index, count
+#define FRAGMENT_HEADER_SIZE ((size_t)(FRAME_ADDRESSING_SIZE + 5))
+// FRAME_TYPE_DELTA header: stream, sequence
+#define DELTA_HEADER_SIZE ((size_t)2)
+// FRAME_TYPE_MULTICAST header: ports, address count
+#define MULTICAST_HEADER_SIZE ((size_t)(2 * FRAME_PORT_SIZE + 1))
+// Common header, timestamps and the largest type specific header
+#define MAX_HEADER_SIZE (COMMON_HEADER_SIZE + TIMESTAMPS_SIZE + FRAGMENT_HEADER_SIZE)
+static_assert(FRAME_BUFFER_SIZE == (MAX_HEADER_SIZE + BUFFER_SIZE + CRC_SIZE), "FRAME_BUFFER_SIZE is out of date");
 
 
 
 
 PacketFraming::PacketFraming() {
-    readBuffer = new uint8_t[BUFFER_SIZE];
+    parseState = SCAN_PREAMBLE;
     preambleScanIdx = 0;
+    parseIdx = 0;
+    headerLen = 0;
+    frameLen = 0;
+    rxMode = txMode = FRAMING_MODE;
+    txSequence = 0;
+    txReliableSequence = 0;
+    keepNext = false;
+    keepPtr = NULL;
+
+    init_read_state(&codecReader, readBuffer, FRAME_BUFFER_SIZE);
+    init_write_state(&codecWriter, codecWriteBuffer, sizeof(codecWriteBuffer));
+
+    batchLen = batchCount = 0;
+    batchLocalPort = batchRemotePort = 0;
+    batchStartUs = 0;
+    batchMaxBytes = BATCH_MAX_BYTES;
+    batchHoldUs = BATCH_MAX_HOLD_US;
+}
+
+
+size_t PacketFraming::header_size(uint8_t frameType) {
+    size_t ret;
+    switch (frameType & ~FRAME_FLAGS) {
+    case FRAME_TYPE_DATA:
+        ret = COMMON_HEADER_SIZE + DATA_HEADER_SIZE;
+        break;
+    case FRAME_TYPE_FRAGMENT:
+        ret = COMMON_HEADER_SIZE + FRAGMENT_HEADER_SIZE;
+        break;
+    case FRAME_TYPE_MULTICAST:
+        ret = COMMON_HEADER_SIZE + MULTICAST_HEADER_SIZE;
+        break;
+    case FRAME_TYPE_BATCH:
+    case FRAME_TYPE_CONTROL:
+    case FRAME_TYPE_NACK:
+        ret = COMMON_HEADER_SIZE;
+        break;
+    default:
+        return 0;
+    }
+
+    if (frameType & FRAME_FLAG_TIMESTAMPS)
+        ret += TIMESTAMPS_SIZE;
+    return ret;
 }
 
-PacketFraming::~PacketFraming() {
-    delete readBuffer;
+size_t PacketFraming::max_frame_size(uint16_t dataLength) {
+    size_t len = MAX_HEADER_SIZE + dataLength + CRC_SIZE;
+    if (txMode == FRAMING_DUMB_SERIAL)
+        // Chunks of 7 bytes grow to 9 and every byte might need escaping, plus frame start and end
+        len = (len + CODEC_CHUNK_BYTES - 1) / CODEC_CHUNK_BYTES * 18 + 2;
+#if FRAME_FEC
+    else if (txMode == FRAMING_FEC)
+        len = fecWriter.max_encoded_size(len);
+#endif
+    else
+        len += sizeof(PREAMBLE);
+    // Newline
+    return len + 1;
 }
 
+size_t PacketFraming::tx_space_needed(uint16_t dataLength) {
+    size_t needed = max_frame_size(dataLength);
+#if BATCH_MAX_BYTES > 0
+    // add_to_batch() may have to flush the batch first
+    if (batchCount > 0)
+        needed += max_frame_size(batchLen);
+#endif
+    // A frame that can never fit is let through once everything else is out, uart_tx_write() then waits for the rest
+    return std::min(needed, (size_t)UART_TX_RING_SIZE);
+}
 
-uint8_t* PacketFraming::make_frame(uint8_t* data, uint16_t dataLength, uint8_t address, uint16_t localPort, uint16_t remotePort, size_t* outputLength) {
-    uint16_t crc = 0;
-    write(PREAMBLE, sizeof(PREAMBLE));
-    WRITE_AND_CRC(&dataLength, 2, crc);
-    WRITE_AND_CRC(&address, 1, crc);
-    WRITE_AND_CRC(&localPort, 2, crc);
-    WRITE_AND_CRC(&remotePort, 2, crc);
-    WRITE_AND_CRC(data, dataLength, crc);
-    write((uint8_t*)&crc, 2);
+void PacketFraming::begin_frame(uint8_t frameType, uint16_t length, const uint8_t* typeHeader, size_t typeHeaderLen, uint32_t rxTimeUs, uint16_t* crc) {
+#ifdef LATENCY_STATS
+    frameType |= FRAME_FLAG_TIMESTAMPS;
+#endif
+    if (keepNext)
+        frameType |= FRAME_FLAG_RELIABLE;
+    uint16_t* sequence = keepNext ? &txReliableSequence : &txSequence;
+
+    // Preamble, type, length, sequence number, timestamps and the type specific header all go out in one write
+    uint8_t header[sizeof(PREAMBLE) + MAX_HEADER_SIZE];
+    uint8_t* ptr = header;
+    if (txMode == FRAMING_PREAMBLE) {
+        memcpy(ptr, PREAMBLE, sizeof(PREAMBLE));
+        ptr += sizeof(PREAMBLE);
+    }
+    uint8_t* crcStart = ptr;
+
+    *(ptr++) = frameType;
+    memcpy(ptr, &length, 2);
+    memcpy(ptr + 2, sequence, 2);
+    ptr += 4;
+
+#ifdef LATENCY_STATS
+    uint32_t timestamps[2] = {rxTimeUs, (uint32_t)micros()};
+    memcpy(ptr, timestamps, TIMESTAMPS_SIZE);
+    ptr += TIMESTAMPS_SIZE;
+#endif
+
+    if (typeHeaderLen > 0) {
+        memcpy(ptr, typeHeader, typeHeaderLen);
+        ptr += typeHeaderLen;
+    }
+
+    *crc = 0;
+    update_crc16(crcStart, ptr - crcStart, crc);
+#if FRAME_FEC
+    if (txMode == FRAMING_FEC)
+        fecWriter.begin();
+#endif
+    write(header, ptr - header);
+
+    if (keepNext) {
+        keepNext = false;
+        keepPtr = retransmitRing.reserve(*sequence, (ptr - crcStart) + length);
+        if (keepPtr != NULL) {
+            memcpy(keepPtr, crcStart, ptr - crcStart);
+            keepPtr += ptr - crcStart;
+        }
+    }
+    // 0 only ever starts the sequence
+    if (++(*sequence) == 0)
+        *sequence = 1;
+}
+
+void PacketFraming::write_payload(const uint8_t* data, size_t len, uint16_t* crc) {
+    update_crc16(data, len, crc);
+    write(data, len);
+    if (keepPtr != NULL) {
+        memcpy(keepPtr, data, len);
+        keepPtr += len;
+    }
+}
+
+void PacketFraming::write_payload(const pbuf* p, uint16_t offset, uint16_t len, uint16_t* crc) {
+    for (const pbuf* q = p; (q != NULL) && (len > 0); q = q->next) {
+        if (offset >= q->len) {
+            offset -= q->len;
+            continue;
+        }
+        uint16_t n = std::min((uint16_t)(q->len - offset), len);
+        write_payload((const uint8_t*)q->payload + offset, n, crc);
+        len -= n;
+        offset = 0;
+    }
+}
+
+void PacketFraming::end_frame(uint16_t crc) {
+    // Terminate the line, so text output around frames stays readable
+    uint8_t trailer[3] = {(uint8_t)crc, (uint8_t)(crc >> 8), '\n'};
+    keepPtr = NULL;
+
+    if (txMode == FRAMING_PREAMBLE) {
+        uart_tx_write(trailer, sizeof(trailer));
+        return;
+    }
+#if FRAME_FEC
+    if (txMode == FRAMING_FEC) {
+        fecWriter.add(trailer, CRC_SIZE);
+        fecWriter.end(uart_tx_write);
+        uart_tx_write(&trailer[2], 1);
+        return;
+    }
+#endif
+
+    write(trailer, CRC_SIZE);
+    write_end_frame(&codecWriter);
+    flush_codec();
+    uart_tx_write(&trailer[2], 1);
+}
+
+uint8_t* PacketFraming::make_frame(uint8_t* data, uint16_t dataLength, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs, size_t* outputLength) {
+    uint8_t header[DATA_HEADER_SIZE];
+    put_frame_addressing(header, address, localPort, remotePort);
+
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_DATA, dataLength, header, sizeof(header), rxTimeUs, &crc);
+    write_payload(data, dataLength, &crc);
+    end_frame(crc);
+    latency_add(HOP_UDP_TO_SERIAL, micros() - rxTimeUs);
     
     // Already wrote everything to serial
     *outputLength = 0;
     return NULL;
 }
 
-uint8_t* PacketFraming::parse_frame(uint8_t next_byte, int8_t* status, uint8_t* address, uint16_t* localPort, uint16_t* remotePort, uint16_t* outputLength) {
-    if (next_byte != PREAMBLE[preambleScanIdx]) {
-        // If preambleScanIdx > 0 that means we already consumed a few bytes
-        // ideally we would have a way to return them back to the serial stream
-        // But I doubt this is ever going to be an actual problem since potential commands will be made up of ASCII characters
-        preambleScanIdx = 0;
-        *status = 0;
-        return NULL;
-    }
+void PacketFraming::make_frame(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs) {
+    uint8_t header[DATA_HEADER_SIZE];
+    put_frame_addressing(header, address, localPort, remotePort);
 
-    preambleScanIdx++;
-    if (preambleScanIdx < sizeof(PREAMBLE)) {
-        *status = -1;
-        return NULL;
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_DATA, p->tot_len, header, sizeof(header), rxTimeUs, &crc);
+    write_payload(p, 0, p->tot_len, &crc);
+    end_frame(crc);
+    latency_add(HOP_UDP_TO_SERIAL, micros() - rxTimeUs);
+}
+
+uint16_t PacketFraming::make_fragment(const pbuf* p, uint16_t offset, uint8_t datagramId, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs) {
+    uint16_t len = std::min((uint16_t)(p->tot_len - offset), (uint16_t)FRAGMENT_SIZE);
+    uint16_t index = offset / FRAGMENT_SIZE;
+    uint16_t count = (p->tot_len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+
+    uint8_t header[FRAGMENT_HEADER_SIZE];
+    uint8_t* ptr = put_frame_addressing(header, address, localPort, remotePort);
+    ptr[0] = datagramId;
+    memcpy(&ptr[1], &index, 2);
+    memcpy(&ptr[3], &count, 2);
+
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_FRAGMENT, len, header, sizeof(header), rxTimeUs, &crc);
+    write_payload(p, offset, len, &crc);
+    end_frame(crc);
+    if ((offset + len) >= p->tot_len)
+        latency_add(HOP_UDP_TO_SERIAL, micros() - rxTimeUs);
+    return len;
+}
+
+void PacketFraming::make_delta(const uint8_t* data, uint16_t dataLength, uint8_t stream, uint8_t sequence, uint32_t rxTimeUs) {
+    uint8_t header[DELTA_HEADER_SIZE] = {stream, sequence};
+
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_DELTA, dataLength, header, sizeof(header), rxTimeUs, &crc);
+    write_payload(data, dataLength, &crc);
+    end_frame(crc);
+    latency_add(HOP_UDP_TO_SERIAL, micros() - rxTimeUs);
+}
+
+void PacketFraming::add_to_batch(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs) {
+#if BATCH_MAX_BYTES > 0
+    uint16_t dataLength = p->tot_len;
+    size_t recordLen = BATCH_RECORD_HEADER_SIZE + dataLength;
+    if (recordLen > batchMaxBytes) {
+        // Doesn't fit into any batch, send it right away without reordering
+        flush_batch();
+        make_frame(p, address, localPort, remotePort, rxTimeUs);
+        return;
     }
-    
-    // Preamble found!
-    // Reset index for next scan
-    preambleScanIdx = 0;
 
-    // Now read the packet
+    if ((batchLen + recordLen) > batchMaxBytes)
+        flush_batch();
+
+    if (batchCount == 0)
+        batchStartUs = rxTimeUs;
+
+    uint16_t lenField = dataLength;
+    bool samePorts = (batchCount > 0) && (localPort == batchLocalPort) && (remotePort == batchRemotePort);
+    if (samePorts)
+        lenField |= BATCH_SAME_PORTS;
+
+    uint8_t* ptr = &batchBuffer[batchLen];
+    memcpy(ptr, &lenField, 2);
+    ptr = put_frame_address(ptr + 2, address);
+    if (!samePorts)
+        ptr = put_frame_ports(ptr, localPort, remotePort);
+    pbuf_copy_partial(p, ptr, dataLength, 0);
+    ptr += dataLength;
+
+    batchLen = ptr - batchBuffer;
+    batchCount++;
+    batchLocalPort = localPort;
+    batchRemotePort = remotePort;
+#else
+    make_frame(p, address, localPort, remotePort, rxTimeUs);
+#endif
+}
+
+void PacketFraming::update_batch(uint32_t nowUs) {
+    if ((batchCount > 0) && ((nowUs - batchStartUs) >= batchHoldUs))
+        flush_batch();
+}
+
+bool PacketFraming::set_batch_max_bytes(uint16_t maxBytes) {
+    if (maxBytes > BATCH_MAX_BYTES)
+        return false;
+
+    flush_batch();
+    batchMaxBytes = maxBytes;
+    return true;
+}
+
+void PacketFraming::send_control(const uint8_t* data, uint16_t length) {
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_CONTROL, length, NULL, 0, micros(), &crc);
+    write_payload(data, length, &crc);
+    end_frame(crc);
+}
+
+void PacketFraming::send_telemetry(uint8_t kind, const uint8_t* data, uint16_t length) {
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_TELEMETRY, length, &kind, 1, micros(), &crc);
+    write_payload(data, length, &crc);
+    end_frame(crc);
+}
+
+void PacketFraming::send_log(const uint8_t* data, uint16_t length) {
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_LOG, length, NULL, 0, micros(), &crc);
+    write_payload(data, length, &crc);
+    end_frame(crc);
+}
+
+void PacketFraming::send_nack(const uint16_t* sequences, size_t count) {
+    uint16_t crc;
+    begin_frame(FRAME_TYPE_NACK, count * 2, NULL, 0, micros(), &crc);
+    write_payload((const uint8_t*)sequences, count * 2, &crc);
+    end_frame(crc);
+}
+
+bool PacketFraming::resend(uint16_t sequence) {
+    uint16_t len;
+    const uint8_t* frame = retransmitRing.find(sequence, &len);
+    if (frame == NULL)
+        return false;
+
+    // Same frame with the flag set, the CRC has to be done again
+    uint8_t frameType = frame[0] | FRAME_FLAG_RETRANSMIT;
     uint16_t crc = 0;
-    
-    uint16_t frameLen = 0;
-    READ_AND_CRC(&frameLen, 2, crc);
-    READ_AND_CRC(address, 1, crc);
-    READ_AND_CRC(localPort, 2, crc);
-    READ_AND_CRC(remotePort, 2, crc);
+    update_crc16(&frameType, 1, &crc);
+    update_crc16(&frame[1], len - 1, &crc);
+
+    if (txMode == FRAMING_PREAMBLE)
+        uart_tx_write(PREAMBLE, sizeof(PREAMBLE));
+#if FRAME_FEC
+    else if (txMode == FRAMING_FEC)
+        fecWriter.begin();
+#endif
+    write(&frameType, 1);
+    write(&frame[1], len - 1);
+    end_frame(crc);
+    return true;
+}
+
+void PacketFraming::flush_batch() {
+#if BATCH_MAX_BYTES > 0
+    if (batchCount == 0)
+        return;
+
+    if (batchCount == 1) {
+        // A plain data frame is smaller than a batch of one
+        uint16_t dataLength;
+        memcpy(&dataLength, &batchBuffer[0], 2);
+        frame_address_t address;
+        get_frame_address(&batchBuffer[2], &address);
+        size_t frameLen = 0;
+        make_frame(&batchBuffer[BATCH_RECORD_HEADER_SIZE], dataLength & ~BATCH_SAME_PORTS, address, batchLocalPort, batchRemotePort, batchStartUs, &frameLen);
+    } else {
+        uint16_t crc;
+        begin_frame(FRAME_TYPE_BATCH, batchLen, NULL, 0, batchStartUs, &crc);
+        write_payload(batchBuffer, batchLen, &crc);
+        end_frame(crc);
+        latency_add(HOP_UDP_TO_SERIAL, micros() - batchStartUs);
+    }
+
+    batchLen = batchCount = 0;
+#endif
+}
+
+const uint8_t* PacketFraming::parse_frame(const uint8_t* data, size_t len, size_t* consumed, int8_t* status, FrameInfo* info, uint16_t* outputLength) {
+    const uint8_t* cur = data;
+    const uint8_t* end = data + len;
+
+    *status = -1;
+    *consumed = len;
+
+    while (cur < end) {
+        switch (parseState) {
+        case SCAN_PREAMBLE: {
+            if ((preambleScanIdx == 0) && (*cur == CODEC_FRAME_START)) {
+                read_reset_buffer(&codecReader);
+                read_process_byte(&codecReader, *(cur++));
+                parseState = READ_CODEC;
+                continue;
+            }
+#if FRAME_FEC
+            if ((preambleScanIdx == 0) && (*cur == FEC_FRAME_START)) {
+                cur++;
+                fecReader.begin();
+                parseState = READ_FEC;
+                continue;
+            }
+#endif
+
+            if (preambleScanIdx >= sizeof(PREAMBLE)) {
+                // Preamble is followed by the frame type
+                headerLen = header_size(*cur);
+                if (headerLen > 0) {
+                    readBuffer[0] = *(cur++);
+                    preambleScanIdx = 0;
+                    parseIdx = 1;
+                    parseState = READ_HEADER;
+                    continue;
+                }
+            } else if (*cur == PREAMBLE[preambleScanIdx]) {
+                cur++;
+                preambleScanIdx++;
+                continue;
+            }
+
+            *status = 0;
+            *consumed = cur - data;
+
+            if (preambleScanIdx > 0) {
+                // Bytes matched so far were not a preamble after all, return them to the text stream
+                // The current byte is left unconsumed, since it might start a new preamble
+                *outputLength = preambleScanIdx;
+                preambleScanIdx = 0;
+                return PREAMBLE;
+            }
+
+            // Return the whole run of text up to a potential frame start
+            const uint8_t* text = cur;
+            while ((cur < end) && (*cur != PREAMBLE[0]) && (*cur != CODEC_FRAME_START) && !IS_FEC_FRAME_START(*cur))
+                cur++;
+            *consumed = cur - data;
+            *outputLength = cur - text;
+            return text;
+        }
+
+        case READ_HEADER: {
+            size_t n = std::min((size_t)(headerLen - parseIdx), (size_t)(end - cur));
+            memcpy(&readBuffer[parseIdx], cur, n);
+            cur += n;
+            parseIdx += n;
+            if (parseIdx < headerLen)
+                break;
+
+            memcpy(&frameLen, &readBuffer[1], 2);
+            if (frameLen > BUFFER_SIZE) {
+                // Most likely a corrupted header, don't wait for a payload that might never come
+                LOG(LOG_WARN, LOG_FRAME_TOO_LONG, readBuffer[0], frameLen);
+                parseState = SCAN_PREAMBLE;
+                *status = -2;
+                *consumed = cur - data;
+                return NULL;
+            }
+            parseState = READ_BODY;
+            break;
+        }
+
+        case READ_BODY: {
+            // Payload and CRC
+            size_t bodyLen = headerLen + frameLen + CRC_SIZE;
+            size_t n = std::min((size_t)(bodyLen - parseIdx), (size_t)(end - cur));
+            memcpy(&readBuffer[parseIdx], cur, n);
+            cur += n;
+            parseIdx += n;
+            if (parseIdx < bodyLen)
+                break;
+
+            parseState = SCAN_PREAMBLE;
+            *consumed = cur - data;
+            rxMode = FRAMING_PREAMBLE;
+            return finish_frame(bodyLen, status, info, outputLength);
+        }
 
-    frameLen = std::min((uint16_t)BUFFER_SIZE, frameLen);
+        case READ_CODEC: {
+            size_t ret = read_process_byte(&codecReader, *(cur++));
+            if ((ret == NOT_COMPLETE) || (ret == NOT_COMPLETE_FRAME_START))
+                continue;
 
-    READ_AND_CRC(readBuffer, frameLen, crc);
+            parseState = SCAN_PREAMBLE;
+            *consumed = cur - data;
+            rxMode = FRAMING_DUMB_SERIAL;
+
+            size_t bodyLen = read_reset_buffer(&codecReader);
+            headerLen = (bodyLen > 0) ? header_size(readBuffer[0]) : 0;
+            if ((headerLen == 0) || (bodyLen < (headerLen + CRC_SIZE))) {
+                LOG(LOG_WARN, LOG_CODEC_BAD_FRAME, bodyLen, (bodyLen > 0) ? readBuffer[0] : 0);
+                *status = -2;
+                return NULL;
+            }
+
+            memcpy(&frameLen, &readBuffer[1], 2);
+            if (bodyLen != (headerLen + frameLen + CRC_SIZE)) {
+                LOG(LOG_WARN, LOG_CODEC_BAD_FRAME, bodyLen, readBuffer[0]);
+                *status = -2;
+                return NULL;
+            }
+            return finish_frame(bodyLen, status, info, outputLength);
+        }
+
+#if FRAME_FEC
+        case READ_FEC: {
+            uint8_t b = *(cur++);
+            if (b == FEC_FRAME_START) {
+                // Previous frame was never terminated
+                fecReader.begin();
+                continue;
+            }
+            if (b != FEC_FRAME_END) {
+                fecReader.add(b);
+                continue;
+            }
+
+            parseState = SCAN_PREAMBLE;
+            *consumed = cur - data;
+            rxMode = FRAMING_FEC;
+
+            int bodyLen = fecReader.finish(readBuffer, FRAME_BUFFER_SIZE);
+            headerLen = (bodyLen > 0) ? header_size(readBuffer[0]) : 0;
+            if ((headerLen == 0) || ((size_t)bodyLen < (headerLen + CRC_SIZE))) {
+                LOG(LOG_WARN, LOG_CODEC_BAD_FRAME, (bodyLen > 0) ? bodyLen : 0, (bodyLen > 0) ? readBuffer[0] : 0);
+                *status = -2;
+                return NULL;
+            }
+
+            memcpy(&frameLen, &readBuffer[1], 2);
+            if ((size_t)bodyLen != (headerLen + frameLen + CRC_SIZE)) {
+                LOG(LOG_WARN, LOG_CODEC_BAD_FRAME, bodyLen, readBuffer[0]);
+                *status = -2;
+                return NULL;
+            }
+            return finish_frame(bodyLen, status, info, outputLength);
+        }
+#endif
+        }
+    }
+
+    return NULL;
+}
+
+const uint8_t* PacketFraming::finish_frame(size_t bodyLen, int8_t* status, FrameInfo* info, uint16_t* outputLength) {
+    // Filled in before the CRC is checked, so broken frames can still be told apart for stats
+    const uint8_t* header = &readBuffer[COMMON_HEADER_SIZE];
+    info->type = readBuffer[0] & ~FRAME_FLAGS;
+    memcpy(&info->sequence, &readBuffer[3], 2);
+    info->retransmitted = readBuffer[0] & FRAME_FLAG_RETRANSMIT;
+    info->reliable = readBuffer[0] & FRAME_FLAG_RELIABLE;
+    info->hasTimestamps = readBuffer[0] & FRAME_FLAG_TIMESTAMPS;
+    if (info->hasTimestamps) {
+        memcpy(&info->networkRxUs, &header[0], 4);
+        memcpy(&info->serialTxUs, &header[4], 4);
+        header += TIMESTAMPS_SIZE;
+    }
+
+    if ((info->type == FRAME_TYPE_DATA) || (info->type == FRAME_TYPE_FRAGMENT))
+        header = get_frame_addressing(header, &info->address, &info->localPort, &info->remotePort);
+
+    if (info->type == FRAME_TYPE_MULTICAST) {
+        header = get_frame_ports(header, &info->localPort, &info->remotePort);
+        info->addressCount = header[0];
+    }
+
+    if (info->type == FRAME_TYPE_FRAGMENT) {
+        info->datagramId = header[0];
+        memcpy(&info->fragmentIndex, &header[1], 2);
+        memcpy(&info->fragmentCount, &header[3], 2);
+    }
+
+    uint16_t crc = 0;
+    update_crc16(readBuffer, bodyLen - CRC_SIZE, &crc);
 
     uint16_t frameCrc = 0;
-    read((uint8_t*)&frameCrc, 2);
+    memcpy(&frameCrc, &readBuffer[bodyLen - CRC_SIZE], 2);
 
     if (crc != frameCrc) {
         *status = -2;
-        
-        
-        printf("[DEBUG] Expected CRC %04hX, Got: %04hX\n", crc, frameCrc);
-        printf("[DEBUG] Read buffer:\n");
-        for (size_t i = 0; i < BUFFER_SIZE; i++)
-            printf("%02hhX ", readBuffer[i]);
-        printf("\n\n\n");
-
+        LOG(LOG_WARN, LOG_CRC_MISMATCH, crc, frameCrc, readBuffer[0], frameLen);
         return NULL;
     }
 
+    // Reply the same way the host talks to us
+    txMode = rxMode;
+
     *status = 1;
     *outputLength = frameLen;
-    return readBuffer;
+    return &readBuffer[headerLen];
+}
+
+uint32_t PacketFraming::take_corrected_chunks() {
+    return take_corrected_chunks(FRAMING_DUMB_SERIAL) + take_corrected_chunks(FRAMING_FEC);
+}
+
+uint32_t PacketFraming::take_corrected_chunks(uint8_t mode) {
+    if (mode == FRAMING_DUMB_SERIAL)
+        return read_take_corrected(&codecReader);
+#if FRAME_FEC
+    if (mode == FRAMING_FEC)
+        return fecReader.take_corrected();
+#endif
+    return 0;
 }
 
 void PacketFraming::write(const uint8_t* data, size_t len) {
-    Serial.write(data, len);
+    if (txMode == FRAMING_PREAMBLE) {
+        uart_tx_write(data, len);
+        return;
+    }
+#if FRAME_FEC
+    if (txMode == FRAMING_FEC) {
+        fecWriter.add(data, len);
+        return;
+    }
+#endif
+
+    // Feed the encoder at most one chunk at a time and pass whatever it produced straight to serial
+    while (len > 0) {
+        size_t n = std::min(len, (size_t)CODEC_CHUNK_BYTES);
+        write_process_bytes(&codecWriter, data, n);
+        flush_codec();
+        data += n;
+        len -= n;
+    }
 }
 
-void PacketFraming::read(uint8_t* data, size_t len) {
-   Serial.read(data, len);
+void PacketFraming::flush_codec() {
+    size_t len = write_reset_buffer(&codecWriter);
+    if (len > 0)
+        uart_tx_write(codecWriteBuffer, len);
 }
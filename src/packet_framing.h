@@ -1,26 +1,304 @@
-#define size_t uint32_t
+#ifndef PACKET_FRAMING_H
+#define PACKET_FRAMING_H
+
+#include <lwip/pbuf.h>
+
 #include "dumb_serial.h"
+#include "fec.h"
+#include "framing_profile.h"
+#include "retransmit.h"
+
+// Framing modes:
+// FRAMING_PREAMBLE    - raw frame after a 3 byte sync sequence, relies on the CRC alone
+// FRAMING_DUMB_SERIAL - frame encoded with dumb_serial, can repair one skipped byte per chunk
+// FRAMING_FEC         - frame encoded with the Reed-Solomon code in fec.h, overhead and strength set by CONFIG_FEC,
+//                       only when the framing profile has FRAME_FEC
+// The parser accepts all of them, FRAMING_MODE only selects what gets sent until the host sends a frame
+#define FRAMING_PREAMBLE 0
+#define FRAMING_DUMB_SERIAL 1
+#define FRAMING_FEC 2
+
+#ifndef FRAMING_MODE
+#define FRAMING_MODE FRAMING_PREAMBLE
+#endif
+static_assert(FRAME_FEC || (FRAMING_MODE != FRAMING_FEC), "FRAMING_FEC needs a framing profile with FEC");
+
+// Frame layout: type(1), length(2), sequence number(2, see retransmit.h), timestamps(8, only with FRAME_FLAG_TIMESTAMPS),
+// type specific header, payload(length), CRC16 over all of that
+// Addresses are FRAME_ADDRESS_SIZE and ports FRAME_PORT_SIZE bytes, set by the framing profile(see framing_profile.h)
+// FRAME_TYPE_DATA    - header: address, local port, remote port; payload: one UDP datagram
+// FRAME_TYPE_BATCH   - no header; payload: records of
+//                      length(2, top bit set = same ports as the previous record), address,
+//                      local port and remote port only if the top bit is clear, datagram(length)
+// FRAME_TYPE_CONTROL - no header; payload: command(1), sequence number(1), arguments
+// FRAME_TYPE_FRAGMENT - header: address, local port, remote port, datagram id(1), fragment index(2),
+//                      fragment count(2); payload: FRAGMENT_SIZE bytes of the datagram, less in the last fragment
+//                      Datagrams longer than FRAGMENT_SIZE are sent this way, both sides reject longer frames
+//                      Fragments of one datagram are sent in order, but fragments of other datagrams may come in between
+// FRAME_TYPE_DELTA   - dongle->host only, see delta.h. header: stream(1), sequence(1)
+//                      payload with DELTA_KEYFRAME set in sequence: address, local port, remote port, datagram
+//                      otherwise for every 8 bytes of the datagram a mask(1, bit n = byte n changed) followed by
+//                      the changed bytes, against the previous datagram of the stream, which has sequence - 1
+// FRAME_TYPE_TELEMETRY - dongle->host only, header: kind(1); payload: counters or a report, see telemetry.h
+// FRAME_TYPE_LOG     - dongle->host only, no header; payload: log records, see log.h
+// FRAME_TYPE_NACK    - no header; payload: sequence numbers(2 each) of frames from the other side that never arrived
+// FRAME_TYPE_MULTICAST - host->dongle only. header: local port, remote port, address count(1);
+//                      payload: addresses(count), one UDP datagram that goes to each of them
+//                      A count of 0 sends the datagram once to the broadcast address of the access point's subnet
+// FRAME_FLAG_TIMESTAMPS - microsecond timestamps in the sender's clock:
+//                      when the datagram arrived from the network(oldest one for batches), when the frame was sent
+// FRAME_FLAG_RETRANSMIT - sent again after a NACK, with the sequence number and timestamps it had the first time
+// FRAME_FLAG_RELIABLE - kept for NACKs, the sequence number counts only these frames(see retransmit.h)
+#define FRAME_TYPE_DATA 0x81
+#define FRAME_TYPE_BATCH 0x82
+#define FRAME_TYPE_CONTROL 0x83
+#define FRAME_TYPE_FRAGMENT 0x84
+#define FRAME_TYPE_DELTA 0x85
+#define FRAME_TYPE_TELEMETRY 0x86
+#define FRAME_TYPE_LOG 0x87
+#define FRAME_TYPE_NACK 0x88
+#define FRAME_TYPE_MULTICAST 0x89
+#define FRAME_FLAG_TIMESTAMPS 0x40
+#define FRAME_FLAG_RETRANSMIT 0x20
+#define FRAME_FLAG_RELIABLE 0x10
+#define FRAME_FLAGS (FRAME_FLAG_TIMESTAMPS | FRAME_FLAG_RETRANSMIT | FRAME_FLAG_RELIABLE)
+
+// Control commands, sent by the host
+// Each one is answered with a CONTROL frame: command | CONTROL_ACK, the same sequence number, status(1), reply data
+// Send per hop latency histograms(see latency.h) as a TELEMETRY frame and start a new window, CONTROL_STATUS_UNKNOWN without
+// LATENCY_STATS
+#define CONTROL_LATENCY_REPORT 0x01
+// Arguments: key(1, CONFIG_*), value(4)
+#define CONTROL_SET_CONFIG 0x02
+// Reply data: key(1), value(4) for each CONFIG_*, then port count(1), ports(2 each), reliable ports(1, bit n = port n)
+#define CONTROL_GET_CONFIG 0x03
+// Start/stop listening on a UDP port. Arguments: port(2)
+#define CONTROL_ADD_PORT 0x04
+#define CONTROL_REMOVE_PORT 0x05
+// Arguments: baud(4). Acked at the old rate, then the dongle switches and goes back
+// unless CONTROL_BAUD_CONFIRM arrives within BAUD_CONFIRM_MS(see baud.h)
+#define CONTROL_SET_BAUD 0x06
+#define CONTROL_BAUD_CONFIRM 0x07
+// Reply data is a copy of the arguments, a test pattern for measuring the link
+#define CONTROL_ECHO 0x08
+// Sends the next datagram of every stream as a keyframe, for when the host lost a DELTA frame
+#define CONTROL_RESYNC 0x09
+// Arguments: port(2), reliable(1). DATA frames of a reliable port are sent again when the other side NACKs them,
+// in both directions. Its datagrams are never batched or sent as deltas, longer ones still go out in fragments
+// that aren't kept. See retransmit.h
+#define CONTROL_SET_RELIABLE 0x0A
+// Send where the loop spends its cycles(see loop_profiler.h) as TELEMETRY frames and start a new window,
+// CONTROL_STATUS_UNKNOWN without LOOP_PROFILER
+#define CONTROL_PROFILER_REPORT 0x0B
+#define CONTROL_ACK 0x80
+
+#define CONTROL_STATUS_OK 0
+// Unknown command or config key
+#define CONTROL_STATUS_UNKNOWN 1
+// Malformed arguments or value out of range
+#define CONTROL_STATUS_BAD_VALUE 2
+// Valid request that couldn't be carried out(bind failed, no free socket...)
+#define CONTROL_STATUS_FAILED 3
+
+// Runtime settings for CONTROL_SET_CONFIG/CONTROL_GET_CONFIG
+// FRAME_TYPE_TELEMETRY interval, 0 turns it off
+#define CONFIG_STATS_INTERVAL_MS 0x01
+// In 0.25 dBm steps, 0-82
+#define CONFIG_TX_POWER 0x02
+// WiFiPhyMode_t
+#define CONFIG_PHY_MODE 0x03
+// WiFiSleepType_t
+#define CONFIG_SLEEP_MODE 0x04
+// Datagrams queued per UDP port before new ones are dropped, 1-RAW_UDP_QUEUE_LEN
+#define CONFIG_UDP_QUEUE_LEN 0x05
+// 0 turns batching off, can't be more than BATCH_MAX_BYTES
+#define CONFIG_BATCH_MAX_BYTES 0x06
+#define CONFIG_BATCH_HOLD_US 0x07
+// WiFi->serial queue budget in payload bytes, 1-TX_QUEUE_MAX_BYTES(see tx_queue.h)
+#define CONFIG_TX_QUEUE_BYTES 0x08
+// TX_DROP_*
+#define CONFIG_TX_DROP_POLICY 0x09
+// 1 sends datagrams of up to DELTA_MAX_LEN in DELTA frames(see delta.h), 0 as they are
+#define CONFIG_COMPRESSION 0x0A
+// FRAMING_FEC profile the dongle sends with: parity bytes | codeword length << 8, see fec.h
+#define CONFIG_FEC 0x0B
+// Bit n lets rule n of coalesce.cpp replace queued WiFi->serial datagrams with newer ones, 0 turns it off
+#define CONFIG_COALESCE 0x0C
+
+struct FrameInfo {
+    // FRAME_TYPE_*, without flags
+    uint8_t type;
+    // Only set for FRAME_TYPE_DATA and FRAME_TYPE_FRAGMENT
+    frame_address_t address;
+    // Also set for FRAME_TYPE_MULTICAST
+    uint16_t localPort, remotePort;
+    // Only set for FRAME_TYPE_MULTICAST, the payload starts with this many addresses
+    uint8_t addressCount;
+    // Only set for FRAME_TYPE_FRAGMENT
+    uint8_t datagramId;
+    uint16_t fragmentIndex, fragmentCount;
+
+    uint16_t sequence;
+    bool retransmitted;
+    // Numbered in the sequence of reliable frames
+    bool reliable;
+
+    bool hasTimestamps;
+    uint32_t networkRxUs, serialTxUs;
+};
+
+// WiFi->serial batching: datagrams are packed into one BATCH frame of up to BATCH_MAX_BYTES of records
+// A batch is sent once full or once its oldest datagram is BATCH_MAX_HOLD_US old. 0 bytes disables batching
+// Both are defaults, the size can be lowered and the hold time changed at runtime
+#ifndef BATCH_MAX_BYTES
+#define BATCH_MAX_BYTES 0
+#endif
+#ifndef BATCH_MAX_HOLD_US
+#define BATCH_MAX_HOLD_US 2000
+#endif
 
 class PacketFraming {
 public:
     PacketFraming();
-    ~PacketFraming();
 
     // Returned pointer - array of bytes of length outputLength
     // Valid until next call to make_frame
-    uint8_t* make_frame(uint8_t* data, uint16_t dataLength, uint8_t address, uint16_t localPort, uint16_t remotePort, size_t* outputLength);
-    
+    // rxTimeUs - when the datagram was received from the network
+    uint8_t* make_frame(uint8_t* data, uint16_t dataLength, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs, size_t* outputLength);
+    // Same, but the payload is written straight from the pbuf chain, the CRC is computed over it in place
+    // The pbuf is not needed anymore once this returns
+    void make_frame(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs);
+    // One FRAGMENT frame with the part of a datagram longer than FRAGMENT_SIZE that starts at offset
+    // offset has to be a multiple of FRAGMENT_SIZE. Returns the number of datagram bytes it carried
+    uint16_t make_fragment(const pbuf* p, uint16_t offset, uint8_t datagramId, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs);
+    // One DELTA frame, data is what DeltaEncoder::encode returned
+    void make_delta(const uint8_t* data, uint16_t dataLength, uint8_t stream, uint8_t sequence, uint32_t rxTimeUs);
+
+    // Same as make_frame, but the datagram may be held back and sent together with others in a BATCH frame
+    // Both only take datagrams of up to FRAGMENT_SIZE, longer ones go through make_fragment
+    void add_to_batch(const pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs);
+    // Sends the batch if it is older than BATCH_MAX_HOLD_US
+    void update_batch(uint32_t nowUs);
+    void flush_batch();
+    bool batch_pending() const { return batchCount > 0; }
+
+    // maxBytes can't be more than BATCH_MAX_BYTES, 0 sends every datagram right away
+    bool set_batch_max_bytes(uint16_t maxBytes);
+    uint16_t get_batch_max_bytes() { return batchMaxBytes; }
+    void set_batch_hold_us(uint32_t holdUs) { batchHoldUs = holdUs; }
+    uint32_t get_batch_hold_us() { return batchHoldUs; }
+
+    // Space the UART TX ring needs for make_frame/add_to_batch with a datagram of this size not to wait
+    size_t tx_space_needed(uint16_t dataLength);
+    // Upper bound for one frame with this much payload, as it is written to the UART
+    size_t max_frame_size(uint16_t dataLength);
+
+    // Sends a CONTROL frame, data is the payload starting with the command byte
+    void send_control(const uint8_t* data, uint16_t length);
+    // Sends a TELEMETRY frame, kind is TELEMETRY_*, data is what telemetry_build or the report of that kind returned
+    void send_telemetry(uint8_t kind, const uint8_t* data, uint16_t length);
+    // Sends a LOG frame, data is what log_take returned
+    void send_log(const uint8_t* data, uint16_t length);
+    // Sends a NACK frame, see retransmit.h
+    void send_nack(const uint16_t* sequences, size_t count);
+
+    // The next frame is kept, so resend can send it again when the host NACKs it
+    void keep_next_frame() { keepNext = true; }
+    // Sends a kept frame again, false if it isn't kept(anymore)
+    bool resend(uint16_t sequence);
+
+    // Incremental parser, never waits for more input
+    // Consumes bytes from data until there is something to hand back or until the input runs out
+    // consumed is an output value - how many bytes of data were used, the rest should be passed to the next call
     // status is an output value
-    // meaning: 0 = byte is not part of a frame, -1 = frame is not complete yet, -2 = crc error, 1 = frame complete
-    // returned pointer, address, port and outputLength are only valid if status = 1
-    // Returned pointer - array of bytes of length outputLength
-    // Valid until next call to make_frame
-    uint8_t* parse_frame(uint8_t next_byte, int8_t* status, uint8_t* address, uint16_t* localPort, uint16_t* remotePort, uint16_t* outputLength);
+    // meaning: 0 = bytes are not part of a frame, -1 = frame is not complete yet, -2 = crc error, 1 = frame complete
+    // status = 0: returned pointer is an array of non-frame(text) bytes of length outputLength
+    //             this includes sync bytes that turned out not to start a frame
+    // status = 1: returned pointer is the frame payload of length outputLength, info is filled in
+    // status = -2: info->type is 0, or the frame type and for DATA/FRAGMENT the address, both might be corrupted
+    // Returned pointer is valid until next call to parse_frame or until data is overwritten
+    const uint8_t* parse_frame(const uint8_t* data, size_t len, size_t* consumed, int8_t* status, FrameInfo* info, uint16_t* outputLength);
+
+    // Framing used by make_frame, follows whatever the host used last
+    uint8_t get_tx_mode() { return txMode; }
+    void set_tx_mode(uint8_t mode) { txMode = mode; }
+
+    // FRAMING_FEC parity bytes per codeword and codeword length, false if out of range or built without FRAME_FEC
+#if FRAME_FEC
+    bool set_fec_profile(uint8_t parity, uint8_t length) { return fecWriter.set_profile(parity, length); }
+    uint8_t get_fec_parity() const { return fecWriter.get_parity(); }
+    uint8_t get_fec_length() const { return fecWriter.get_length(); }
+#else
+    bool set_fec_profile(uint8_t parity, uint8_t length) { return false; }
+    uint8_t get_fec_parity() const { return 0; }
+    uint8_t get_fec_length() const { return 0; }
+#endif
+
+    // Number of dumb_serial chunks and FEC codewords repaired since the last call
+    uint32_t take_corrected_chunks();
+    // The same for one framing, FRAMING_DUMB_SERIAL or FRAMING_FEC, the other counter is left alone
+    uint32_t take_corrected_chunks(uint8_t mode);
 
 private:
+    static size_t header_size(uint8_t frameType);
+
+    // Frames are written as header, payload pieces and CRC, without assembling them in a buffer first
+    // typeHeader - the FRAME_TYPE_* specific header, typeHeaderLen bytes
+    void begin_frame(uint8_t frameType, uint16_t length, const uint8_t* typeHeader, size_t typeHeaderLen, uint32_t rxTimeUs, uint16_t* crc);
+    void write_payload(const uint8_t* data, size_t len, uint16_t* crc);
+    void write_payload(const pbuf* p, uint16_t offset, uint16_t len, uint16_t* crc);
+    void end_frame(uint16_t crc);
+
     void write(const uint8_t* data, size_t len);
-    void read(uint8_t* data, size_t len);
+    void flush_codec();
 
+    const uint8_t* finish_frame(size_t bodyLen, int8_t* status, FrameInfo* info, uint16_t* outputLength);
+
+    enum ParseState : uint8_t {
+        SCAN_PREAMBLE,
+        READ_HEADER,
+        READ_BODY,
+        READ_CODEC,
+#if FRAME_FEC
+        READ_FEC,
+#endif
+    };
+
+    ParseState parseState;
     uint8_t preambleScanIdx;
-    uint8_t* readBuffer;
+    uint8_t rxMode, txMode;
+    uint16_t parseIdx;
+    uint16_t headerLen;
+    uint16_t frameLen;
+
+    // Header, payload, CRC
+    uint8_t readBuffer[FRAME_BUFFER_SIZE];
+
+    read_state_t codecReader;
+    write_state_t codecWriter;
+    // Encoder output is flushed to serial after every chunk, so this only has to hold one
+    uint8_t codecWriteBuffer[32];
+
+#if FRAME_FEC
+    FecEncoder fecWriter;
+    FecDecoder fecReader;
+#endif
+
+    // Of the frames that aren't kept and the ones that are(FRAME_FLAG_RELIABLE)
+    uint16_t txSequence, txReliableSequence;
+    // keep_next_frame was called, and where the frame being written is kept
+    bool keepNext;
+    uint8_t* keepPtr;
+    RetransmitRing retransmitRing;
+
+#if BATCH_MAX_BYTES > 0
+    uint8_t batchBuffer[BATCH_MAX_BYTES];
+#endif
+    uint16_t batchLen, batchCount;
+    uint16_t batchLocalPort, batchRemotePort;
+    uint32_t batchStartUs;
+    uint16_t batchMaxBytes;
+    uint32_t batchHoldUs;
 };
+
+#endif
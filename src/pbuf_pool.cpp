@@ -0,0 +1,53 @@
+#include "pbuf_pool.h"
+
+
+PbufPool pbufPool;
+
+PbufPool::PbufPool() : nextSlot(0), exhausted(0) {
+    for (int i = 0; i < PBUF_POOL_SLOTS; i++) {
+        slots[i].pc.custom_free_function = &PbufPool::on_free;
+        slots[i].used.store(false, std::memory_order_relaxed);
+    }
+}
+
+void PbufPool::on_free(pbuf* p) {
+    // pc is the first member
+    Slot* slot = (Slot*)p;
+    slot->used.store(false, std::memory_order_release);
+}
+
+pbuf* PbufPool::alloc(pbuf_layer layer, uint16_t len) {
+    if (len > FRAGMENT_SIZE)
+        return NULL;
+
+    for (int i = 0; i < PBUF_POOL_SLOTS; i++) {
+        Slot* slot = &slots[(nextSlot + i) % PBUF_POOL_SLOTS];
+        if (slot->used.load(std::memory_order_acquire))
+            continue;
+
+        // PBUF_REF tells lwIP the payload can't grow into headers, see alloc()
+        pbuf_type type = (layer == PBUF_RAW) ? PBUF_REF : PBUF_RAM;
+        pbuf* p = pbuf_alloced_custom(layer, len, type, &slot->pc, slot->mem, sizeof(slot->mem));
+        if (p == NULL)
+            return NULL;
+        slot->used.store(true, std::memory_order_relaxed);
+        nextSlot = (nextSlot + i + 1) % PBUF_POOL_SLOTS;
+        return p;
+    }
+
+    exhausted++;
+    return NULL;
+}
+
+uint8_t PbufPool::in_use() const {
+    uint8_t ret = 0;
+    for (int i = 0; i < PBUF_POOL_SLOTS; i++)
+        ret += slots[i].used.load(std::memory_order_relaxed);
+    return ret;
+}
+
+uint32_t PbufPool::take_exhausted() {
+    uint32_t ret = exhausted;
+    exhausted = 0;
+    return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef PBUF_POOL_H
+#define PBUF_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <lwip/pbuf.h>
+
+#include "packet_framing.h"
+
+// pbufs for serial->WiFi datagrams from a fixed set of static buffers, so sending and reassembly never touch the heap
+// Each buffer takes up to FRAGMENT_SIZE bytes with room for the UDP/IP headers in front, longer datagrams are chains
+// A buffer is free again once lwIP lets go of its pbuf, which can be after udp_sendto() returned(the WiFi driver
+// keeps a reference until the frame is out). That happens in lwIP's context, so the flags are atomic
+
+// Enough for the longest datagram of the framing profile, more lets datagrams wait on the WiFi driver while others come in
+#ifndef PBUF_POOL_SLOTS
+#define PBUF_POOL_SLOTS FRAME_MAX_FRAGMENTS
+#endif
+static_assert(PBUF_POOL_SLOTS >= FRAME_MAX_FRAGMENTS, "PBUF_POOL_SLOTS can't hold the longest datagram, see FRAME_MAX_DATAGRAM_SIZE");
+
+class PbufPool {
+public:
+    PbufPool();
+
+    // len - up to FRAGMENT_SIZE bytes
+    // layer - PBUF_TRANSPORT for a datagram or its first fragment, PBUF_RAW for fragments chained after it
+    //         or a datagram for several addresses: lwIP never writes headers into a PBUF_RAW one, it chains its own
+    //         in front for every udp_sendto(), so copies the WiFi driver still holds stay intact
+    // NULL if every buffer is in use
+    pbuf* alloc(pbuf_layer layer, uint16_t len);
+
+    // Buffers taken right now
+    uint8_t in_use() const;
+    // Allocations that found every buffer in use, since the last call
+    uint32_t take_exhausted();
+
+private:
+    static void on_free(pbuf* p);
+
+    struct Slot {
+        // lwIP finds the header room for a PBUF_RAM pbuf right behind the struct, so mem has to follow it
+        pbuf_custom pc;
+        alignas(4) uint8_t mem[((PBUF_TRANSPORT + 3) & ~3) + FRAGMENT_SIZE];
+        std::atomic<bool> used;
+    };
+
+    Slot slots[PBUF_POOL_SLOTS];
+    // Where the search for a free buffer starts
+    uint8_t nextSlot;
+    uint32_t exhausted;
+};
+
+extern PbufPool pbufPool;
+
+#endif
@@ -0,0 +1,195 @@
+#include <coredecls.h>
+
+#include "pbuf_pool.h"
+#include "raw_udp.h"
+
+
+// The free-running uint8_t indices wrap at a multiple of it
+static_assert(((RAW_UDP_QUEUE_LEN & (RAW_UDP_QUEUE_LEN - 1)) == 0) && (RAW_UDP_QUEUE_LEN <= 128), "RAW_UDP_QUEUE_LEN must be a power of two up to 128");
+static_assert(((RAW_UDP_DROP_LOG_LEN & (RAW_UDP_DROP_LOG_LEN - 1)) == 0) && (RAW_UDP_DROP_LOG_LEN <= 128), "RAW_UDP_DROP_LOG_LEN must be a power of two up to 128");
+
+
+RawUdp::RawUdp() : pcb(NULL), port(0), rxHead(0), rxTail(0), rxLimit(RAW_UDP_QUEUE_LEN), dropped(0), droppedTaken(0), dropHead(0), dropTail(0) {
+    for (uint8_t i = 0; i < RAW_UDP_DROP_LOG_LEN; i++) {
+        dropLog[i].count.store(0, std::memory_order_relaxed);
+        dropLog[i].taken = 0;
+    }
+}
+
+RawUdp::~RawUdp() {
+    stop();
+}
+
+bool RawUdp::begin(uint16_t localPort) {
+    if (pcb != NULL)
+        return false;
+
+    pcb = udp_new();
+    if (pcb == NULL)
+        return false;
+
+    if (udp_bind(pcb, IP_ADDR_ANY, localPort) != ERR_OK) {
+        udp_remove(pcb);
+        pcb = NULL;
+        return false;
+    }
+
+    // lwIP refuses broadcasts(FRAME_TYPE_MULTICAST without addresses) from pcbs without it
+    ip_set_option(pcb, SOF_BROADCAST);
+    udp_recv(pcb, &RawUdp::on_recv, this);
+    port = localPort;
+    return true;
+}
+
+void RawUdp::stop() {
+    // No more callbacks once the pcb is gone
+    if (pcb != NULL)
+        udp_remove(pcb);
+    pcb = NULL;
+    port = 0;
+
+    while (available())
+        pop();
+    for (uint8_t i = 0; i < RAW_UDP_DROP_LOG_LEN; i++)
+        dropLog[i].taken = 0;
+    dropHead.store(dropTail.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+bool RawUdp::set_queue_limit(uint8_t limit) {
+    if ((limit < 1) || (limit > RAW_UDP_QUEUE_LEN))
+        return false;
+    // Already queued datagrams above the new limit are still delivered
+    rxLimit = limit;
+    return true;
+}
+
+// The producer side of the queue
+void RawUdp::on_recv(void* arg, udp_pcb* pcb, pbuf* p, const ip_addr_t* addr, u16_t port) {
+    RawUdp* self = (RawUdp*)arg;
+
+    uint8_t tail = self->rxTail.load(std::memory_order_relaxed);
+    if ((uint8_t)(tail - self->rxHead.load(std::memory_order_acquire)) >= self->rxLimit) {
+        pbuf_free(p);
+        self->dropped.store(self->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        self->log_drop(addr);
+        return;
+    }
+
+    QueuedPacket& packet = self->rxQueue[tail % RAW_UDP_QUEUE_LEN];
+    packet.p = p;
+    // addr points into the packet headers, keep a copy
+    packet.addr = *addr;
+    packet.port = port;
+    packet.rxTimeUs = micros();
+    self->rxTail.store(tail + 1, std::memory_order_release);
+
+    esp_schedule();
+}
+
+const pbuf* RawUdp::peek(IPAddress* remoteIP, uint16_t* remotePort, uint32_t* rxTimeUs) {
+    if (!available())
+        return NULL;
+
+    QueuedPacket& packet = rxQueue[rxHead.load(std::memory_order_relaxed) % RAW_UDP_QUEUE_LEN];
+    const ip4_addr_t* addr = ip_2_ip4(&packet.addr);
+    *remoteIP = IPAddress(ip4_addr1(addr), ip4_addr2(addr), ip4_addr3(addr), ip4_addr4(addr));
+    *remotePort = packet.port;
+    *rxTimeUs = packet.rxTimeUs;
+    return packet.p;
+}
+
+void RawUdp::pop() {
+    if (!available())
+        return;
+
+    uint8_t head = rxHead.load(std::memory_order_relaxed);
+    pbuf_free(rxQueue[head % RAW_UDP_QUEUE_LEN].p);
+    rxHead.store(head + 1, std::memory_order_release);
+}
+
+pbuf* RawUdp::take(IPAddress* remoteIP, uint16_t* remotePort, uint32_t* rxTimeUs) {
+    pbuf* p = (pbuf*)peek(remoteIP, remotePort, rxTimeUs);
+    if (p == NULL)
+        return NULL;
+
+    rxHead.store(rxHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return p;
+}
+
+bool RawUdp::send(const IPAddress& ip, uint16_t remotePort, const uint8_t* data, size_t len) {
+    if (pcb == NULL)
+        return false;
+
+    pbuf* p = pbufPool.alloc(PBUF_TRANSPORT, len);
+    if (p == NULL)
+        return false;
+    pbuf_take(p, data, len);
+
+    bool ret = send(ip, remotePort, p);
+    pbuf_free(p);
+    return ret;
+}
+
+bool RawUdp::send(const IPAddress& ip, uint16_t remotePort, pbuf* p) {
+    if (pcb == NULL)
+        return false;
+
+    ip_addr_t addr;
+    IP_ADDR4(&addr, ip[0], ip[1], ip[2], ip[3]);
+    return udp_sendto(pcb, p, &addr, remotePort) == ERR_OK;
+}
+
+uint32_t RawUdp::take_dropped() {
+    uint32_t total = dropped.load(std::memory_order_relaxed);
+    uint32_t ret = total - droppedTaken;
+    droppedTaken = total;
+    return ret;
+}
+
+// Called by on_recv only
+void RawUdp::log_drop(const ip_addr_t* addr) {
+    const ip4_addr_t* ip = ip_2_ip4(addr);
+    frame_address_t address = frame_address(IPAddress(ip4_addr1(ip), ip4_addr2(ip), ip4_addr3(ip), ip4_addr4(ip)));
+
+    uint8_t tail = dropTail.load(std::memory_order_relaxed);
+    if (tail != dropHead.load(std::memory_order_acquire)) {
+        // The loop never removes the newest record
+        DropRecord& last = dropLog[(uint8_t)(tail - 1) % RAW_UDP_DROP_LOG_LEN];
+        if (last.address == address) {
+            last.count.store(last.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            return;
+        }
+    }
+    if ((uint8_t)(tail - dropHead.load(std::memory_order_acquire)) >= RAW_UDP_DROP_LOG_LEN)
+        return;
+
+    // Records are only reused once the loop moved past them and reset taken
+    DropRecord& record = dropLog[tail % RAW_UDP_DROP_LOG_LEN];
+    record.address = address;
+    record.count.store(1, std::memory_order_relaxed);
+    dropTail.store(tail + 1, std::memory_order_release);
+}
+
+bool RawUdp::take_dropped_address(frame_address_t* address, uint32_t* count) {
+    while (true) {
+        uint8_t head = dropHead.load(std::memory_order_relaxed);
+        uint8_t tail = dropTail.load(std::memory_order_acquire);
+        if (tail == head)
+            return false;
+
+        DropRecord& record = dropLog[head % RAW_UDP_DROP_LOG_LEN];
+        uint32_t total = record.count.load(std::memory_order_acquire);
+        *address = record.address;
+        *count = total - record.taken;
+        record.taken = total;
+        // on_recv may still add to the newest one, the others are done
+        if ((uint8_t)(head + 1) != tail) {
+            record.taken = 0;
+            dropHead.store(head + 1, std::memory_order_release);
+        }
+        if (*count > 0)
+            return true;
+        if ((uint8_t)(head + 1) == tail)
+            return false;
+    }
+}
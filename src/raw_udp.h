@@ -0,0 +1,95 @@
+#ifndef RAW_UDP_H
+#define RAW_UDP_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <lwip/udp.h>
+
+#include <atomic>
+
+#include "framing_profile.h"
+
+// UDP socket on the raw lwIP API
+// Datagrams are queued by the lwIP receive callback, which also wakes the main loop with esp_schedule(),
+// so the loop doesn't have to poll parsePacket() on every socket
+// The queue is a lock-free single producer(the callback), single consumer(everything else) ring, so the callback
+// may run in another task or on another core than the loop
+
+// Queue capacity, how much of it is used can be lowered at runtime with set_queue_limit()
+// Has to be a power of two
+#define RAW_UDP_QUEUE_LEN 16
+// Senders of dropped datagrams kept until the loop charges them to their trackers, has to be a power of two
+// Consecutive drops from one sender take one entry, drops past that still count in take_dropped()
+#define RAW_UDP_DROP_LOG_LEN 8
+
+class RawUdp {
+public:
+    RawUdp();
+    ~RawUdp();
+
+    bool begin(uint16_t port);
+    // Unbinds and drops everything still queued
+    void stop();
+    // 0 if not bound
+    uint16_t localPort() const { return port; }
+
+    // 1..RAW_UDP_QUEUE_LEN, datagrams arriving while this many are queued are dropped
+    bool set_queue_limit(uint8_t limit);
+    uint8_t queue_limit() const { return rxLimit; }
+
+    bool available() const { return rxTail.load(std::memory_order_acquire) != rxHead.load(std::memory_order_relaxed); }
+
+    // Oldest queued datagram, NULL if the queue is empty
+    // The pbuf stays queued until pop(), so it can be used without copying it out first
+    // rxTimeUs - when the datagram was handed over by lwIP
+    const pbuf* peek(IPAddress* remoteIP, uint16_t* remotePort, uint32_t* rxTimeUs);
+    // Removes the oldest queued datagram and frees its pbuf
+    void pop();
+    // Same as peek() followed by pop(), except the pbuf is handed over instead of freed
+    pbuf* take(IPAddress* remoteIP, uint16_t* remotePort, uint32_t* rxTimeUs);
+
+    // Up to FRAGMENT_SIZE bytes, copied into a pbuf from pbufPool
+    bool send(const IPAddress& ip, uint16_t remotePort, const uint8_t* data, size_t len);
+    // Sends the pbuf(chain) as it is, it still has to be freed by the caller
+    bool send(const IPAddress& ip, uint16_t remotePort, pbuf* p);
+
+    // Datagrams dropped because the queue was full, since the last call
+    uint32_t take_dropped();
+    // Sender of the oldest drops not taken yet and how many, false if there are none
+    // The callback can't touch the tracker table itself, the loop may be updating it at the same time
+    bool take_dropped_address(frame_address_t* address, uint32_t* count);
+
+private:
+    static void on_recv(void* arg, udp_pcb* pcb, pbuf* p, const ip_addr_t* addr, u16_t port);
+    void log_drop(const ip_addr_t* addr);
+
+    struct QueuedPacket {
+        pbuf* p;
+        ip_addr_t addr;
+        uint16_t port;
+        uint32_t rxTimeUs;
+    };
+
+    udp_pcb* pcb;
+    uint16_t port;
+
+    QueuedPacket rxQueue[RAW_UDP_QUEUE_LEN];
+    // Free-running, rxTail is only stored by on_recv and rxHead by the consumer
+    std::atomic<uint8_t> rxHead, rxTail;
+    uint8_t rxLimit;
+    // Only stored by on_recv, take_dropped() returns how far it got since the last call
+    std::atomic<uint32_t> dropped;
+    uint32_t droppedTaken;
+    struct DropRecord {
+        frame_address_t address;
+        // Only stored by on_recv, taken is how far the loop got, like dropped/droppedTaken
+        std::atomic<uint32_t> count;
+        uint32_t taken;
+    };
+
+    // Same scheme as rxQueue, except the newest record is never removed so on_recv can keep adding to it
+    DropRecord dropLog[RAW_UDP_DROP_LOG_LEN];
+    std::atomic<uint8_t> dropHead, dropTail;
+};
+
+#endif
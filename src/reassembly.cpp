@@ -0,0 +1,127 @@
+#include <Arduino.h>
+
+#include "pbuf_pool.h"
+#include "reassembly.h"
+#include "telemetry.h"
+
+
+Reassembly::Reassembly() : dropped(0) {
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++)
+        slots[i].p = NULL;
+}
+
+Reassembly::~Reassembly() {
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if (slots[i].p != NULL)
+            pbuf_free(slots[i].p);
+}
+
+Reassembly::Slot* Reassembly::find(const FrameInfo& info) {
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++) {
+        Slot* slot = &slots[i];
+        if ((slot->p != NULL) && (slot->address == info.address) && (slot->localPort == info.localPort) &&
+            (slot->remotePort == info.remotePort) && (slot->datagramId == info.datagramId))
+            return slot;
+    }
+    return NULL;
+}
+
+void Reassembly::drop(Slot* slot) {
+    pbuf_free(slot->p);
+    slot->p = NULL;
+    dropped++;
+    telemetry_dropped(slot->address);
+}
+
+pbuf* Reassembly::add(const FrameInfo& info, const uint8_t* data, uint16_t len) {
+    if ((info.fragmentIndex >= info.fragmentCount) || (len == 0))
+        return NULL;
+
+    // The host doesn't send them, see FRAME_MAX_DATAGRAM_SIZE. Counted once, by the first fragment
+    if (info.fragmentCount > FRAME_MAX_FRAGMENTS) {
+        if (info.fragmentIndex == 0) {
+            dropped++;
+            telemetry_dropped(info.address);
+        }
+        return NULL;
+    }
+
+    Slot* slot = find(info);
+
+    if (info.fragmentIndex == 0) {
+        // Same id again, the previous one never completed
+        if (slot != NULL)
+            drop(slot);
+
+        slot = &slots[0];
+        for (int i = 0; i < REASSEMBLY_SLOTS; i++) {
+            if (slots[i].p == NULL) {
+                slot = &slots[i];
+                break;
+            }
+            if ((int32_t)(slots[i].lastMs - slot->lastMs) < 0)
+                slot = &slots[i];
+        }
+        if (slot->p != NULL)
+            drop(slot);
+
+        // Room for the UDP/IP headers in front, so lwIP doesn't need another pbuf for them
+        slot->p = pbufPool.alloc(PBUF_TRANSPORT, len);
+        if (slot->p == NULL) {
+            dropped++;
+            telemetry_dropped(info.address);
+            return NULL;
+        }
+        pbuf_take(slot->p, data, len);
+
+        slot->address = info.address;
+        slot->localPort = info.localPort;
+        slot->remotePort = info.remotePort;
+        slot->datagramId = info.datagramId;
+        slot->count = info.fragmentCount;
+        slot->lastMs = millis();
+    } else {
+        if (slot == NULL) {
+            // Missed the start, count the datagram only once
+            if (info.fragmentIndex == (info.fragmentCount - 1)) {
+                dropped++;
+                telemetry_dropped(info.address);
+            }
+            return NULL;
+        }
+        if ((info.fragmentIndex != slot->nextIndex) || (info.fragmentCount != slot->count) ||
+            (((uint32_t)slot->p->tot_len + len) > 0xFFFF)) {
+            drop(slot);
+            return NULL;
+        }
+
+        pbuf* q = pbufPool.alloc(PBUF_RAW, len);
+        if (q == NULL) {
+            drop(slot);
+            return NULL;
+        }
+        pbuf_take(q, data, len);
+        pbuf_cat(slot->p, q);
+        slot->lastMs = millis();
+    }
+
+    slot->nextIndex = info.fragmentIndex + 1;
+    if (slot->nextIndex < slot->count)
+        return NULL;
+
+    pbuf* ret = slot->p;
+    slot->p = NULL;
+    return ret;
+}
+
+void Reassembly::expire(uint32_t nowMs) {
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if ((slots[i].p != NULL) && ((nowMs - slots[i].lastMs) >= REASSEMBLY_TIMEOUT_MS))
+            drop(&slots[i]);
+}
+
+uint32_t Reassembly::take_dropped() {
+    uint32_t ret = dropped;
+    dropped = 0;
+    return ret;
+}
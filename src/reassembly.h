@@ -0,0 +1,49 @@
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+#include <stdint.h>
+
+#include <lwip/pbuf.h>
+
+#include "packet_framing.h"
+
+// Serial->WiFi datagrams that come in FRAME_TYPE_FRAGMENT frames
+// Each fragment is copied into its own pbuf from pbufPool and chained onto the ones before it, so the chain can be
+// handed to lwIP as it is. Datagrams of more than FRAME_MAX_FRAGMENTS fragments are dropped
+
+// Datagrams being put together at the same time, a new one replaces the oldest
+#define REASSEMBLY_SLOTS 2
+// Dropped if no fragment of it came in for this long
+#define REASSEMBLY_TIMEOUT_MS 200
+
+class Reassembly {
+public:
+    Reassembly();
+    ~Reassembly();
+
+    // Returns the datagram once its last fragment is in, the caller has to pbuf_free() it
+    pbuf* add(const FrameInfo& info, const uint8_t* data, uint16_t len);
+    void expire(uint32_t nowMs);
+
+    // Datagrams lost to missing fragments, timeouts or allocation failures, since the last call
+    uint32_t take_dropped();
+
+private:
+    struct Slot {
+        // NULL if the slot is free
+        pbuf* p;
+        frame_address_t address;
+        uint16_t localPort, remotePort;
+        uint8_t datagramId;
+        uint16_t nextIndex, count;
+        uint32_t lastMs;
+    };
+
+    Slot* find(const FrameInfo& info);
+    void drop(Slot* slot);
+
+    Slot slots[REASSEMBLY_SLOTS];
+    uint32_t dropped;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "retransmit.h"
+
+#include <string.h>
+
+
+RetransmitRing::RetransmitRing() : nextSlot(0), writePos(0) {
+    for (int i = 0; i < RETRANSMIT_SLOTS; i++)
+        slots[i].used = false;
+}
+
+uint8_t* RetransmitRing::reserve(uint16_t sequence, uint16_t length) {
+    if ((length == 0) || (length > RETRANSMIT_BYTES))
+        return NULL;
+
+    // Frames are kept in one piece
+    if ((writePos + length) > RETRANSMIT_BYTES)
+        writePos = 0;
+    for (int i = 0; i < RETRANSMIT_SLOTS; i++) {
+        Slot* s = &slots[i];
+        if (s->used && (s->start < (writePos + length)) && (writePos < (s->start + s->length)))
+            s->used = false;
+    }
+
+    Slot* slot = &slots[nextSlot];
+    nextSlot = (nextSlot + 1) % RETRANSMIT_SLOTS;
+    slot->sequence = sequence;
+    slot->start = writePos;
+    slot->length = length;
+    slot->used = true;
+    writePos += length;
+    return &buffer[slot->start];
+}
+
+const uint8_t* RetransmitRing::find(uint16_t sequence, uint16_t* length) const {
+    for (int i = 0; i < RETRANSMIT_SLOTS; i++) {
+        const Slot* s = &slots[i];
+        if (s->used && (s->sequence == sequence)) {
+            *length = s->length;
+            return &buffer[s->start];
+        }
+    }
+    return NULL;
+}
+
+
+SequenceTracker::SequenceTracker(bool nack) : nack(nack), started(false), expected(0), missingCount(0), lost(0), recovered(0) {}
+
+void SequenceTracker::add_missing(uint16_t sequence, uint32_t nowMs) {
+    if (missingCount == NACK_MAX_MISSING) {
+        // Missing frames are added in order, so the first one is the oldest
+        memmove(&missing[0], &missing[1], (NACK_MAX_MISSING - 1) * sizeof(Missing));
+        missingCount--;
+    }
+    Missing* m = &missing[missingCount++];
+    m->sequence = sequence;
+    m->tries = 0;
+    m->nextMs = nowMs;
+}
+
+bool SequenceTracker::received(uint16_t sequence, bool retransmitted, uint32_t nowMs) {
+    if (retransmitted) {
+        for (uint8_t i = 0; i < missingCount; i++) {
+            if (missing[i].sequence != sequence)
+                continue;
+            memmove(&missing[i], &missing[i + 1], (missingCount - i - 1) * sizeof(Missing));
+            missingCount--;
+            recovered++;
+            return true;
+        }
+        return false;
+    }
+
+    // More than half the sequence space behind means the other side started over without its first frame coming through
+    uint16_t gap = sequence - expected;
+    if (!started || (sequence == 0) || (gap >= 0x8000)) {
+        started = true;
+        missingCount = 0;
+        expected = sequence;
+        gap = 0;
+    }
+    // 0 is skipped when wrapping
+    if ((gap > 0) && (sequence < expected))
+        gap--;
+
+    lost += gap;
+    if (nack) {
+        // Only the newest ones of a long run, the rest would be given up anyway
+        uint16_t first = (gap > NACK_MAX_MISSING) ? (sequence - NACK_MAX_MISSING) : expected;
+        for (uint16_t s = first; s != sequence; s++)
+            if (s != 0)
+                add_missing(s, nowMs);
+    }
+
+    expected = sequence + 1;
+    if (expected == 0)
+        expected = 1;
+    return true;
+}
+
+size_t SequenceTracker::take_nacks(uint32_t nowMs, uint16_t* out) {
+    size_t count = 0;
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < missingCount; i++) {
+        Missing m = missing[i];
+        if ((int32_t)(nowMs - m.nextMs) >= 0) {
+            // Given up once the last try had its time
+            if (m.tries == NACK_TRIES)
+                continue;
+            out[count++] = m.sequence;
+            m.tries++;
+            m.nextMs = nowMs + NACK_RETRY_MS;
+        }
+        missing[kept++] = m;
+    }
+    missingCount = kept;
+    return count;
+}
+
+uint32_t SequenceTracker::take_lost() {
+    uint32_t ret = lost;
+    lost = 0;
+    return ret;
+}
+
+uint32_t SequenceTracker::take_recovered() {
+    uint32_t ret = recovered;
+    recovered = 0;
+    return ret;
+}
@@ -0,0 +1,90 @@
+#ifndef RETRANSMIT_H
+#define RETRANSMIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Serial link loss accounting and retransmission
+// Every frame carries a sequence number counting the frames sent in its direction(see packet_framing.h), so the
+// receiver can tell frames lost on the link from datagrams lost before they got to the dongle
+// A sender starts at 0 and skips it when the counter wraps, so 0 always means the other side just started
+// DATA frames of reliable ports are kept by the sender, carry FRAME_FLAG_RELIABLE and are counted in a sequence of
+// their own. The receiver asks for gaps in that one in FRAME_TYPE_NACK frames and the sender sends the frames again
+// with FRAME_FLAG_RETRANSMIT. Gaps in the other frames are only counted, nothing could be sent again for them
+// A lost frame is only noticed once the next one of its sequence comes in, and retransmitted frames arrive out of order
+// host/retransmit.py has the same logic
+
+// Kept frames, type..payload. The oldest one is replaced by a new one that doesn't fit
+#ifndef RETRANSMIT_BYTES
+#define RETRANSMIT_BYTES 1024
+#endif
+#define RETRANSMIT_SLOTS 16
+
+// Missing frames being asked for at a time, the oldest one is given up for a new one
+// Also the most sequence numbers in one NACK frame
+#define NACK_MAX_MISSING 16
+// Asked for again if the frame doesn't come within this long, up to NACK_TRIES times
+#define NACK_RETRY_MS 30
+#define NACK_TRIES 3
+
+class RetransmitRing {
+public:
+    RetransmitRing();
+
+    // Room for a frame of length bytes, NULL if it can't be kept
+    uint8_t* reserve(uint16_t sequence, uint16_t length);
+    // The kept frame, NULL if it isn't kept(anymore)
+    const uint8_t* find(uint16_t sequence, uint16_t* length) const;
+
+private:
+    struct Slot {
+        uint16_t sequence;
+        uint16_t start, length;
+        bool used;
+    };
+
+    Slot slots[RETRANSMIT_SLOTS];
+    // Slot reserve uses next, they are taken in turn
+    uint8_t nextSlot;
+    uint16_t writePos;
+    uint8_t buffer[RETRANSMIT_BYTES];
+};
+
+class SequenceTracker {
+public:
+    // nack - ask for missing frames, otherwise only count them
+    explicit SequenceTracker(bool nack);
+
+    // Call for every frame with a good CRC
+    // Returns false for a retransmitted frame that isn't missing(anymore), it was delivered already
+    bool received(uint16_t sequence, bool retransmitted, uint32_t nowMs);
+
+    // Sequence numbers to ask for now, writes up to NACK_MAX_MISSING to out and returns how many
+    size_t take_nacks(uint32_t nowMs, uint16_t* out);
+    // Whether take_nacks will have something to return later
+    bool nacks_pending() const { return missingCount > 0; }
+
+    // Counters since the last call
+    // Frames that never arrived, including the ones recovered later
+    uint32_t take_lost();
+    // Frames that arrived after being NACKed
+    uint32_t take_recovered();
+
+private:
+    struct Missing {
+        uint16_t sequence;
+        uint8_t tries;
+        uint32_t nextMs;
+    };
+
+    void add_missing(uint16_t sequence, uint32_t nowMs);
+
+    const bool nack;
+    bool started;
+    uint16_t expected;
+    Missing missing[NACK_MAX_MISSING];
+    uint8_t missingCount;
+    uint32_t lost, recovered;
+};
+
+#endif
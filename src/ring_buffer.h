@@ -0,0 +1,58 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+
+// Lock-free single producer, single consumer ring of bytes
+// The producer only stores head and the consumer only stores tail, with release ordering so the data is visible
+// before the index that publishes it. That holds between an interrupt handler and the main loop as well as between
+// tasks on different cores or threads. Only loads and stores, the LX106 has no atomic read-modify-write
+// SIZE has to be a power of two, head and tail are free-running and only masked on access
+// Reading and writing is done in place on contiguous spans:
+//   ptr = write_span(&len); fill up to len bytes; commit_write(n);
+//   ptr = read_span(&len); consume up to len bytes; commit_read(n);
+template<size_t SIZE>
+class RingBuffer {
+    static_assert((SIZE & (SIZE - 1)) == 0, "RingBuffer size must be a power of two");
+
+public:
+    RingBuffer() : head(0), tail(0) {}
+
+    // Exact on the consumer side, a lower bound anywhere else
+    size_t available() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    // Exact on the producer side, a lower bound anywhere else
+    size_t space() const { return SIZE - available(); }
+    // Only while neither side runs
+    void clear() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer
+    uint8_t* write_span(size_t* len) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t idx = h & (SIZE - 1);
+        *len = std::min(SIZE - (h - tail.load(std::memory_order_acquire)), SIZE - idx);
+        return &buffer[idx];
+    }
+    void commit_write(size_t len) { head.store(head.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+
+    // Consumer
+    uint8_t* read_span(size_t* len) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t idx = t & (SIZE - 1);
+        *len = std::min(head.load(std::memory_order_acquire) - t, SIZE - idx);
+        return &buffer[idx];
+    }
+    void commit_read(size_t len) { tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+
+private:
+    std::atomic<size_t> head, tail;
+    uint8_t buffer[SIZE];
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <Arduino.h>
+
+#include "telemetry.h"
+
+
+struct TrackerStats {
+    bool used;
+    bool seen;
+    uint32_t lastSeenMs;
+    TelemetryTracker counters;
+};
+
+static TrackerStats trackers[TELEMETRY_TRACKERS];
+static uint8_t frameBuffer[TELEMETRY_MAX_SIZE];
+
+static TrackerStats* find_tracker(frame_address_t fullAddress, bool add) {
+    uint8_t address = frame_address_last_byte(fullAddress);
+    for (int i = 0; i < TELEMETRY_TRACKERS; i++)
+        if (trackers[i].used && (trackers[i].counters.address == address))
+            return &trackers[i];
+    if (!add)
+        return NULL;
+
+    // A free one, otherwise the one not seen for the longest time
+    TrackerStats* t = &trackers[0];
+    uint32_t maxAge = 0;
+    uint32_t now = millis();
+    for (int i = 0; i < TELEMETRY_TRACKERS; i++) {
+        if (!trackers[i].used) {
+            t = &trackers[i];
+            break;
+        }
+        uint32_t age = trackers[i].seen ? (now - trackers[i].lastSeenMs) : TELEMETRY_NEVER;
+        if (age > maxAge) {
+            maxAge = age;
+            t = &trackers[i];
+        }
+    }
+
+    memset(t, 0, sizeof(TrackerStats));
+    t->used = true;
+    t->counters.address = address;
+    return t;
+}
+
+void telemetry_seen(frame_address_t address) {
+    TrackerStats* t = find_tracker(address, true);
+    t->seen = true;
+    t->lastSeenMs = millis();
+}
+
+void telemetry_wifi2serial(frame_address_t address, uint16_t len) {
+    TrackerStats* t = find_tracker(address, true);
+    t->counters.wifi2serialPackets++;
+    t->counters.wifi2serialBytes += len;
+}
+
+void telemetry_serial2wifi(frame_address_t address, uint16_t len) {
+    TrackerStats* t = find_tracker(address, true);
+    t->counters.serial2wifiPackets++;
+    t->counters.serial2wifiBytes += len;
+}
+
+void telemetry_send_error(frame_address_t address) {
+    find_tracker(address, true)->counters.sendErrors++;
+}
+
+void telemetry_dropped(frame_address_t address, uint32_t count) {
+    find_tracker(address, true)->counters.dropped += count;
+}
+
+void telemetry_crc_failure(frame_address_t address) {
+    TrackerStats* t = find_tracker(address, false);
+    if (t != NULL)
+        t->counters.crcFailures++;
+}
+
+uint16_t telemetry_size() {
+    uint16_t count = 0;
+    for (int i = 0; i < TELEMETRY_TRACKERS; i++)
+        count += trackers[i].used;
+    return sizeof(TelemetryGlobals) + 1 + count * sizeof(TelemetryTracker);
+}
+
+const uint8_t* telemetry_build(const TelemetryGlobals& globals, uint16_t* outputLength) {
+    memcpy(frameBuffer, &globals, sizeof(globals));
+    uint8_t* countPtr = &frameBuffer[sizeof(globals)];
+    uint8_t* ptr = countPtr + 1;
+    *countPtr = 0;
+
+    uint32_t now = millis();
+    for (int i = 0; i < TELEMETRY_TRACKERS; i++) {
+        TrackerStats* t = &trackers[i];
+        if (!t->used)
+            continue;
+
+        t->counters.lastSeenAgoMs = t->seen ? (now - t->lastSeenMs) : TELEMETRY_NEVER;
+        memcpy(ptr, &t->counters, sizeof(TelemetryTracker));
+        ptr += sizeof(TelemetryTracker);
+        (*countPtr)++;
+
+        uint8_t address = t->counters.address;
+        memset(&t->counters, 0, sizeof(TelemetryTracker));
+        t->counters.address = address;
+    }
+
+    *outputLength = ptr - frameBuffer;
+    return frameBuffer;
+}
@@ -0,0 +1,98 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#include "framing_profile.h"
+
+// Stats for the host, sent as FRAME_TYPE_TELEMETRY frames(see packet_framing.h) instead of text on the data stream
+// Header: kind(1), one of TELEMETRY_*
+// TELEMETRY_STATS payload: TelemetryGlobals, tracker count(1), TelemetryTracker for each tracker. All counters are since
+// the previous frame
+// host/slime_ap.py decodes it, keep the two in sync
+#define TELEMETRY_STATS 0
+// Asked for with CONTROL_LATENCY_REPORT, see latency.h
+#define TELEMETRY_LATENCY 1
+// Asked for with CONTROL_PROFILER_REPORT, a frame per stage, see loop_profiler.h
+#define TELEMETRY_PROFILE 2
+
+// Trackers(by the last address byte) with counters kept, the one not seen for the longest time is replaced
+#define TELEMETRY_TRACKERS 16
+
+struct __attribute__((packed)) TelemetryGlobals {
+    // Since the previous frame
+    uint32_t intervalMs;
+    uint32_t loops;
+    uint32_t baud;
+    // FRAMING_*
+    uint8_t framing;
+    // Serial frames from the host
+    uint32_t badFrames;
+    uint32_t repairedChunks;
+    // Dropped datagrams or bytes
+    uint32_t udpQueueDropped;
+    uint32_t serialRxDroppedBytes;
+    uint32_t txQueueDropped;
+    uint32_t incompleteFragmented;
+    // Current state of the WiFi->serial queue, max depth is since the previous frame
+    uint16_t txQueueDepth;
+    uint16_t txQueueMaxDepth;
+    uint32_t txQueueBytes;
+    uint32_t txQueueBudget;
+    uint16_t uartTxFree;
+    // Queued datagrams replaced by newer ones(see coalesce.h), and how long datagrams waited from arriving
+    // until they were framed, average and max
+    uint32_t txSuperseded;
+    uint32_t txAgeAvgUs;
+    uint32_t txAgeMaxUs;
+    // Host frames that never arrived, the ones of them that came after a NACK, and frames sent again for host NACKs
+    // See retransmit.h
+    uint32_t framesLost;
+    uint32_t framesRecovered;
+    uint32_t framesResent;
+    // See delta.h
+    uint32_t keyframes;
+    uint32_t deltas;
+    uint32_t savedBytes;
+    // Lowest free heap and largest free block since the previous frame. Nothing after setup() should need the heap,
+    // lwIP aside, so these stay flat on a healthy dongle
+    uint32_t heapFreeMin;
+    uint32_t heapMaxBlockMin;
+    // See pbuf_pool.h, buffers taken now and allocations that found none free
+    uint8_t pbufPoolInUse;
+    uint32_t pbufPoolExhausted;
+};
+
+struct __attribute__((packed)) TelemetryTracker {
+    uint8_t address;
+    uint32_t wifi2serialPackets, wifi2serialBytes;
+    uint32_t serial2wifiPackets, serial2wifiBytes;
+    // Serial->WiFi datagrams lwIP didn't take or for a port that isn't listened on
+    uint32_t sendErrors;
+    // Datagrams lost in a queue or to missing fragments, nothing is cut short anymore since fragmentation
+    uint32_t dropped;
+    // Broken frames from the host that named this tracker, the address might have been broken as well
+    uint32_t crcFailures;
+    // Since a datagram from it came in, TELEMETRY_NEVER if none did
+    uint32_t lastSeenAgoMs;
+};
+
+#define TELEMETRY_NEVER 0xFFFFFFFF
+#define TELEMETRY_MAX_SIZE (sizeof(TelemetryGlobals) + 1 + TELEMETRY_TRACKERS * sizeof(TelemetryTracker))
+
+// Datagram received from a tracker
+void telemetry_seen(frame_address_t address);
+void telemetry_wifi2serial(frame_address_t address, uint16_t len);
+void telemetry_serial2wifi(frame_address_t address, uint16_t len);
+void telemetry_send_error(frame_address_t address);
+void telemetry_dropped(frame_address_t address, uint32_t count = 1);
+// Only counted for trackers already known, a broken frame shouldn't add one
+void telemetry_crc_failure(frame_address_t address);
+
+// Size of the payload telemetry_build would return now
+uint16_t telemetry_size();
+// Returned pointer - FRAME_TYPE_TELEMETRY payload of length outputLength, valid until the next call
+// Starts counting again from 0
+const uint8_t* telemetry_build(const TelemetryGlobals& globals, uint16_t* outputLength);
+
+#endif
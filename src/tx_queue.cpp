@@ -0,0 +1,294 @@
+#include "tx_queue.h"
+
+#include <string.h>
+
+#include "coalesce.h"
+#include "telemetry.h"
+
+
+TxQueue::TxQueue(uint16_t chunkBytes) : nextId(0), chunk(chunkBytes), trackerCount(0), current(0), count(0), maxDepth(0), totalBytes(0), budget(TX_QUEUE_BYTES), policy(TX_DROP_POLICY), coalesceRules(COALESCE_RULES_ENABLED), dropped(0), superseded(0) {
+    for (uint8_t i = 0; i < TX_QUEUE_LEN; i++)
+        entries[i].next = (i + 1 < TX_QUEUE_LEN) ? (i + 1) : NO_ENTRY;
+    freeList = 0;
+}
+
+int TxQueue::find_tracker(frame_address_t address) const {
+    for (uint8_t i = 0; i < trackerCount; i++)
+        if (trackers[i].address == address)
+            return i;
+    return -1;
+}
+
+void TxQueue::push(pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs) {
+    uint32_t len = p->tot_len;
+    if (len > budget) {
+        pbuf_free(p);
+        dropped++;
+        telemetry_dropped(address);
+        return;
+    }
+
+    // The new datagram counts towards its tracker's share before a victim is picked
+    int idx = find_tracker(address);
+    uint32_t cls = coalesce_class(p, coalesceRules);
+    if ((cls != COALESCE_NONE) && (idx >= 0) && supersede(idx, p, localPort, remotePort, rxTimeUs, cls)) {
+        // Might have grown
+        while (totalBytes > budget)
+            if (!drop_one())
+                break;
+        return;
+    }
+
+    if ((idx < 0) && (trackerCount >= TX_QUEUE_TRACKERS)) {
+        pbuf_free(p);
+        dropped++;
+        telemetry_dropped(address);
+        return;
+    }
+
+    while ((freeList == NO_ENTRY) || ((totalBytes + len) > budget)) {
+        // Over its own share, make room at its own expense
+        bool overQuota = (policy == TX_DROP_OVER_QUOTA) && (idx >= 0) && ((trackers[idx].bytes + len) > (budget / trackerCount));
+        if (!(overQuota && drop_from(idx)) && !drop_one()) {
+            // Only datagrams that are going out are left
+            pbuf_free(p);
+            dropped++;
+            telemetry_dropped(address);
+            return;
+        }
+        idx = find_tracker(address);
+    }
+
+    if (idx < 0) {
+        idx = trackerCount++;
+        Tracker& t = trackers[idx];
+        t.address = address;
+        t.head = t.tail = NO_ENTRY;
+        t.count = 0;
+        t.bytes = 0;
+        // Starts its turn right away if nobody else is waiting
+        t.deficit = (trackerCount == 1) ? TX_QUEUE_QUANTUM : 0;
+    }
+
+    uint8_t e = freeList;
+    freeList = entries[e].next;
+    entries[e].p = p;
+    entries[e].rxTimeUs = rxTimeUs;
+    entries[e].localPort = localPort;
+    entries[e].remotePort = remotePort;
+    entries[e].sent = 0;
+    entries[e].id = nextId++;
+    entries[e].cls = cls;
+    entries[e].next = NO_ENTRY;
+
+    Tracker& t = trackers[idx];
+    if (t.tail == NO_ENTRY)
+        t.head = e;
+    else
+        entries[t.tail].next = e;
+    t.tail = e;
+    t.count++;
+    t.bytes += len;
+
+    count++;
+    totalBytes += len;
+    if (count > maxDepth)
+        maxDepth = count;
+}
+
+bool TxQueue::supersede(uint8_t idx, pbuf* p, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs, uint32_t cls) {
+    Tracker& t = trackers[idx];
+    for (uint8_t e = t.head; e != NO_ENTRY; e = entries[e].next) {
+        Entry& entry = entries[e];
+        if ((entry.cls != cls) || (entry.sent > 0) || (entry.localPort != localPort) || (entry.remotePort != remotePort))
+            continue;
+
+        // Keeps its place in the queue, so the newer data goes out when the older would have
+        t.bytes += p->tot_len - entry.p->tot_len;
+        totalBytes += p->tot_len - entry.p->tot_len;
+        pbuf_free(entry.p);
+        entry.p = p;
+        entry.rxTimeUs = rxTimeUs;
+        superseded++;
+        return true;
+    }
+    return false;
+}
+
+bool TxQueue::find_droppable(uint8_t idx, uint8_t* prev) const {
+    // Only the head goes out in chunks
+    const Tracker& t = trackers[idx];
+    if (entries[t.head].sent == 0) {
+        *prev = NO_ENTRY;
+        return true;
+    }
+    *prev = t.head;
+    return entries[t.head].next != NO_ENTRY;
+}
+
+bool TxQueue::drop_from(uint8_t idx) {
+    uint8_t prev;
+    if (!find_droppable(idx, &prev))
+        return false;
+    remove_entry(idx, prev, true);
+    return true;
+}
+
+bool TxQueue::drop_one() {
+    int victim = -1;
+    uint8_t victimPrev = NO_ENTRY;
+    uint32_t victimTime = 0;
+    for (uint8_t i = 0; i < trackerCount; i++) {
+        uint8_t prev;
+        if (!find_droppable(i, &prev))
+            continue;
+
+        // The entry is the oldest of its tracker that can go
+        uint32_t rxTimeUs = entries[(prev == NO_ENTRY) ? trackers[i].head : entries[prev].next].rxTimeUs;
+        bool better;
+        if (victim < 0)
+            better = true;
+        else if (policy == TX_DROP_OLDEST)
+            better = (int32_t)(rxTimeUs - victimTime) < 0;
+        else
+            better = trackers[i].bytes > trackers[victim].bytes;
+        if (better) {
+            victim = i;
+            victimPrev = prev;
+            victimTime = rxTimeUs;
+        }
+    }
+    if (victim < 0)
+        return false;
+
+    remove_entry(victim, victimPrev, true);
+    return true;
+}
+
+void TxQueue::remove_entry(uint8_t idx, uint8_t prev, bool isDrop) {
+    Tracker& t = trackers[idx];
+    uint8_t e = (prev == NO_ENTRY) ? t.head : entries[prev].next;
+    pbuf* p = entries[e].p;
+
+    if (prev == NO_ENTRY)
+        t.head = entries[e].next;
+    else
+        entries[prev].next = entries[e].next;
+    if (t.tail == e)
+        t.tail = prev;
+    t.count--;
+    t.bytes -= p->tot_len;
+    count--;
+    totalBytes -= p->tot_len;
+
+    pbuf_free(p);
+    entries[e].next = freeList;
+    freeList = e;
+
+    if (isDrop) {
+        dropped++;
+        telemetry_dropped(t.address);
+    }
+
+    if (t.count > 0)
+        return;
+
+    // Keep the round-robin order of the rest
+    memmove(&trackers[idx], &trackers[idx + 1], (trackerCount - idx - 1) * sizeof(Tracker));
+    trackerCount--;
+    if (idx < current) {
+        current--;
+    } else if ((idx == current) && (trackerCount > 0)) {
+        // Its turn ended with it, the next one starts
+        if (current >= trackerCount)
+            current = 0;
+        trackers[current].deficit += TX_QUEUE_QUANTUM;
+    }
+    if (current >= trackerCount)
+        current = 0;
+}
+
+uint16_t TxQueue::next_chunk(const Entry& e) const {
+    uint16_t left = e.p->tot_len - e.sent;
+    return (left > chunk) ? chunk : left;
+}
+
+bool TxQueue::peek(TxDatagram* datagram) {
+    if (count == 0)
+        return false;
+
+    // Move on until a tracker has enough deficit for the next chunk of its oldest datagram
+    while (trackers[current].deficit < next_chunk(entries[trackers[current].head])) {
+        current = (current + 1 < trackerCount) ? (current + 1) : 0;
+        trackers[current].deficit += TX_QUEUE_QUANTUM;
+    }
+
+    const Tracker& t = trackers[current];
+    const Entry& e = entries[t.head];
+    datagram->p = e.p;
+    datagram->address = t.address;
+    datagram->localPort = e.localPort;
+    datagram->remotePort = e.remotePort;
+    datagram->rxTimeUs = e.rxTimeUs;
+    datagram->offset = e.sent;
+    datagram->id = e.id;
+    return true;
+}
+
+void TxQueue::advance(uint16_t len) {
+    if (count == 0)
+        return;
+
+    // Called right after peek(), so the current tracker can afford it
+    Tracker& t = trackers[current];
+    Entry& e = entries[t.head];
+    t.deficit -= len;
+    e.sent += len;
+    if (e.sent >= e.p->tot_len)
+        remove_entry(current, NO_ENTRY, false);
+}
+
+bool TxQueue::set_budget(uint32_t budgetBytes) {
+    if ((budgetBytes < 1) || (budgetBytes > TX_QUEUE_MAX_BYTES))
+        return false;
+
+    budget = budgetBytes;
+    // What is going out stays, even over the new budget
+    while (totalBytes > budget)
+        if (!drop_one())
+            break;
+    return true;
+}
+
+bool TxQueue::set_coalesce(uint32_t enabledRules) {
+    if (enabledRules & ~coalesce_rules_mask())
+        return false;
+    // Queued datagrams keep their class, they just aren't replaced anymore once it is off
+    coalesceRules = enabledRules;
+    return true;
+}
+
+bool TxQueue::set_policy(uint8_t dropPolicy) {
+    if (dropPolicy > TX_DROP_OVER_QUOTA)
+        return false;
+    policy = dropPolicy;
+    return true;
+}
+
+uint32_t TxQueue::take_dropped() {
+    uint32_t ret = dropped;
+    dropped = 0;
+    return ret;
+}
+
+uint16_t TxQueue::take_max_depth() {
+    uint16_t ret = maxDepth;
+    maxDepth = count;
+    return ret;
+}
+
+uint32_t TxQueue::take_superseded() {
+    uint32_t ret = superseded;
+    superseded = 0;
+    return ret;
+}
@@ -0,0 +1,139 @@
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <lwip/pbuf.h>
+
+#include "framing_profile.h"
+
+// WiFi->serial datagrams waiting for room in the UART TX ring
+// Each tracker(by its address) has its own FIFO and they are served deficit round-robin:
+// every turn a tracker may send up to TX_QUEUE_QUANTUM more payload bytes, so the serial link is shared
+// by bytes rather than by datagrams and a tracker sending big bursts can't push the others out
+// The pbufs are held as they came from lwIP, the budget is in payload bytes
+// With coalescing on, a newer datagram of the same class replaces a queued one in place, see coalesce.h
+
+// Maximum datagrams and trackers with something queued
+#define TX_QUEUE_LEN 32
+#define TX_QUEUE_TRACKERS 16
+// Default budget, can be changed at runtime up to TX_QUEUE_MAX_BYTES
+#ifndef TX_QUEUE_BYTES
+#define TX_QUEUE_BYTES 4096
+#endif
+#define TX_QUEUE_MAX_BYTES 65535
+#define TX_QUEUE_QUANTUM 128
+
+// What gets dropped when a new datagram doesn't fit:
+// TX_DROP_OLDEST     - the oldest queued datagram, whichever tracker it belongs to
+// TX_DROP_OVER_QUOTA - the oldest datagram of the tracker holding the most bytes, so one tracker flooding
+//                      the dongle only loses its own data while the others stay under their share
+// A datagram that started going out is never dropped, the host would be left with part of its fragments.
+// The next one of that tracker is taken instead, and the new datagram if nothing else can go
+#define TX_DROP_OLDEST 0
+#define TX_DROP_OVER_QUOTA 1
+
+#ifndef TX_DROP_POLICY
+#define TX_DROP_POLICY TX_DROP_OVER_QUOTA
+#endif
+
+struct TxDatagram {
+    const pbuf* p;
+    frame_address_t address;
+    uint16_t localPort, remotePort;
+    uint32_t rxTimeUs;
+    // Bytes already sent, for datagrams that go out in chunks
+    uint16_t offset;
+    // Different for every datagram queued(wraps around), tells apart fragments of different datagrams
+    uint8_t id;
+};
+
+class TxQueue {
+public:
+    // Datagrams longer than chunkBytes are sent chunkBytes at a time, other trackers get their turns in between
+    TxQueue(uint16_t chunkBytes);
+
+    // Takes over the pbuf reference, it is freed once sent or dropped
+    void push(pbuf* p, frame_address_t address, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs);
+
+    // Datagram of the tracker whose turn it is, false if the queue is empty
+    bool peek(TxDatagram* datagram);
+    // Marks len more bytes of the datagram returned by peek() as sent, it is removed once all of it is
+    void advance(uint16_t len);
+
+    bool empty() const { return count == 0; }
+    uint16_t depth() const { return count; }
+    uint32_t bytes() const { return totalBytes; }
+
+    // 1..TX_QUEUE_MAX_BYTES, datagrams above the new budget are dropped right away
+    bool set_budget(uint32_t budgetBytes);
+    uint32_t get_budget() const { return budget; }
+    bool set_policy(uint8_t dropPolicy);
+    uint8_t get_policy() const { return policy; }
+    // Bit n enables coalescing rule n, 0 turns it off
+    bool set_coalesce(uint32_t enabledRules);
+    uint32_t get_coalesce() const { return coalesceRules; }
+
+    // Since the last call
+    uint32_t take_dropped();
+    uint16_t take_max_depth();
+    // Datagrams replaced by a newer one before they went out
+    uint32_t take_superseded();
+
+private:
+    struct Entry {
+        pbuf* p;
+        uint32_t rxTimeUs;
+        uint16_t localPort, remotePort;
+        uint16_t sent;
+        uint8_t id;
+        // coalesce_class() of the datagram
+        uint32_t cls;
+        // Next entry of the same tracker, NO_ENTRY at the tail
+        uint8_t next;
+    };
+
+    struct Tracker {
+        frame_address_t address;
+        uint8_t head, tail;
+        uint8_t count;
+        uint32_t bytes;
+        // Payload bytes it may still send this turn
+        uint32_t deficit;
+    };
+
+    static const uint8_t NO_ENTRY = 0xFF;
+
+    // Puts the datagram in place of a queued one of the same class that didn't start going out, false if there is none
+    bool supersede(uint8_t idx, pbuf* p, uint16_t localPort, uint16_t remotePort, uint32_t rxTimeUs, uint32_t cls);
+    // Drops one datagram according to the policy, returns false if there was nothing to drop
+    bool drop_one();
+    // Entry before the oldest datagram of trackers[idx] that didn't start going out, NO_ENTRY for the head
+    // Returns false if it has none
+    bool find_droppable(uint8_t idx, uint8_t* prev) const;
+    // Drops the oldest datagram of trackers[idx] that didn't start going out, false if it has none
+    bool drop_from(uint8_t idx);
+    // Removes the entry after prev(the head for NO_ENTRY) of trackers[idx], and the tracker once it has nothing left
+    void remove_entry(uint8_t idx, uint8_t prev, bool isDrop);
+    int find_tracker(frame_address_t address) const;
+    uint16_t next_chunk(const Entry& e) const;
+
+    Entry entries[TX_QUEUE_LEN];
+    uint8_t freeList;
+    uint8_t nextId;
+    uint16_t chunk;
+
+    // Only trackers with something queued, in round-robin order
+    Tracker trackers[TX_QUEUE_TRACKERS];
+    uint8_t trackerCount;
+    uint8_t current;
+
+    uint16_t count, maxDepth;
+    uint32_t totalBytes, budget;
+    uint8_t policy;
+    uint32_t coalesceRules;
+    uint32_t dropped, superseded;
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <coredecls.h>
+#include <esp8266_peri.h>
+#include <ets_sys.h>
+
+#include "uart.h"
+
+#include "loop_profiler.h"
+
+// UART0, same as Serial
+#define UART_NUM 0
+#define UART_FIFO_SIZE 128
+
+RingBuffer<UART_RX_RING_SIZE> uartRx;
+RingBuffer<UART_TX_RING_SIZE> uartTx;
+
+static volatile uint32_t droppedBytes = 0;
+// TX FIFO empty interrupt is enabled
+static volatile bool txActive = false;
+static volatile size_t txWakeLevel = 0;
+
+// Runs from IRAM, the ring buffer methods get inlined into it
+static void IRAM_ATTR uart_rx_fill() {
+    uint32_t count = (USS(UART_NUM) >> USRXC) & 0xFF;
+    bool received = count > 0;
+    while (count > 0) {
+        size_t space = 0;
+        uint8_t* ptr = uartRx.write_span(&space);
+        if (space == 0)
+            break;
+
+        size_t n = std::min((size_t)count, space);
+        for (size_t i = 0; i < n; i++)
+            ptr[i] = USF(UART_NUM);
+        uartRx.commit_write(n);
+        count -= n;
+    }
+
+    // The main loop fell behind, the FIFO still has to be emptied or the interrupt fires again right away
+    if (count > 0)
+        droppedBytes = droppedBytes + count;
+    while (count--) {
+        uint8_t discarded = USF(UART_NUM);
+        (void)discarded;
+    }
+
+    if (received)
+        esp_schedule();
+}
+
+// Called with the UART interrupt disabled or from the handler itself
+static void IRAM_ATTR uart_tx_fill() {
+    size_t room = UART_FIFO_SIZE - ((USS(UART_NUM) >> USTXC) & 0xFF);
+    while (room > 0) {
+        size_t len = 0;
+        const uint8_t* ptr = uartTx.read_span(&len);
+        if (len == 0)
+            break;
+
+        size_t n = std::min(room, len);
+        for (size_t i = 0; i < n; i++)
+            USF(UART_NUM) = ptr[i];
+        uartTx.commit_read(n);
+        room -= n;
+    }
+
+    if (uartTx.available() == 0) {
+        USIE(UART_NUM) &= ~(1 << UIFE);
+        txActive = false;
+    }
+
+    if ((txWakeLevel > 0) && (uartTx.available() < txWakeLevel)) {
+        txWakeLevel = 0;
+        esp_schedule();
+    }
+}
+
+static void IRAM_ATTR uart_isr(void* arg, void* frame) {
+    uint32_t status = USIS(UART_NUM);
+    if (status & (1 << UIOF))
+        droppedBytes = droppedBytes + 1;
+
+    if (status & ((1 << UIFF) | (1 << UIOF) | (1 << UITO)))
+        uart_rx_fill();
+    if (status & (1 << UIFE))
+        uart_tx_fill();
+
+    USIC(UART_NUM) = status;
+}
+
+static void uart_tx_start() {
+    if (txActive)
+        return;
+
+    ETS_UART_INTR_DISABLE();
+    txActive = true;
+    USIE(UART_NUM) |= (1 << UIFE);
+    ETS_UART_INTR_ENABLE();
+}
+
+static void uart_tx_copy(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t space = 0;
+        uint8_t* ptr = uartTx.write_span(&space);
+        if (space == 0) {
+            // Full, feed the FIFO directly instead of waiting for the interrupt
+            // Doesn't yield, printf may be called from places where that isn't allowed
+            ETS_UART_INTR_DISABLE();
+            uart_tx_fill();
+            ETS_UART_INTR_ENABLE();
+            continue;
+        }
+
+        size_t n = std::min(len, space);
+        memcpy(ptr, data, n);
+        uartTx.commit_write(n);
+        data += n;
+        len -= n;
+    }
+
+    uart_tx_start();
+}
+
+// printf/os_printf output, not profiled so that printing the profile doesn't add to it
+static void uart_putc(char c) {
+    uart_tx_copy((const uint8_t*)&c, 1);
+}
+
+void uart_begin() {
+    ETS_UART_INTR_DISABLE();
+    ETS_UART_INTR_ATTACH(uart_isr, NULL);
+
+    USC1(UART_NUM) = (UART_RX_FIFO_THRESHOLD << UCFFT) | (UART_TX_FIFO_THRESHOLD << UCFET) | (UART_RX_TIMEOUT << UCTOT) | (1UL << UCTOE);
+    USIC(UART_NUM) = 0xFFFF;
+    USIE(UART_NUM) = (1 << UIFF) | (1 << UIOF) | (1 << UITO);
+
+    ETS_UART_INTR_ENABLE();
+
+    ets_install_putc1(uart_putc);
+}
+
+uint32_t uart_rx_take_dropped() {
+    ETS_UART_INTR_DISABLE();
+    uint32_t ret = droppedBytes;
+    droppedBytes = 0;
+    ETS_UART_INTR_ENABLE();
+    return ret;
+}
+
+void uart_tx_write(const uint8_t* data, size_t len) {
+    ProfileScope scope(STAGE_UART_WRITE);
+    uart_tx_copy(data, len);
+}
+
+size_t uart_tx_space() {
+    return uartTx.space();
+}
+
+size_t uart_tx_pending() {
+    return uartTx.available();
+}
+
+void uart_tx_wake_below(size_t pending) {
+    txWakeLevel = pending;
+    uart_tx_start();
+}
+
+void uart_tx_flush() {
+    while (uartTx.available() > 0) {
+        ETS_UART_INTR_DISABLE();
+        uart_tx_fill();
+        ETS_UART_INTR_ENABLE();
+    }
+    Serial.flush();
+}
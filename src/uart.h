@@ -0,0 +1,44 @@
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ring_buffer.h"
+
+// UART0 without polling or blocking, both directions go through ring buffers serviced by one interrupt handler
+// RX: bytes are moved from the hardware FIFO straight into uartRx and the main loop is woken with esp_schedule()
+// TX: uart_tx_write() only copies into uartTx, the TX FIFO empty interrupt keeps the FIFO topped up from it
+// Replaces the core's interrupt handler, so Serial.available()/read()/write() must not be used after uart_begin()
+// printf output is redirected into uartTx as well, so text never lands in the middle of a frame
+#define UART_RX_RING_SIZE 1024
+// Has to hold at least one frame of the largest kind
+#define UART_TX_RING_SIZE 2048
+
+// Interrupt once this many bytes are in the 128 byte RX FIFO...
+#define UART_RX_FIFO_THRESHOLD 32
+// ...or once the line was idle for this many byte times
+#define UART_RX_TIMEOUT 2
+// Refill the TX FIFO once fewer bytes than this are left in it
+#define UART_TX_FIFO_THRESHOLD 16
+
+extern RingBuffer<UART_RX_RING_SIZE> uartRx;
+extern RingBuffer<UART_TX_RING_SIZE> uartTx;
+
+// Call after Serial.begin()
+void uart_begin();
+
+// Bytes lost to a full ring or a FIFO overflow since the last call
+uint32_t uart_rx_take_dropped();
+
+// Queues data for sending. Only waits if uartTx is full, check uart_tx_space() first to avoid that
+void uart_tx_write(const uint8_t* data, size_t len);
+size_t uart_tx_space();
+// Bytes in uartTx that haven't made it to the FIFO yet
+size_t uart_tx_pending();
+// Wakes the main loop with esp_schedule() once less than this is pending
+void uart_tx_wake_below(size_t pending);
+// Waits until everything queued has left the TX FIFO
+void uart_tx_flush();
+
+#endif